@@ -38,3 +38,16 @@ def filter_dataframe(df, dictionary):
     for key, value in dictionary.items():
         df = df[df[key] == value]
     return df
+
+
+def telemetry_as_dataframe(log, name):
+    """
+    Convert the telemetry records of the log into a DataFrame.
+
+    Only records with the given name are taken into account. Each record
+    field is converted into a column, indexed by the record timestamp.
+    """
+    records = [x for x in log if x[2] == 'telemetry' and x[3] == name]
+    df = DataFrame([x[-1] for x in records], index=[x[0] for x in records])
+    df.index.name = 'timestamp'
+    return df
@@ -21,9 +21,10 @@ from osbrain import (
     run_nameserver,
 )
 
-from analysis import explode_yaml_series
-from analysis import filter_dataframe
 from analysis import log_as_dataframe
+from analysis import telemetry_as_dataframe
+from telemetry import Frame
+from telemetry import TelemetryDecoder
 
 
 matplotlib.interactive(True)
@@ -67,7 +68,7 @@ def plot_top_bottom(df, top, bottom, title=''):
 class Proxy(Agent):
     def on_init(self):
         self.log = []
-        self.buffer = b''
+        self.decoder = TelemetryDecoder()
         self.log_filter = None
         self.filtered = None
         self.spinete_pub = self.bind('PUB',
@@ -110,20 +111,21 @@ class Proxy(Agent):
         self.send('spinete', pickle.dumps((fields[2], log[0], fields[3])))
 
     def process_received(self, received):
-        self.buffer += received
-        if b'\n' not in self.buffer:
-            return 0
-        splits = self.buffer.split(b'\n')
-        for message in splits[:-1]:
+        messages = self.decoder.feed(received)
+        for message in messages:
+            if isinstance(message, Frame):
+                self.log.append((message.timestamp / 1000., 'DATA',
+                                 'telemetry', message.name, message.values))
+                continue
             fields = message.split(b',')
-            log = [x.decode('utf-8') for x in fields[:4]]
+            log = [x.decode('utf-8', 'replace') for x in fields[:4]]
             try:
                 log[0] = float(log[0])
             except ValueError:
                 pass
             body = b','.join(fields[4:])
             if not body.startswith(b'RAW'):
-                body = body.decode('utf-8')
+                body = body.decode('utf-8', 'replace')
             else:
                 raise NotImplementedError()
             log = tuple(log + [body])
@@ -134,8 +136,7 @@ class Proxy(Agent):
                 self.log_filter = None
             self.log.append(log)
             self.publish(log)
-        self.buffer = splits[-1]
-        return len(splits) - 1
+        return len(messages)
 
     def send_bt(self, message):
         for retry in range(3):
@@ -331,14 +332,10 @@ class Bulebule(cmd.Cmd):
 
     def plot_function_top_bottom(self, top, bottom):
         """Plot a linear profile out of the current log data."""
-        df = log_as_dataframe(self.proxy.get_attr('log'))
-        match = dict(level='DATA')
-        df = filter_dataframe(df, match)
-        df = explode_yaml_series(df['data'])
+        df = telemetry_as_dataframe(self.proxy.get_attr('log'), 'control')
         if not len(df):
             print('Empty dataframe...')
             return
-        df.columns = top + bottom
         # Set configuration variables as title
         config = self.proxy.get_configuration_variables()
         title = '\n'.join(wrap(str(config), 120))
@@ -346,13 +343,14 @@ class Bulebule(cmd.Cmd):
 
     def plot_linear_speed_profile(self):
         """Plot a linear profile out of the current log data."""
-        top = ['target_speed', 'ideal_speed', 'left_speed', 'right_speed']
+        top = ['target_linear_speed', 'ideal_linear_speed', 'left_speed',
+               'right_speed']
         bottom = ['pwm_left', 'pwm_right']
         self.plot_function_top_bottom(top, bottom)
 
     def plot_angular_speed_profile(self):
         """Plot the angular speed profile with the current log data."""
-        top = ['ideal_speed', 'angular_speed']
+        top = ['ideal_angular_speed', 'angular_speed']
         bottom = ['pwm_left', 'pwm_right', 'voltage_left', 'voltage_right']
         self.plot_function_top_bottom(top, bottom)
 
@@ -2,6 +2,9 @@ import serial
 import datetime
 import zmq
 
+from telemetry import Frame
+from telemetry import TelemetryDecoder
+
 
 def publish(log):
     body = log[-1]
@@ -13,29 +16,28 @@ def publish(log):
     return fields
 
 
-def process_received(received, buf):
-    buf += received
-    if b'\n' not in buf:
-        return 0
-    splits = buf.split(b'\n')
-    for message in splits[:-1]:
+def process_received(received, decoder):
+    data = None
+    for message in decoder.feed(received):
+        if isinstance(message, Frame):
+            print(message)
+            continue
         fields = message.split(b',')
-        log = [x.decode('utf-8') for x in fields[:4]]
+        log = [x.decode('utf-8', 'replace') for x in fields[:4]]
         try:
             log[0] = float(log[0])
         except ValueError:
             pass
         body = b','.join(fields[4:])
         if not body.startswith(b'RAW'):
-            body = body.decode('utf-8')
+            body = body.decode('utf-8', 'replace')
         else:
             raise NotImplementedError()
         log = tuple(log + [body])
         if log[1] == 'ERROR':
             print(log)
-    buf = splits[-1]
-    prefilt = publish(log)
-    return(prefilt, buf)
+        data = publish(log) or data
+    return data
 
 
 ser = serial.Serial('/dev/ttyUSB0', 921600)
@@ -44,14 +46,16 @@ context = zmq.Context()
 publisher = context.socket(zmq.PUB)
 host = "127.0.0.1"
 publisher.bind('tcp://{}:{}'.format(host, 5000))
-buf = b''
+decoder = TelemetryDecoder()
 log = []
 integ_pc = 0
 while True:
     try:
         i = ser.read(80)
-        data, buf = process_received(i, buf)
+        data = process_received(i, decoder)
         print(data)
+        if data is None:
+            continue
         now = datetime.datetime.utcnow()
         if data[2] == 'gyro_raw':
             gyro_raw = float(data[3])
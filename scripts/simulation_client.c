@@ -6,11 +6,143 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <zmq.h>
 
+#include "maze.h"
+
+/**
+ * Simulation protocol.
+ *
+ * Every request gets a single reply (ZeroMQ REQ/REP). The legacy protocol
+ * makes one round trip per cell:
+ *
+ * - `W x y d`: walls (left, front, right) around the mouse.
+ * - `S x y d C distances C walls`: whole maze state (518 bytes).
+ *
+ * The pipelined protocol makes most round trips unnecessary. A request is a
+ * sequence of commands, only the last one being replied:
+ *
+ * - `B x y r`: absolute walls (`SIM_MAZE_*` bits) of the cells within `r`
+ *   cells of `(x, y)`, row by row from `(x - r, y - r)`. Cells out of the
+ *   maze are surrounded by walls.
+ * - `D x y d n (cell distance walls) * n`: state changes since the last
+ *   `D` command, `n` and `cell` being little-endian 16-bit values.
+ *
+ * State changes are queued and sent along with the next walls query (or at
+ * the end), while walls are cached, so there is a round trip every few cells
+ * only.
+ *
+ * The MMSim server only understands the legacy protocol (and `reset`). The
+ * pipelined protocol is served by the in-process server (`serve()`), which
+ * answers the requests from a maze file without sockets at all and is the
+ * reference implementation for servers willing to support it.
+ */
+#define WALLS_QUERY_RADIUS 2
+#define WALLS_QUERY_SIZE (2 * WALLS_QUERY_RADIUS + 1)
+#define MAX_STATE_SIZE (6 + 4 * MAZE_SIZE * MAZE_SIZE)
+#define MAX_REQUEST_SIZE 4096
+#define MAX_REPLY_SIZE 256
+
+enum protocol {
+	PROTOCOL_LEGACY,
+	PROTOCOL_PIPELINED,
+};
+
+static enum protocol protocol = PROTOCOL_LEGACY;
 static void *requester;
+static uint32_t round_trips;
+
+/* In-process server */
+static bool in_process;
+static struct sim_maze maze;
+static uint8_t server_distances[MAZE_SIZE * MAZE_SIZE];
+static uint8_t server_walls[MAZE_SIZE * MAZE_SIZE];
+
+/* Pipelined protocol client state */
+static bool walls_known[MAZE_SIZE * MAZE_SIZE];
+static uint8_t walls_cache[MAZE_SIZE * MAZE_SIZE];
+static bool state_sent;
+static uint8_t sent_distances[MAZE_SIZE * MAZE_SIZE];
+static uint8_t sent_walls[MAZE_SIZE * MAZE_SIZE];
+static char pending[MAX_REQUEST_SIZE];
+static int pending_size;
+
+/**
+ * @brief Absolute walls of a cell of the loaded maze.
+ */
+static uint8_t cell_walls(int x, int y)
+{
+	static const uint8_t bits[] = {SIM_MAZE_EAST, SIM_MAZE_SOUTH,
+				       SIM_MAZE_WEST, SIM_MAZE_NORTH};
+	uint8_t walls = 0;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (sim_maze_has_wall(&maze, x, y, bits[i]))
+			walls |= bits[i];
+	return walls;
+}
+
+/**
+ * @brief Answer a pipelined protocol request from the loaded maze.
+ *
+ * State changes are applied to a copy of the maze state, so it can be
+ * checked against the client state at the end.
+ *
+ * @return Size of the reply.
+ */
+static int serve(const char *request, int size, char *reply)
+{
+	const uint8_t *command;
+	int position = 0;
+	int count;
+	int cell;
+	int r;
+	int i;
+
+	while (position < size) {
+		command = (const uint8_t *)&request[position];
+		if (command[0] == 'B') {
+			r = command[3];
+			for (i = 0; i < (2 * r + 1) * (2 * r + 1); i++)
+				reply[i] = cell_walls(
+				    command[1] - r + i % (2 * r + 1),
+				    command[2] - r + i / (2 * r + 1));
+			return i;
+		}
+		if (command[0] != 'D')
+			break;
+		count = command[4] | command[5] << 8;
+		for (i = 0; i < count; i++) {
+			cell = command[6 + 4 * i] | command[7 + 4 * i] << 8;
+			server_distances[cell] = command[8 + 4 * i];
+			server_walls[cell] = command[9 + 4 * i];
+		}
+		position += 6 + 4 * count;
+	}
+	reply[0] = 'o';
+	reply[1] = 'k';
+	return 2;
+}
+
+/**
+ * @brief Send a request and wait for its reply.
+ *
+ * @return Size of the reply.
+ */
+static int exchange(const char *request, int size, char *reply,
+		    int reply_size)
+{
+	round_trips++;
+	if (in_process)
+		return serve(request, size, reply);
+	zmq_send(requester, request, size, 0);
+	return zmq_recv(requester, reply, reply_size, 0);
+}
 
 static void wait_response()
 {
@@ -32,11 +164,69 @@ static char encoded_direction(void)
 	return 'X';
 }
 
+/**
+ * @brief Queue the maze state changes since the last queued state.
+ *
+ * The first time, every cell is queued.
+ */
+static void queue_state(void)
+{
+	uint16_t count = 0;
+	int count_position;
+	uint8_t distance;
+	uint8_t walls;
+	int x;
+
+	pending[pending_size++] = 'D';
+	pending[pending_size++] = search_position() % MAZE_SIZE;
+	pending[pending_size++] = search_position() / MAZE_SIZE;
+	pending[pending_size++] = encoded_direction();
+	count_position = pending_size;
+	pending_size += 2;
+	for (x=0; x<MAZE_SIZE*MAZE_SIZE; x++) {
+		distance = read_cell_distance_value(x);
+		walls = read_cell_walls_value(x);
+		if (state_sent && distance == sent_distances[x] &&
+		    walls == sent_walls[x])
+			continue;
+		sent_distances[x] = distance;
+		sent_walls[x] = walls;
+		pending[pending_size++] = x & 0xFF;
+		pending[pending_size++] = x >> 8;
+		pending[pending_size++] = distance;
+		pending[pending_size++] = walls;
+		count++;
+	}
+	state_sent = true;
+	pending[count_position] = count & 0xFF;
+	pending[count_position + 1] = count >> 8;
+}
+
+/**
+ * @brief Send the queued state changes, if any.
+ */
+static void flush_state(void)
+{
+	char reply[MAX_REPLY_SIZE];
+
+	if (!pending_size)
+		return;
+	exchange(pending, pending_size, reply, MAX_REPLY_SIZE);
+	pending_size = 0;
+}
+
 void send_state()
 {
 	char state[2 * (MAZE_SIZE * MAZE_SIZE + 1) + 4];
 	int x;
 
+	if (protocol == PROTOCOL_PIPELINED) {
+		if (pending_size + MAX_STATE_SIZE + 4 > MAX_REQUEST_SIZE)
+			flush_state();
+		queue_state();
+		return;
+	}
+
 	state[0] = 'S';
 	state[1] = search_position() % MAZE_SIZE;
 	state[2] = search_position() / MAZE_SIZE;
@@ -52,21 +242,85 @@ void send_state()
 		    read_cell_walls_value(x);
 	}
 
+	round_trips++;
 	zmq_send(requester, state, 518, 0);
 	wait_response();
 }
 
+/**
+ * @brief Query the walls of the cells around the mouse, caching them.
+ *
+ * Queued state changes are sent in the same request.
+ */
+static void query_walls(int x, int y)
+{
+	char reply[MAX_REPLY_SIZE];
+	int cell_x;
+	int cell_y;
+	int i;
+
+	pending[pending_size++] = 'B';
+	pending[pending_size++] = x;
+	pending[pending_size++] = y;
+	pending[pending_size++] = WALLS_QUERY_RADIUS;
+	if (exchange(pending, pending_size, reply, MAX_REPLY_SIZE) <
+	    WALLS_QUERY_SIZE * WALLS_QUERY_SIZE) {
+		fprintf(stderr, "Unexpected walls reply\n");
+		exit(EXIT_FAILURE);
+	}
+	pending_size = 0;
+	for (i = 0; i < WALLS_QUERY_SIZE * WALLS_QUERY_SIZE; i++) {
+		cell_x = x - WALLS_QUERY_RADIUS + i % WALLS_QUERY_SIZE;
+		cell_y = y - WALLS_QUERY_RADIUS + i / WALLS_QUERY_SIZE;
+		if (cell_x < 0 || cell_y < 0 || cell_x >= MAZE_SIZE ||
+		    cell_y >= MAZE_SIZE)
+			continue;
+		walls_cache[cell_x + cell_y * MAZE_SIZE] = reply[i];
+		walls_known[cell_x + cell_y * MAZE_SIZE] = true;
+	}
+}
+
+/**
+ * @brief Read the walls around the mouse from the walls cache.
+ */
+static struct walls_around read_cached_walls(void)
+{
+	static const uint8_t order[] = {SIM_MAZE_NORTH, SIM_MAZE_EAST,
+					SIM_MAZE_SOUTH, SIM_MAZE_WEST};
+	struct walls_around walls_readings;
+	int position = search_position();
+	uint8_t walls;
+	int front;
+
+	if (!walls_known[position])
+		query_walls(position % MAZE_SIZE, position / MAZE_SIZE);
+	walls = walls_cache[position];
+	for (front = 0; front < 4; front++)
+		if (encoded_direction() == "NESW"[front])
+			break;
+	assert(front < 4);
+
+	walls_readings.left = (bool)(walls & order[(front + 3) % 4]);
+	walls_readings.front = (bool)(walls & order[front]);
+	walls_readings.right = (bool)(walls & order[(front + 1) % 4]);
+	return walls_readings;
+}
+
 struct walls_around read_walls(void)
 {
 	char walls[3] = { 0 };
 	char position_state[4];
 	struct walls_around walls_readings;
 
+	if (protocol == PROTOCOL_PIPELINED)
+		return read_cached_walls();
+
 	position_state[0] = 'W';
 	position_state[1] = search_position() % MAZE_SIZE;
 	position_state[2] = search_position() / MAZE_SIZE;
 	position_state[3] = encoded_direction();
 
+	round_trips++;
 	zmq_send(requester, position_state, 4, 0);
 	zmq_recv(requester, walls, 3, 0);
 
@@ -76,18 +330,59 @@ struct walls_around read_walls(void)
 	return walls_readings;
 }
 
-int main(void)
+/**
+ * @brief Host monotonic clock, in seconds.
+ */
+static double wall_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Explore a simulated maze.
+ *
+ * Usage: `simulation_client [-p] [-m MAZE_FILE]`
+ *
+ * By default, the legacy protocol is used against the server listening on
+ * `tcp://127.0.0.1:6574`. With `-p` the pipelined protocol is used instead,
+ * which the server must support. With `-m` the maze is served in-process
+ * from a text maze file, always with the pipelined protocol.
+ */
+int main(int argc, char *argv[])
 {
 	int rc;
-	void *context = zmq_ctx_new();
-	char buffer[256];
+	void *context;
+	const char *path = NULL;
+	double start;
+	int i;
 
-	requester = zmq_socket(context, ZMQ_REQ);
-	rc = zmq_connect(requester, "tcp://127.0.0.1:6574");
-	assert(rc == 0);
-	zmq_send(requester, "reset", 5, 0);
-	wait_response();
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-p"))
+			protocol = PROTOCOL_PIPELINED;
+		else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+			path = argv[++i];
+	}
+	if (path) {
+		protocol = PROTOCOL_PIPELINED;
+		if (sim_maze_load(path, &maze) || maze.size != MAZE_SIZE) {
+			fprintf(stderr, "Unable to serve %s in-process\n",
+				path);
+			return EXIT_FAILURE;
+		}
+		in_process = true;
+	} else {
+		context = zmq_ctx_new();
+		requester = zmq_socket(context, ZMQ_REQ);
+		rc = zmq_connect(requester, "tcp://127.0.0.1:6574");
+		assert(rc == 0);
+		zmq_send(requester, "reset", 5, 0);
+		wait_response();
+	}
 
+	start = wall_clock();
 	set_goal_classic();
 	set_target_goal();
 
@@ -96,6 +391,20 @@ int main(void)
 	set_target_goal();
 	set_distances();
 	send_state();
+	flush_state();
 
+	printf("explore: %.3f ms, %u round trips\n",
+	       (wall_clock() - start) * 1e3, round_trips);
+	if (in_process) {
+		for (i = 0; i < MAZE_SIZE * MAZE_SIZE; i++) {
+			if (server_distances[i] !=
+				read_cell_distance_value(i) ||
+			    server_walls[i] != read_cell_walls_value(i)) {
+				fprintf(stderr, "State mismatch at cell %d\n",
+					i);
+				return EXIT_FAILURE;
+			}
+		}
+	}
 	return 0;
 }
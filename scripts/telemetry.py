@@ -0,0 +1,147 @@
+from binascii import crc_hqx
+from collections import namedtuple
+import struct
+
+
+SYNC = b'\xa5\x5a'
+HEADER = struct.Struct('<2sBBHI')
+CRC = struct.Struct('<H')
+CRC_INIT = 0xffff
+
+Record = namedtuple('Record', 'name,layout,fields,scales')
+Frame = namedtuple('Frame', 'sequence,timestamp,name,values')
+
+RECORDS = {
+    1: Record(
+        name='control',
+        layout=struct.Struct('<10h'),
+        fields=[
+            'target_linear_speed',
+            'ideal_linear_speed',
+            'left_speed',
+            'right_speed',
+            'ideal_angular_speed',
+            'angular_speed',
+            'pwm_left',
+            'pwm_right',
+            'voltage_left',
+            'voltage_right',
+        ],
+        scales=[1e-3] * 6 + [1] * 2 + [1e-3] * 2,
+    ),
+    2: Record(
+        name='capture',
+        layout=struct.Struct('<2Hh4h2h'),
+        fields=[
+            'encoder_left',
+            'encoder_right',
+            'gyro_z',
+            'sensor_side_left',
+            'sensor_side_right',
+            'sensor_front_left',
+            'sensor_front_right',
+            'power_left',
+            'power_right',
+        ],
+        scales=[1] * 9,
+    ),
+}
+
+
+def crc16(data):
+    """
+    CRC-16/CCITT-FALSE, as computed by the firmware.
+    """
+    return crc_hqx(data, CRC_INIT)
+
+
+def encode_frame(type_, sequence, timestamp, payload):
+    """
+    Build a telemetry frame, as sent by the firmware.
+    """
+    header = HEADER.pack(SYNC, type_, len(payload), sequence, timestamp)
+    crc = crc16(header[len(SYNC):] + payload)
+    return header + payload + CRC.pack(crc)
+
+
+def decode_record(type_, payload):
+    """
+    Decode a record payload into a dictionary of scaled values.
+
+    Unknown record types are returned as raw bytes.
+    """
+    record = RECORDS.get(type_)
+    if record is None or record.layout.size != len(payload):
+        return 'unknown', payload
+    values = record.layout.unpack(payload)
+    return record.name, {field: value * scale for field, value, scale
+                         in zip(record.fields, values, record.scales)}
+
+
+class TelemetryDecoder:
+    """
+    Split the serial stream into text log messages and telemetry frames.
+
+    Text messages are returned as bytes (without the trailing new line) and
+    telemetry frames as `Frame` tuples. Frames with a wrong CRC are discarded
+    and synchronization is searched again from the next byte. Lost frames
+    are accounted using the sequence numbers.
+    """
+    def __init__(self):
+        self.buffer = b''
+        self.sequence = None
+        self.crc_errors = 0
+        self.lost_frames = 0
+
+    def feed(self, received):
+        self.buffer += received
+        messages = []
+        while self.buffer:
+            if self.buffer[:1] == SYNC[:1]:
+                if len(self.buffer) < HEADER.size:
+                    break
+                frame = self.decode_frame()
+                if frame is None:
+                    break
+                if frame is not False:
+                    messages.append(frame)
+                continue
+            end = self.buffer.find(b'\n')
+            sync = self.buffer.find(SYNC[:1])
+            if end < 0 or 0 <= sync < end:
+                if sync < 0:
+                    break
+                messages.append(self.buffer[:sync])
+                self.buffer = self.buffer[sync:]
+                continue
+            messages.append(self.buffer[:end])
+            self.buffer = self.buffer[end + 1:]
+        return messages
+
+    def decode_frame(self):
+        """
+        Decode the frame at the beginning of the buffer.
+
+        Returns `None` if more data is needed or `False` if the frame is
+        not valid.
+        """
+        sync, type_, size, sequence, timestamp = \
+            HEADER.unpack_from(self.buffer)
+        end = HEADER.size + size + CRC.size
+        if sync != SYNC:
+            self.buffer = self.buffer[1:]
+            return False
+        if len(self.buffer) < end:
+            return None
+        crc, = CRC.unpack_from(self.buffer, end - CRC.size)
+        if crc != crc16(self.buffer[len(SYNC):end - CRC.size]):
+            self.crc_errors += 1
+            self.buffer = self.buffer[1:]
+            return False
+        payload = self.buffer[HEADER.size:end - CRC.size]
+        self.buffer = self.buffer[end:]
+        if self.sequence is not None:
+            self.lost_frames += (sequence - self.sequence - 1) & 0xffff
+        self.sequence = sequence
+        name, values = decode_record(type_, payload)
+        return Frame(sequence, timestamp, name, values)
@@ -5,6 +5,7 @@ from analysis import explode_yaml_series
 from analysis import filter_dataframe
 from analysis import log_as_dataframe
 from analysis import LOG_COLUMNS
+from analysis import telemetry_as_dataframe
 
 
 def test_log_as_dataframe_empty():
@@ -52,3 +53,19 @@ def test_filter_dataframe():
     # No results
     result = filter_dataframe(df, {'a': 1, 'b': 2, 'c': 1})
     assert len(result) == 0
+
+
+def test_telemetry_as_dataframe():
+    """
+    Test `telemetry_as_dataframe()` function.
+    """
+    log = [
+        (0.001, 'DATA', 'telemetry', 'control', {'a': 1, 'b': 2}),
+        (0.001, 'INFO', 'main.c:1', 'main', 'hello'),
+        (0.002, 'DATA', 'telemetry', 'control', {'a': 3, 'b': 4}),
+    ]
+    df = telemetry_as_dataframe(log, 'control')
+    assert df.index.name == 'timestamp'
+    assert list(df.index) == [0.001, 0.002]
+    assert list(df['a']) == [1, 3]
+    assert list(df['b']) == [2, 4]
@@ -0,0 +1,100 @@
+import struct
+
+from pytest import approx
+
+from telemetry import crc16
+from telemetry import encode_frame
+from telemetry import Frame
+from telemetry import RECORDS
+from telemetry import TelemetryDecoder
+
+
+CONTROL = struct.pack('<10h', 500, 250, 200, 300, -1500, -1400, -512, 700,
+                      -2500, 3400)
+
+CAPTURE = struct.pack('<2Hh4h2h', 65535, 12, -300, 900, 990, 1080, -10, 512,
+                      -1024)
+
+
+def test_crc16():
+    """
+    The CRC must match the CRC-16/CCITT-FALSE check value.
+    """
+    assert crc16(b'123456789') == 0x29b1
+
+
+def test_decode_control_frame():
+    """
+    A control frame is decoded into scaled values.
+    """
+    decoder = TelemetryDecoder()
+    messages = decoder.feed(encode_frame(1, 7, 1234, CONTROL))
+    assert len(messages) == 1
+    frame = messages[0]
+    assert isinstance(frame, Frame)
+    assert frame.sequence == 7
+    assert frame.timestamp == 1234
+    assert frame.name == 'control'
+    assert list(frame.values) == RECORDS[1].fields
+    assert frame.values['target_linear_speed'] == approx(0.5)
+    assert frame.values['angular_speed'] == approx(-1.4)
+    assert frame.values['pwm_left'] == -512
+    assert frame.values['voltage_right'] == approx(3.4)
+
+
+def test_decode_capture_frame():
+    """
+    A capture frame is decoded into raw values.
+    """
+    decoder = TelemetryDecoder()
+    frame, = decoder.feed(encode_frame(2, 0, 51, CAPTURE))
+    assert frame.name == 'capture'
+    assert frame.timestamp == 51
+    assert list(frame.values) == RECORDS[2].fields
+    assert frame.values['encoder_left'] == 65535
+    assert frame.values['gyro_z'] == -300
+    assert frame.values['sensor_side_left'] == 900
+    assert frame.values['sensor_front_right'] == -10
+    assert frame.values['power_right'] == -1024
+
+
+def test_decode_mixed_stream():
+    """
+    Text messages and frames can be interleaved and received in pieces.
+    """
+    stream = b'1.000,INFO,main.c:1,main,hello\n'
+    stream += encode_frame(1, 0, 1, CONTROL)
+    stream += b'1.002,INFO,main.c:1,main,bye\n'
+    decoder = TelemetryDecoder()
+    messages = []
+    for i in range(len(stream)):
+        messages.extend(decoder.feed(stream[i:i + 1]))
+    assert len(messages) == 3
+    assert messages[0] == b'1.000,INFO,main.c:1,main,hello'
+    assert messages[1].name == 'control'
+    assert messages[2] == b'1.002,INFO,main.c:1,main,bye'
+
+
+def test_decode_corrupted_frame():
+    """
+    Frames with a wrong CRC are discarded and the stream is resynchronized.
+    """
+    corrupted = bytearray(encode_frame(1, 0, 1, CONTROL))
+    corrupted[12] ^= 0xff
+    stream = bytes(corrupted) + encode_frame(1, 1, 2, CONTROL)
+    decoder = TelemetryDecoder()
+    frames = [x for x in decoder.feed(stream) if isinstance(x, Frame)]
+    assert decoder.crc_errors == 1
+    assert len(frames) == 1
+    assert frames[0].sequence == 1
+
+
+def test_lost_frames():
+    """
+    Gaps in the sequence numbers are accounted as lost frames, even when the
+    sequence number wraps around.
+    """
+    decoder = TelemetryDecoder()
+    decoder.feed(encode_frame(1, 0xfffe, 1, CONTROL))
+    decoder.feed(encode_frame(1, 2, 2, CONTROL))
+    assert decoder.lost_frames == 3
@@ -0,0 +1,169 @@
+#include <string.h>
+
+#include "capture.h"
+
+enum capture_state {
+	CAPTURE_STOPPED,
+	CAPTURE_RUNNING,
+	CAPTURE_TRIGGERED,
+};
+
+static struct telemetry_capture records[CAPTURE_RECORDS];
+static volatile enum capture_state state;
+static volatile uint32_t captured;
+static uint32_t ticks;
+static uint32_t remaining;
+static uint32_t start_time;
+
+/**
+ * @brief Saturate a value to the `int16_t` range.
+ */
+static int16_t saturate_int16(int32_t value)
+{
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return value;
+}
+
+/**
+ * @brief Freeze the capture after `CAPTURE_POST_TRIGGER` more records.
+ */
+static void trigger(void)
+{
+	remaining = CAPTURE_POST_TRIGGER;
+	state = remaining ? CAPTURE_TRIGGERED : CAPTURE_STOPPED;
+}
+
+/**
+ * @brief Start capturing, discarding any previous capture.
+ *
+ * Records are taken on every `CAPTURE_DECIMATION` SysTick periods from now
+ * on (see `capture_tick()`), overwriting the oldest ones when the buffer is
+ * full, until the capture is stopped or frozen after a trigger.
+ */
+void capture_start(void)
+{
+	cm_disable_interrupts();
+	captured = 0;
+	ticks = 0;
+	start_time = get_clock_ticks();
+	state = CAPTURE_RUNNING;
+	cm_enable_interrupts();
+}
+
+/**
+ * @brief Trigger the capture.
+ *
+ * `CAPTURE_POST_TRIGGER` more records are taken and then the capture is
+ * frozen. Triggering a capture that is not running has no effect.
+ *
+ * The capture is triggered automatically when a collision is detected.
+ */
+void capture_trigger(void)
+{
+	cm_disable_interrupts();
+	if (state == CAPTURE_RUNNING)
+		trigger();
+	cm_enable_interrupts();
+}
+
+/**
+ * @brief Stop capturing, keeping the captured records.
+ */
+void capture_stop(void)
+{
+	state = CAPTURE_STOPPED;
+}
+
+/**
+ * @brief Take a capture record if the capture is running.
+ *
+ * Must be called on every SysTick period, after the motor control, so the
+ * record holds the readings and the powers commanded within the period.
+ */
+void capture_tick(void)
+{
+	struct telemetry_capture *record;
+	uint16_t on[NUM_SENSOR];
+	uint16_t off[NUM_SENSOR];
+	int sensor;
+
+	if (state == CAPTURE_STOPPED)
+		return;
+	if (state == CAPTURE_RUNNING &&
+	    get_collision_report().cause != COLLISION_NONE)
+		trigger();
+	if (ticks++ % CAPTURE_DECIMATION)
+		return;
+
+	record = &records[captured % CAPTURE_RECORDS];
+	record->encoder_left = read_encoder_left();
+	record->encoder_right = read_encoder_right();
+	record->gyro_z = get_mpu_gyro_z_raw();
+	get_sensors_raw(on, off);
+	for (sensor = 0; sensor < NUM_SENSOR; sensor++)
+		record->sensors[sensor] = on[sensor] - off[sensor];
+	record->power_left = saturate_int16(get_left_power());
+	record->power_right = saturate_int16(get_right_power());
+	captured++;
+
+	if (state == CAPTURE_TRIGGERED && !--remaining)
+		state = CAPTURE_STOPPED;
+}
+
+/**
+ * @brief Send the captured records through serial, oldest first.
+ *
+ * The capture is stopped first. Each record is sent as a telemetry frame
+ * (see `TELEMETRY_CAPTURE`) timestamped with the clock ticks at which it was
+ * taken. The function waits for room in the transmission buffer before
+ * sending each frame, so records are not dropped because of a full buffer.
+ */
+void capture_dump(void)
+{
+	uint32_t count;
+	uint32_t first;
+	uint32_t timestamp;
+	uint32_t i;
+
+	capture_stop();
+	count = captured < CAPTURE_RECORDS ? captured : CAPTURE_RECORDS;
+	first = captured - count;
+	LOG_INFO("Capture: %u records every %u ticks", count,
+		 CAPTURE_DECIMATION);
+	for (i = first; i < captured; i++) {
+		timestamp = start_time + (uint64_t)i * CAPTURE_DECIMATION *
+					     CLOCK_FREQUENCY_HZ /
+					     SYSTICK_FREQUENCY_HZ;
+		while (get_serial_transmit_space() < TELEMETRY_MAX_FRAME_SIZE)
+			;
+		telemetry_send_at(TELEMETRY_CAPTURE,
+				  &records[i % CAPTURE_RECORDS],
+				  sizeof(struct telemetry_capture), timestamp);
+	}
+}
+
+/**
+ * @brief Execute the received command if it is a capture command.
+ *
+ * - `capture_dump`: send the captured records again.
+ *
+ * Other commands are left for `execute_command()`.
+ *
+ * @return Whether a capture command was executed.
+ */
+bool execute_capture_command(void)
+{
+	char *command;
+
+	if (!get_received_command_flag())
+		return false;
+	command = get_received_serial_buffer();
+	if (strcmp(command, "capture_dump"))
+		return false;
+	capture_dump();
+	set_received_command_flag(false);
+	return true;
+}
@@ -0,0 +1,31 @@
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#include "mmlib/clock.h"
+#include "mmlib/logging.h"
+
+#include "collision.h"
+#include "detection.h"
+#include "motor.h"
+#include "platform.h"
+#include "serial.h"
+#include "setup.h"
+#include "telemetry.h"
+
+#if CAPTURE_POST_TRIGGER > CAPTURE_RECORDS
+#error "CAPTURE_POST_TRIGGER must not exceed CAPTURE_RECORDS"
+#endif
+
+void capture_start(void);
+void capture_trigger(void);
+void capture_stop(void);
+void capture_tick(void);
+void capture_dump(void);
+bool execute_capture_command(void);
+
+#endif /* __CAPTURE_H */
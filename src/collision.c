@@ -0,0 +1,170 @@
+#include <string.h>
+
+#include "collision.h"
+#include "motor.h"
+
+#define WINDOW_PERIODS(seconds) ((uint16_t)((seconds)*SYSTICK_FREQUENCY_HZ))
+
+_Static_assert(WINDOW_PERIODS(COLLISION_SATURATION_WINDOW) <=
+			   COLLISION_MAX_WINDOW &&
+		       WINDOW_PERIODS(COLLISION_LINEAR_WINDOW) <=
+			   COLLISION_MAX_WINDOW &&
+		       WINDOW_PERIODS(COLLISION_ANGULAR_WINDOW) <=
+			   COLLISION_MAX_WINDOW,
+	       "Collision windows exceed COLLISION_MAX_WINDOW periods");
+
+/**
+ * Sliding window of conditions, one per SysTick period.
+ */
+struct window {
+	bool history[COLLISION_MAX_WINDOW];
+	uint16_t size;
+	uint16_t threshold;
+	uint16_t position;
+	uint16_t count;
+};
+
+static const char *const cause_names[] = {"none", "saturation",
+					  "linear speed", "gyro"};
+
+static struct window saturation_window = {
+    .size = WINDOW_PERIODS(COLLISION_SATURATION_WINDOW),
+    .threshold = WINDOW_PERIODS(COLLISION_SATURATION_WINDOW) *
+		 COLLISION_SATURATION_RATIO,
+};
+static struct window linear_window = {
+    .size = WINDOW_PERIODS(COLLISION_LINEAR_WINDOW),
+    .threshold = WINDOW_PERIODS(COLLISION_LINEAR_WINDOW) *
+		 COLLISION_LINEAR_RATIO,
+};
+static struct window angular_window = {
+    .size = WINDOW_PERIODS(COLLISION_ANGULAR_WINDOW),
+    .threshold = WINDOW_PERIODS(COLLISION_ANGULAR_WINDOW) *
+		 COLLISION_ANGULAR_RATIO,
+};
+
+static struct collision_report report;
+static float last_angular_speed;
+
+/**
+ * @brief Push a condition into a sliding window.
+ *
+ * @return Whether the condition was met on at least the window threshold.
+ */
+static bool window_push(struct window *window, bool condition)
+{
+	window->count += condition;
+	window->count -= window->history[window->position];
+	window->history[window->position] = condition;
+	window->position = (window->position + 1) % window->size;
+	return window->count >= window->threshold;
+}
+
+/**
+ * @brief Clear a sliding window.
+ */
+static void window_reset(struct window *window)
+{
+	memset(window->history, 0, sizeof(window->history));
+	window->position = 0;
+	window->count = 0;
+}
+
+/**
+ * @brief Evaluate the collision conditions for the last SysTick period.
+ *
+ * The conditions are only met while the motors are driven. The first
+ * collision detected is reported, with its cause and the clock ticks at the
+ * time, and it is latched until `reset_collision_detector()` is called.
+ *
+ * Must be called on every SysTick period, after the motor control.
+ *
+ * @return Whether a collision was detected on this period (only the first
+ * one since the last reset).
+ */
+bool update_collision_detector(void)
+{
+	bool active = motor_driver_active();
+	float linear_speed;
+	float angular_speed;
+	float angular_acceleration;
+	bool saturated;
+	bool linear;
+	bool angular;
+
+	linear_speed =
+	    (get_encoder_left_speed() + get_encoder_right_speed()) / 2.;
+	angular_speed = get_measured_angular_speed();
+	angular_acceleration =
+	    (angular_speed - last_angular_speed) * SYSTICK_FREQUENCY_HZ;
+	last_angular_speed = angular_speed;
+
+	saturated = window_push(&saturation_window,
+				active && motor_driver_saturated());
+	linear = window_push(&linear_window,
+			     active && fabsf(get_ideal_linear_speed() -
+					     linear_speed) >
+					   COLLISION_LINEAR_ERROR);
+	angular = window_push(
+	    &angular_window,
+	    active && (fabsf(get_ideal_angular_speed() - angular_speed) >
+			   COLLISION_ANGULAR_ERROR ||
+		       fabsf(angular_acceleration) >
+			   COLLISION_ANGULAR_ACCELERATION));
+
+	if (report.cause != COLLISION_NONE)
+		return false;
+	if (saturated)
+		report.cause = COLLISION_SATURATION;
+	else if (linear)
+		report.cause = COLLISION_LINEAR_SPEED;
+	else if (angular)
+		report.cause = COLLISION_GYRO;
+	else
+		return false;
+	report.timestamp = get_clock_ticks();
+	return true;
+}
+
+/**
+ * @brief Clear the collision report and the sliding windows.
+ */
+void reset_collision_detector(void)
+{
+	window_reset(&saturation_window);
+	window_reset(&linear_window);
+	window_reset(&angular_window);
+	report.timestamp = 0;
+	report.cause = COLLISION_NONE;
+}
+
+/**
+ * @brief Get the first collision detected since the last reset.
+ */
+struct collision_report get_collision_report(void)
+{
+	return report;
+}
+
+/**
+ * @brief Whether a collision was detected since the last reset.
+ */
+bool collision_reported(void)
+{
+	return report.cause != COLLISION_NONE;
+}
+
+/**
+ * @brief Log the collision report.
+ */
+void log_collision_report(void)
+{
+	struct collision_report collision = report;
+
+	if (collision.cause == COLLISION_NONE) {
+		LOG_INFO("No collision detected");
+		return;
+	}
+	LOG_WARNING("Collision detected: %s at %u ms",
+		    cause_names[collision.cause], collision.timestamp);
+}
@@ -0,0 +1,37 @@
+#ifndef __COLLISION_H
+#define __COLLISION_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mmlib/clock.h"
+#include "mmlib/control.h"
+#include "mmlib/encoder.h"
+#include "mmlib/logging.h"
+#include "mmlib/speed.h"
+
+#include "setup.h"
+
+/** Longest sliding window, in SysTick periods */
+#define COLLISION_MAX_WINDOW 256
+
+enum collision_cause {
+	COLLISION_NONE,
+	COLLISION_SATURATION,
+	COLLISION_LINEAR_SPEED,
+	COLLISION_GYRO,
+};
+
+struct collision_report {
+	enum collision_cause cause;
+	uint32_t timestamp;
+};
+
+bool update_collision_detector(void);
+void reset_collision_detector(void);
+struct collision_report get_collision_report(void);
+bool collision_reported(void);
+void log_collision_report(void);
+
+#endif /* __COLLISION_H */
@@ -1,46 +1,110 @@
 #include "config.h"
 
-static volatile float micrometers_per_count = MICROMETERS_PER_COUNT;
-static volatile struct control_constants control = {
-    .kp_linear = KP_LINEAR,
-    .kd_linear = KD_LINEAR,
-    .kp_angular = KP_ANGULAR,
-    .kd_angular = KD_ANGULAR,
-    .kp_angular_front = KP_ANGULAR_FRONT,
-    .ki_angular_front = KI_ANGULAR_FRONT,
-    .kp_angular_side = KP_ANGULAR_SIDE,
-    .ki_angular_side = KI_ANGULAR_SIDE,
-    .kp_angular_diagonal = KP_ANGULAR_DIAGONAL,
-    .ki_angular_diagonal = KI_ANGULAR_DIAGONAL};
-
-static volatile float linear_speed_limit = LINEAR_SPEED_LIMIT;
+/**
+ * Configuration is double buffered.
+ *
+ * Readers (i.e.: the control loop in the SysTick handler) only load the
+ * pointer to the active buffer. Updates are prepared in the inactive buffer
+ * and published with a single pointer store, so readers always get a
+ * consistent configuration and never wait.
+ *
+ * Updates must be made from thread mode (i.e.: the command loop), so the
+ * inactive buffer is never being read while it is modified: an interruption
+ * reading the previously active buffer always completes before the update
+ * can continue.
+ */
+static struct config buffers[2] = {{
+    .micrometers_per_count = MICROMETERS_PER_COUNT,
+    .control =
+	{
+	    .kp_linear = KP_LINEAR,
+	    .kd_linear = KD_LINEAR,
+	    .kp_angular = KP_ANGULAR,
+	    .kd_angular = KD_ANGULAR,
+	    .kp_angular_front = KP_ANGULAR_FRONT,
+	    .ki_angular_front = KI_ANGULAR_FRONT,
+	    .kp_angular_side = KP_ANGULAR_SIDE,
+	    .ki_angular_side = KI_ANGULAR_SIDE,
+	    .kp_angular_diagonal = KP_ANGULAR_DIAGONAL,
+	    .ki_angular_diagonal = KI_ANGULAR_DIAGONAL,
+	},
+    .linear_speed_limit = LINEAR_SPEED_LIMIT,
+}};
+static const struct config *volatile active = &buffers[0];
+
+/**
+ * @brief Get the active configuration.
+ *
+ * The returned configuration is not modified until the next update is
+ * committed, so interruptions can read it in place, without copying it.
+ */
+const struct config *get_config(void)
+{
+	return active;
+}
+
+/**
+ * @brief Start a configuration update.
+ *
+ * @return Inactive buffer, initialized with the active configuration, to be
+ * modified and then published with `commit_config_update()`.
+ */
+struct config *begin_config_update(void)
+{
+	struct config *update = &buffers[active == &buffers[0]];
+
+	*update = *active;
+	return update;
+}
+
+/**
+ * @brief Publish a configuration update.
+ *
+ * The buffer contents are stored before the pointer is published (release
+ * ordering).
+ *
+ * @param[in] update Buffer returned by `begin_config_update()`.
+ */
+void commit_config_update(struct config *update)
+{
+	__atomic_store_n(&active, update, __ATOMIC_RELEASE);
+}
 
 float get_micrometers_per_count(void)
 {
-	return micrometers_per_count;
+	return active->micrometers_per_count;
 }
 
 void set_micrometers_per_count(float value)
 {
-	micrometers_per_count = value;
+	struct config *update = begin_config_update();
+
+	update->micrometers_per_count = value;
+	commit_config_update(update);
 }
 
 struct control_constants get_control_constants(void)
 {
-	return control;
+	return active->control;
 }
 
 void set_control_constants(struct control_constants value)
 {
-	control = value;
+	struct config *update = begin_config_update();
+
+	update->control = value;
+	commit_config_update(update);
 }
 
 float get_linear_speed_limit(void)
 {
-	return linear_speed_limit;
+	return active->linear_speed_limit;
 }
 
 void set_linear_speed_limit(float value)
 {
-	linear_speed_limit = value;
+	struct config *update = begin_config_update();
+
+	update->linear_speed_limit = value;
+	commit_config_update(update);
 }
@@ -46,6 +46,16 @@ struct control_constants {
 /** Speed constants */
 #define LINEAR_SPEED_LIMIT 2.
 
+/** Live configuration */
+struct config {
+	float micrometers_per_count;
+	struct control_constants control;
+	float linear_speed_limit;
+};
+
+const struct config *get_config(void);
+struct config *begin_config_update(void);
+void commit_config_update(struct config *update);
 float get_micrometers_per_count(void);
 void set_micrometers_per_count(float value);
 struct control_constants get_control_constants(void);
@@ -0,0 +1,30 @@
+#include "crc.h"
+
+/** CRC-16/CCITT (polynomial 0x1021) of every nibble */
+static const uint16_t crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+/**
+ * @brief Update a CRC-16/CCITT-FALSE with a block of data.
+ *
+ * The data is processed a nibble at a time, which is a good compromise
+ * between speed and table size.
+ *
+ * @param[in] crc Current CRC value (`CRC16_INIT` on the first block).
+ * @param[in] data Data to process.
+ * @param[in] size Size (number of bytes) of the data.
+ * @return The updated CRC value.
+ */
+uint16_t crc16(uint16_t crc, const void *data, uint32_t size)
+{
+	const uint8_t *byte = data;
+
+	while (size--) {
+		crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*byte >> 4)];
+		crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*byte & 0x0f)];
+		byte++;
+	}
+	return crc;
+}
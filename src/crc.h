@@ -0,0 +1,11 @@
+#ifndef __CRC_H
+#define __CRC_H
+
+#include <stdint.h>
+
+/** Initial value of the CRC-16/CCITT-FALSE computation */
+#define CRC16_INIT 0xFFFF
+
+uint16_t crc16(uint16_t crc, const void *data, uint32_t size);
+
+#endif /* __CRC_H */
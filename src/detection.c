@@ -3,7 +3,51 @@
 #define LOG_CONVERSION_TABLE_STEP 4
 #define LOG_CONVERSION_TABLE_SIZE (ADC_RESOLUTION / LOG_CONVERSION_TABLE_STEP)
 
+#define EMITTERS_OFF ((GPIO8 | GPIO9) << 16)
+
+/** Sensors sweep period, on both acquisition modes */
+#define SWEEP_PERIOD_CYCLES (SYSCLK_FREQUENCY_HZ / SENSORS_SWEEP_FREQUENCY_HZ)
+#define SLOT_PERIOD_CYCLES (SWEEP_PERIOD_CYCLES / SENSORS_SWEEP_SLOTS)
+#define SM_STATE_PERIOD_CYCLES (SWEEP_PERIOD_CYCLES / (4 * NUM_SENSOR))
+
+static const char *const filter_names[] = {
+    [SENSORS_FILTER_NONE] = "none",
+    [SENSORS_FILTER_MEDIAN] = "median",
+    [SENSORS_FILTER_IIR] = "iir",
+};
+
 static volatile uint16_t sensors_off[NUM_SENSOR], sensors_on[NUM_SENSOR];
+static volatile uint32_t sensors_timestamp[NUM_SENSOR];
+
+static volatile enum sensors_filter filter = SENSORS_FILTER_NONE;
+static uint16_t history_off[NUM_SENSOR][SENSORS_HISTORY_SIZE];
+static uint16_t history_on[NUM_SENSOR][SENSORS_HISTORY_SIZE];
+static uint8_t history_index[NUM_SENSOR];
+static uint32_t iir_off[NUM_SENSOR], iir_on[NUM_SENSOR];
+
+/**
+ * Ring buffer for the DMA acquisition mode, with room for two sweeps.
+ *
+ * Each sweep contains, for every sensor, the reading with the emitter off
+ * followed by the reading with the emitter on.
+ */
+static volatile uint16_t sensors_samples[2 * SENSORS_SWEEP_SLOTS];
+
+/**
+ * GPIOA and GPIOB bit set/reset values written at the beginning of each slot
+ * of the sweep on DMA acquisition mode.
+ *
+ * Emitters are only turned on during the slot in which their
+ * phototransistor is read with the emitter on.
+ */
+static const uint32_t emitters_gpioa[SENSORS_SWEEP_SLOTS] = {
+    EMITTERS_OFF, GPIO9 | (GPIO8 << 16), EMITTERS_OFF, EMITTERS_OFF,
+    EMITTERS_OFF, GPIO8 | (GPIO9 << 16), EMITTERS_OFF, EMITTERS_OFF,
+};
+static const uint32_t emitters_gpiob[SENSORS_SWEEP_SLOTS] = {
+    EMITTERS_OFF, EMITTERS_OFF, EMITTERS_OFF, GPIO8 | (GPIO9 << 16),
+    EMITTERS_OFF, EMITTERS_OFF, EMITTERS_OFF, GPIO9 | (GPIO8 << 16),
+};
 
 /**
  * Table to calculate the log of values between `1` and `ADC_RESOLUTION - 1`.
@@ -177,6 +221,82 @@ static void set_emitter_off(uint8_t emitter)
 	}
 }
 
+/**
+ * @brief Return the median of the samples kept for a sensor.
+ *
+ * @param[in] history Last `SENSORS_HISTORY_SIZE` samples.
+ */
+static uint16_t median(const uint16_t *history)
+{
+	uint16_t sorted[SENSORS_HISTORY_SIZE];
+	uint16_t value;
+	int i, j;
+
+	for (i = 0; i < SENSORS_HISTORY_SIZE; i++) {
+		value = history[i];
+		for (j = i; j > 0 && sorted[j - 1] > value; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = value;
+	}
+	return sorted[SENSORS_HISTORY_SIZE / 2];
+}
+
+/**
+ * @brief Update a first order IIR filter and return its output.
+ *
+ * The state keeps the output scaled by `2^SENSORS_IIR_SHIFT`, so that no
+ * resolution is lost on integer arithmetic.
+ *
+ * @param[in,out] state Filter state.
+ * @param[in] sample New sample.
+ */
+static uint16_t iir(uint32_t *state, uint16_t sample)
+{
+	*state = *state - (*state >> SENSORS_IIR_SHIFT) + sample;
+	return (uint16_t)(*state >> SENSORS_IIR_SHIFT);
+}
+
+/**
+ * @brief Add a new pair of samples of a sensor and filter the readings.
+ *
+ * All samples are kept and both filters updated regardless of the filter
+ * selected, so that switching filters does not start from stale values.
+ *
+ * @param[in] sensor Sensor ID.
+ * @param[in] on Raw reading with emitter on.
+ * @param[in] off Raw reading with emitter off.
+ * @param[in] timestamp Cycle counter when the reading with emitter on was
+ * taken.
+ */
+static void sensors_update(uint8_t sensor, uint16_t on, uint16_t off,
+			   uint32_t timestamp)
+{
+	uint8_t index = history_index[sensor];
+	uint16_t iir_on_value, iir_off_value;
+
+	history_on[sensor][index] = on;
+	history_off[sensor][index] = off;
+	history_index[sensor] = (index + 1) % SENSORS_HISTORY_SIZE;
+	iir_on_value = iir(&iir_on[sensor], on);
+	iir_off_value = iir(&iir_off[sensor], off);
+
+	switch (filter) {
+	case SENSORS_FILTER_MEDIAN:
+		sensors_on[sensor] = median(history_on[sensor]);
+		sensors_off[sensor] = median(history_off[sensor]);
+		break;
+	case SENSORS_FILTER_IIR:
+		sensors_on[sensor] = iir_on_value;
+		sensors_off[sensor] = iir_off_value;
+		break;
+	default:
+		sensors_on[sensor] = on;
+		sensors_off[sensor] = off;
+		break;
+	}
+	sensors_timestamp[sensor] = timestamp;
+}
+
 /**
  * @brief State machine to manage the sensors activation and deactivation
  * states and readings.
@@ -195,6 +315,7 @@ static void sm_emitter_adc(void)
 {
 	static uint8_t emitter_status = 1;
 	static uint8_t sensor_index = SENSOR_SIDE_LEFT_ID;
+	static uint16_t off;
 
 	switch (emitter_status) {
 	case 1:
@@ -202,8 +323,7 @@ static void sm_emitter_adc(void)
 		emitter_status = 2;
 		break;
 	case 2:
-		sensors_off[sensor_index] =
-		    adc_read_injected(ADC1, (sensor_index + 1));
+		off = adc_read_injected(ADC1, (sensor_index + 1));
 		set_emitter_on(sensor_index);
 		emitter_status = 3;
 		break;
@@ -212,8 +332,9 @@ static void sm_emitter_adc(void)
 		emitter_status = 4;
 		break;
 	case 4:
-		sensors_on[sensor_index] =
-		    adc_read_injected(ADC1, (sensor_index + 1));
+		sensors_update(sensor_index,
+			       adc_read_injected(ADC1, (sensor_index + 1)), off,
+			       read_cycle_counter() - SM_STATE_PERIOD_CYCLES);
 		set_emitter_off(sensor_index);
 		emitter_status = 1;
 		if (sensor_index == (NUM_SENSOR - 1))
@@ -240,9 +361,115 @@ void tim1_up_isr(void)
 	}
 }
 
+/**
+ * @brief Configure a DMA channel to write a table of values on a GPIO bit
+ * set/reset register, one on each request.
+ *
+ * @param[in] channel DMA channel to configure.
+ * @param[in] gpioport GPIO port register base address.
+ * @param[in] table Table with the values for each slot of the sweep.
+ */
+static void setup_emitters_dma_channel(uint8_t channel, uint32_t gpioport,
+				       const uint32_t *table)
+{
+	dma_channel_reset(DMA1, channel);
+
+	dma_set_peripheral_address(DMA1, channel,
+				   (uint32_t)(uintptr_t)&GPIO_BSRR(gpioport));
+	dma_set_memory_address(DMA1, channel, (uint32_t)(uintptr_t)table);
+	dma_set_number_of_data(DMA1, channel, SENSORS_SWEEP_SLOTS);
+	dma_set_read_from_memory(DMA1, channel);
+	dma_enable_memory_increment_mode(DMA1, channel);
+	dma_set_peripheral_size(DMA1, channel, DMA_CCR_PSIZE_32BIT);
+	dma_set_memory_size(DMA1, channel, DMA_CCR_MSIZE_32BIT);
+	dma_enable_circular_mode(DMA1, channel);
+	dma_set_priority(DMA1, channel, DMA_CCR_PL_VERY_HIGH);
+
+	dma_enable_channel(DMA1, channel);
+}
+
+/**
+ * @brief Setup the DMA channels for the DMA acquisition mode.
+ *
+ * - DMA 1 channel 1 transfers each ADC1 conversion to the `sensors_samples`
+ *   ring buffer. The half and complete transfer interruptions are generated
+ *   after each sweep.
+ * - DMA 1 channel 5 (TIM1 update request) switches GPIOA emitters at the
+ *   beginning of each slot.
+ * - DMA 1 channel 6 (TIM1 compare 3 request) switches GPIOB emitters right
+ *   after.
+ *
+ * @see Reference manual (RM0008) "DMA request mapping".
+ */
+void setup_sensors_dma(void)
+{
+	dma_channel_reset(DMA1, DMA_CHANNEL1);
+
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL1,
+				   (uint32_t)(uintptr_t)&ADC_DR(ADC1));
+	dma_set_memory_address(DMA1, DMA_CHANNEL1,
+			       (uint32_t)(uintptr_t)sensors_samples);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1, 2 * SENSORS_SWEEP_SLOTS);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+	dma_set_priority(DMA1, DMA_CHANNEL1, DMA_CCR_PL_VERY_HIGH);
+
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL1);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
+
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+
+	setup_emitters_dma_channel(DMA_CHANNEL5, GPIOA, emitters_gpioa);
+	setup_emitters_dma_channel(DMA_CHANNEL6, GPIOB, emitters_gpiob);
+}
+
+/**
+ * @brief DMA 1 channel 1 interruption routine.
+ *
+ * Executed after each sensors sweep on DMA acquisition mode, when one half of
+ * the `sensors_samples` ring buffer is complete, while the other half is
+ * being filled.
+ *
+ * If both flags are set, only the latest sweep is kept.
+ *
+ * The interruption is generated right after the last conversion of the
+ * sweep, so the time at which each conversion was triggered is known.
+ */
+void dma1_channel1_isr(void)
+{
+	const volatile uint16_t *sweep;
+	uint32_t now = read_cycle_counter();
+	uint32_t elapsed;
+	uint8_t i;
+
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1,
+					  DMA_TCIF | DMA_HTIF);
+		sweep = &sensors_samples[SENSORS_SWEEP_SLOTS];
+	} else if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_HTIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_HTIF);
+		sweep = &sensors_samples[0];
+	} else {
+		return;
+	}
+
+	for (i = 0; i < NUM_SENSOR; i++) {
+		elapsed = (SENSORS_SWEEP_SLOTS - 2 * (i + 1)) *
+			  SLOT_PERIOD_CYCLES;
+		sensors_update(i, sweep[2 * i + 1], sweep[2 * i],
+			       now - elapsed);
+	}
+}
+
 /**
  * @brief Get sensors values with emitter on and off.
  *
+ * Readings are filtered as configured with `set_sensors_filter()`. They are
+ * recorded or played when replaying (see `replay.h`).
+ *
  * @param[out] on Raw sensors reading with emitter on.
  * @param[out] off Raw sensors reading with emitter off.
  */
@@ -254,6 +481,51 @@ void get_sensors_raw(uint16_t *on, uint16_t *off)
 		off[i] = sensors_off[i];
 		on[i] = sensors_on[i];
 	}
+	replay_sensors(on, off);
+}
+
+/**
+ * @brief Get the latency of a sensor filtered reading, in seconds.
+ *
+ * It is the time elapsed since the latest reading was taken plus the delay
+ * introduced by the filter (half the window for the median filter, the group
+ * delay for the IIR filter). It is reported with the `sensors` command.
+ *
+ * @param[in] sensor Sensor ID.
+ */
+float get_sensor_latency(uint8_t sensor)
+{
+	uint32_t cycles = read_cycle_counter() - sensors_timestamp[sensor];
+
+	switch (filter) {
+	case SENSORS_FILTER_MEDIAN:
+		cycles += (SENSORS_HISTORY_SIZE / 2) * SWEEP_PERIOD_CYCLES;
+		break;
+	case SENSORS_FILTER_IIR:
+		cycles += ((1 << SENSORS_IIR_SHIFT) - 1) * SWEEP_PERIOD_CYCLES;
+		break;
+	default:
+		break;
+	}
+	return (float)cycles / SYSCLK_FREQUENCY_HZ;
+}
+
+/**
+ * @brief Get the filter applied to the sensors readings.
+ */
+enum sensors_filter get_sensors_filter(void)
+{
+	return filter;
+}
+
+/**
+ * @brief Set the filter applied to the sensors readings.
+ *
+ * @param[in] value Filter to apply from the next readings on.
+ */
+void set_sensors_filter(enum sensors_filter value)
+{
+	filter = value;
 }
 
 /**
@@ -278,3 +550,53 @@ float sensors_raw_log(uint16_t on, uint16_t off)
 		diff = 1;
 	return log_conversion[diff];
 }
+
+/**
+ * @brief Log the sensors filter and the latency of each sensor reading.
+ */
+static void log_sensors(void)
+{
+	uint8_t i;
+
+	LOG_INFO("Sensors filter: %s", filter_names[filter]);
+	for (i = 0; i < NUM_SENSOR; i++)
+		LOG_INFO("Sensor %u latency: %u us", i,
+			 (uint32_t)(get_sensor_latency(i) * 1000000));
+}
+
+/**
+ * @brief Execute the received command if it is a sensors command.
+ *
+ * - `sensors`: log the sensors filter and the latency of each reading.
+ * - `sensors_filter NAME`: select the filter (`none`, `median` or `iir`).
+ *
+ * Other commands are left for `execute_command()`.
+ *
+ * @return Whether a sensors command was executed.
+ */
+bool execute_sensors_command(void)
+{
+	char *command;
+	uint8_t i;
+
+	if (!get_received_command_flag())
+		return false;
+	command = get_received_serial_buffer();
+	if (!strcmp(command, "sensors")) {
+		log_sensors();
+	} else if (!strncmp(command, "sensors_filter ", 15)) {
+		for (i = 0; i < sizeof(filter_names) / sizeof(filter_names[0]);
+		     i++) {
+			if (!strcmp(command + 15, filter_names[i]))
+				break;
+		}
+		if (i < sizeof(filter_names) / sizeof(filter_names[0]))
+			set_sensors_filter((enum sensors_filter)i);
+		else
+			LOG_ERROR("Invalid sensors filter");
+	} else {
+		return false;
+	}
+	set_received_command_flag(false);
+	return true;
+}
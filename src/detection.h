@@ -1,12 +1,18 @@
 #ifndef __DETECTION_H
 #define __DETECTION_H
 
+#include <string.h>
+
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/adc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/timer.h>
 
+#include "mmlib/logging.h"
+
 #include "config.h"
+#include "platform.h"
+#include "serial.h"
 #include "setup.h"
 
 /* Sensors IDs*/
@@ -16,8 +22,27 @@
 #define SENSOR_FRONT_RIGHT_ID 3
 #define NUM_SENSOR 4
 #define SENSORS_SM_TICKS 4
+#define SENSORS_SWEEP_SLOTS (2 * NUM_SENSOR)
+
+/**
+ * Sensors filtering across consecutive sweeps (not oversampling): samples
+ * kept per sensor (odd) and IIR filter shift.
+ */
+#define SENSORS_HISTORY_SIZE 5
+#define SENSORS_IIR_SHIFT 2
+
+enum sensors_filter {
+	SENSORS_FILTER_NONE,
+	SENSORS_FILTER_MEDIAN,
+	SENSORS_FILTER_IIR,
+};
 
+void setup_sensors_dma(void);
 void get_sensors_raw(uint16_t *on, uint16_t *off);
+float get_sensor_latency(uint8_t sensor);
+enum sensors_filter get_sensors_filter(void);
+void set_sensors_filter(enum sensors_filter value);
 float sensors_raw_log(uint16_t on, uint16_t off);
+bool execute_sensors_command(void);
 
 #endif /* __DETECTION_H */
@@ -1,6 +1,25 @@
 #include "eeprom.h"
+#include "maze_store.h"
 
 #define BYTES_PER_WORD 4
+#define BYTES_PER_HALF_WORD 2
+
+/**
+ * Asynchronous write, optionally erasing the page first.
+ */
+struct eeprom_write {
+	uint32_t address;
+	const uint8_t *data;
+	uint16_t num_bytes;
+	uint16_t programmed;
+	bool erase;
+};
+
+static struct eeprom_write writes[EEPROM_WRITES];
+static uint32_t write_status[EEPROM_WRITES];
+static volatile uint32_t writes_head;
+static volatile uint32_t writes_tail;
+static volatile bool write_active;
 
 /**
  * @brief Function to get the words of a number of bytes.
@@ -23,6 +42,8 @@ static uint16_t bytes_to_words(uint16_t num_bytes)
 /**
  * @brief Function to read EEPROM data from a specific address.
  *
+ * Reads from `FLASH_EEPROM_ADDRESS_MAZE` are served by the maze store.
+ *
  * @param[in] start_address Address to read from.
  * @param[in] num_elements Number of bytes to be read.
  * @param[out] output_data Pointer to a buffer to save the read data.
@@ -31,8 +52,12 @@ void eeprom_read_data(uint32_t start_address, uint16_t num_bytes,
 		      uint8_t *output_data)
 {
 	uint16_t iter;
-	uint32_t *memory_ptr = (uint32_t *)start_address;
+	uint32_t *memory_ptr = (uint32_t *)(uintptr_t)start_address;
 
+	if (start_address == FLASH_EEPROM_ADDRESS_MAZE) {
+		maze_store_load(output_data, num_bytes);
+		return;
+	}
 	for (iter = 0; iter < bytes_to_words(num_bytes); iter++) {
 		*(uint32_t *)output_data = *(memory_ptr + iter);
 		output_data += BYTES_PER_WORD;
@@ -47,6 +72,11 @@ void eeprom_read_data(uint32_t start_address, uint16_t num_bytes,
  * - Program flash memory word by word (32-bits) and verify that it is
  * written.
  *
+ * Writes to `FLASH_EEPROM_ADDRESS_MAZE` are served by the maze store, which
+ * only appends the changed bytes and rarely needs to erase a page.
+ *
+ * Pending asynchronous writes are completed first.
+ *
  * @param[in] page_address Address of a EEPROM page to flash on.
  * @param[in] input_data Pointer to the data to be flashed.
  * @param[in] num_bytes Number of bytes to be flashed.
@@ -58,6 +88,10 @@ uint32_t eeprom_flash_page(uint32_t page_address, uint8_t *input_data,
 	uint16_t iter;
 	uint32_t flash_status = 0;
 
+	if (page_address == FLASH_EEPROM_ADDRESS_MAZE)
+		return maze_store_save(input_data, num_bytes);
+
+	eeprom_wait_writes();
 	flash_unlock();
 
 	flash_erase_page(page_address);
@@ -73,7 +107,7 @@ uint32_t eeprom_flash_page(uint32_t page_address, uint8_t *input_data,
 		if (flash_status != FLASH_SR_EOP)
 			return flash_status;
 
-		if (*((uint32_t *)(page_address + iter)) !=
+		if (*((uint32_t *)(uintptr_t)(page_address + iter)) !=
 		    *((uint32_t *)(input_data + iter)))
 			return FLASH_WRONG_DATA_WRITTEN;
 	}
@@ -84,6 +118,10 @@ uint32_t eeprom_flash_page(uint32_t page_address, uint8_t *input_data,
 /**
  * @brief Function to erase a page of EEPROM.
  *
+ * Erasing `FLASH_EEPROM_ADDRESS_MAZE` resets the maze store instead.
+ *
+ * Pending asynchronous writes are completed first.
+ *
  * @param[in] page_address Address of the EEPROM page to erase.
  * @return Erase state.
  */
@@ -91,6 +129,10 @@ uint32_t eeprom_erase_page(uint32_t page_address)
 {
 	uint32_t erase_status = 0;
 
+	if (page_address == FLASH_EEPROM_ADDRESS_MAZE)
+		return maze_store_reset();
+
+	eeprom_wait_writes();
 	flash_unlock();
 
 	flash_erase_page(page_address);
@@ -100,3 +142,176 @@ uint32_t eeprom_erase_page(uint32_t page_address)
 
 	return RESULT_OK;
 }
+
+/**
+ * @brief Queue an asynchronous write.
+ *
+ * @return Write ticket, or `0` if the queue is full.
+ */
+static uint32_t queue_write(uint32_t address, const uint8_t *input_data,
+			    uint16_t num_bytes, bool erase)
+{
+	struct eeprom_write *write;
+
+	if (writes_head - writes_tail >= EEPROM_WRITES)
+		return 0;
+	write = &writes[writes_head % EEPROM_WRITES];
+	write->address = address;
+	write->data = input_data;
+	write->num_bytes = num_bytes;
+	write->programmed = 0;
+	write->erase = erase;
+	/* The entry must be complete before the interruption can see it */
+	__dmb();
+	writes_head++;
+	nvic_set_pending_irq(NVIC_FLASH_IRQ);
+	return writes_head;
+}
+
+/**
+ * @brief Queue an asynchronous write of a whole EEPROM page.
+ *
+ * Like `eeprom_flash_page()`, the page is erased and then programmed, but
+ * this function returns immediately. The operations are driven by the flash
+ * interruption, one after the end of the other, so the caller is never
+ * blocked waiting for the flash to complete.
+ *
+ * @param[in] page_address Address of a EEPROM page to flash on.
+ * @param[in] input_data Data to be flashed. It must remain unchanged until
+ * the write completes.
+ * @param[in] num_bytes Number of bytes to be flashed.
+ * @return Write ticket to check the completion with
+ * `eeprom_get_write_status()`, or `0` if the queue is full.
+ */
+uint32_t eeprom_flash_page_async(uint32_t page_address,
+				 const uint8_t *input_data, uint16_t num_bytes)
+{
+	return queue_write(page_address, input_data, num_bytes, true);
+}
+
+/**
+ * @brief Queue an asynchronous write to already erased flash.
+ *
+ * @param[in] address Address to program, aligned to a half word.
+ * @param[in] input_data Data to be flashed. It must remain unchanged until
+ * the write completes.
+ * @param[in] num_bytes Number of bytes to be flashed.
+ * @return Write ticket, or `0` if the queue is full.
+ *
+ * @see `eeprom_flash_page_async()`.
+ */
+uint32_t eeprom_program_async(uint32_t address, const uint8_t *input_data,
+			      uint16_t num_bytes)
+{
+	return queue_write(address, input_data, num_bytes, false);
+}
+
+/**
+ * @brief Get the result of an asynchronous write.
+ *
+ * Results are kept until `EEPROM_WRITES` newer writes are queued.
+ *
+ * @param[in] ticket Write ticket, as returned when queued.
+ * @return `EEPROM_WRITE_PENDING` or the flash state.
+ */
+uint32_t eeprom_get_write_status(uint32_t ticket)
+{
+	if ((int32_t)(ticket - writes_tail) > 0)
+		return EEPROM_WRITE_PENDING;
+	return write_status[(ticket - 1) % EEPROM_WRITES];
+}
+
+/**
+ * @brief Check whether there are asynchronous writes not yet completed.
+ */
+bool eeprom_writes_pending(void)
+{
+	return writes_head != writes_tail;
+}
+
+/**
+ * @brief Wait for all the asynchronous writes to complete.
+ */
+void eeprom_wait_writes(void)
+{
+	while (eeprom_writes_pending())
+		;
+}
+
+/**
+ * @brief Start the next flash operation of a write.
+ *
+ * The page is erased first, if requested, and then programmed half word by
+ * half word (an odd last byte is padded with an erased byte).
+ *
+ * @return Whether an operation was started (`false` if the write is
+ * complete).
+ */
+static bool write_next(struct eeprom_write *write)
+{
+	uint16_t half_word;
+	uint16_t offset = write->programmed;
+
+	if (write->erase) {
+		write->erase = false;
+		flash_start_erase_page(write->address &
+				       ~(FLASH_EEPROM_PAGE_SIZE - 1));
+		return true;
+	}
+	if (offset >= write->num_bytes)
+		return false;
+	half_word = write->data[offset];
+	if (offset + 1 < write->num_bytes)
+		half_word |= write->data[offset + 1] << 8;
+	else
+		half_word |= 0xFF00;
+	flash_start_program_half_word(write->address + offset, half_word);
+	write->programmed += BYTES_PER_HALF_WORD;
+	return true;
+}
+
+/**
+ * @brief Flash end of operation (and error) interruption handler.
+ *
+ * Also pended when a write is queued, to start it if the flash is idle.
+ *
+ * Each operation of the active write is started when the previous one ends.
+ * When the write completes (or fails), its result is saved and the next
+ * queued write is started. Flash interruptions are only enabled while there
+ * are writes in progress, so blocking flash functions are not disturbed.
+ */
+void flash_isr(void)
+{
+	uint32_t flash_status = flash_get_status_flags();
+	struct eeprom_write *write;
+	uint32_t index;
+
+	if (write_active && !(flash_status & (FLASH_SR_EOP | FLASH_SR_PGERR |
+					      FLASH_SR_WRPRTERR)))
+		return;
+	flash_clear_status_flags();
+	flash_end_operation();
+	while (writes_tail != writes_head) {
+		index = writes_tail % EEPROM_WRITES;
+		write = &writes[index];
+		if (!write_active) {
+			write_active = true;
+			flash_status = FLASH_SR_EOP;
+			flash_unlock();
+			flash_enable_interrupts(FLASH_CR_EOPIE |
+						FLASH_CR_ERRIE);
+		}
+		if (flash_status == FLASH_SR_EOP && write_next(write))
+			return;
+		if (flash_status != FLASH_SR_EOP)
+			write_status[index] = flash_status;
+		else if (memcmp((const void *)(uintptr_t)write->address,
+				write->data, write->num_bytes))
+			write_status[index] = FLASH_WRONG_DATA_WRITTEN;
+		else
+			write_status[index] = RESULT_OK;
+		write_active = false;
+		writes_tail++;
+	}
+	flash_disable_interrupts(FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+}
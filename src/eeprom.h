@@ -1,16 +1,36 @@
 #ifndef __EEPROM_H
 #define __EEPROM_H
 
+#include <stdbool.h>
+#include <string.h>
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/sync.h>
 #include <libopencm3/stm32/flash.h>
 
+#include "mylibopencm3.h"
+#include "setup.h"
+
 /** Flash results */
 #define RESULT_OK 0
 #define FLASH_WRONG_DATA_WRITTEN 0x80
+#define EEPROM_WRITE_PENDING 0x100
+#define EEPROM_DATA_TOO_LARGE 0x200
+
+/** Maximum number of queued asynchronous writes (must be a power of two) */
+#define EEPROM_WRITES 8
 
 uint32_t eeprom_flash_page(uint32_t page_address, uint8_t *input_data,
 			   uint16_t num_bytes);
 void eeprom_read_data(uint32_t start_address, uint16_t num_bytes,
 		      uint8_t *output_data);
 uint32_t eeprom_erase_page(uint32_t page_address);
+uint32_t eeprom_flash_page_async(uint32_t page_address,
+				 const uint8_t *input_data, uint16_t num_bytes);
+uint32_t eeprom_program_async(uint32_t address, const uint8_t *input_data,
+			      uint16_t num_bytes);
+uint32_t eeprom_get_write_status(uint32_t ticket);
+bool eeprom_writes_pending(void);
+void eeprom_wait_writes(void);
 
 #endif /* __EEPROM_H */
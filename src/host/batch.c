@@ -0,0 +1,417 @@
+#include <errno.h>
+#include <float.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "setup.h"
+
+#include "hal.h"
+#include "physics.h"
+#include "scenario.h"
+
+#define MAX_LINE_LENGTH 4096
+#define MAX_JOBS 256
+
+/**
+ * A batch scenario: a maze simulated with a given configuration.
+ */
+struct scenario {
+	unsigned int line;
+	char *maze;
+	float force;
+	uint32_t seed;
+	double sensor_noise;
+	double gyro_noise;
+	struct control_constants control;
+};
+
+/**
+ * A scenario being simulated in a child process.
+ */
+struct job {
+	pid_t pid;
+	int fd;
+	int index;
+};
+
+/** Control constants that can be set in a scenario, by name */
+static const struct {
+	const char *name;
+	size_t offset;
+} constants[] = {
+#define CONSTANT(field) {#field, offsetof(struct control_constants, field)}
+    CONSTANT(kp_linear),	  CONSTANT(kd_linear),
+    CONSTANT(kp_angular),	  CONSTANT(kd_angular),
+    CONSTANT(kp_angular_front),	  CONSTANT(ki_angular_front),
+    CONSTANT(kp_angular_side),	  CONSTANT(ki_angular_side),
+    CONSTANT(kp_angular_diagonal), CONSTANT(ki_angular_diagonal),
+#undef CONSTANT
+};
+
+/**
+ * @brief Set a `name=value` scenario parameter.
+ *
+ * @return Whether the parameter is known and the value is a number.
+ */
+static bool set_parameter(struct scenario *scenario, const char *parameter)
+{
+	const char *value = strchr(parameter, '=');
+	size_t length;
+	char *end;
+	double number;
+	size_t i;
+
+	if (!value)
+		return false;
+	length = (size_t)(value - parameter);
+	number = strtod(++value, &end);
+	if (end == value || *end)
+		return false;
+	if (!strncmp(parameter, "sensor_noise", length) && length == 12) {
+		scenario->sensor_noise = number;
+		return true;
+	}
+	if (!strncmp(parameter, "gyro_noise", length) && length == 10) {
+		scenario->gyro_noise = number;
+		return true;
+	}
+	for (i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+		if (strlen(constants[i].name) != length ||
+		    strncmp(parameter, constants[i].name, length))
+			continue;
+		*(float *)((char *)&scenario->control + constants[i].offset) =
+		    (float)number;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Parse a scenario line.
+ *
+ * The line format is `MAZE FORCE SEED [NAME=VALUE ...]`, where names are
+ * either `struct control_constants` fields or the noise standard deviations
+ * (`sensor_noise` in ADC counts and `gyro_noise` in radians per second).
+ * Control constants not set keep their default value.
+ *
+ * @return Whether the line is a valid scenario.
+ */
+static bool parse_scenario(char *line, struct scenario *scenario)
+{
+	char *token;
+	char *end;
+
+	memset(scenario, 0, sizeof(*scenario));
+	scenario->control = get_control_constants();
+	token = strtok(line, " \t\r\n");
+	if (!token)
+		return false;
+	scenario->maze = strdup(token);
+	token = strtok(NULL, " \t\r\n");
+	if (!token)
+		return false;
+	scenario->force = strtof(token, &end);
+	if (*end || scenario->force <= 0.)
+		return false;
+	token = strtok(NULL, " \t\r\n");
+	if (!token)
+		return false;
+	scenario->seed = (uint32_t)strtoul(token, &end, 0);
+	if (*end)
+		return false;
+	while ((token = strtok(NULL, " \t\r\n")))
+		if (!set_parameter(scenario, token))
+			return false;
+	return true;
+}
+
+/**
+ * @brief Load the scenarios from a file.
+ *
+ * Empty lines and lines starting with `#` are ignored.
+ *
+ * @return The number of scenarios loaded, or -1 on errors.
+ */
+static int load_scenarios(const char *path, struct scenario **scenarios)
+{
+	char line[MAX_LINE_LENGTH];
+	unsigned int number = 0;
+	int count = 0;
+	int capacity = 0;
+	char *start;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		return -1;
+	}
+	*scenarios = NULL;
+	while (fgets(line, sizeof(line), file)) {
+		number++;
+		start = line + strspn(line, " \t\r\n");
+		if (!*start || *start == '#')
+			continue;
+		if (count == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			*scenarios =
+			    realloc(*scenarios, capacity * sizeof(**scenarios));
+		}
+		if (!parse_scenario(start, &(*scenarios)[count])) {
+			fprintf(stderr, "%s:%u: invalid scenario\n", path,
+				number);
+			fclose(file);
+			return -1;
+		}
+		(*scenarios)[count++].line = number;
+	}
+	fclose(file);
+	return count;
+}
+
+/**
+ * @brief Simulate a scenario in the current (child) process.
+ *
+ * The firmware state is only initialized here, so every scenario starts
+ * from a fresh instance, as after a reset of the mouse. Ticks are emulated
+ * in lockstep (see `host_start_lockstep()`), so the result mostly depends on
+ * the scenario only.
+ */
+static void simulate_scenario(const struct scenario *scenario,
+			      struct scenario_result *result)
+{
+	host_set_serial_output(-1);
+	setup();
+	set_control_constants(scenario->control);
+	physics_set_noise(scenario->seed, scenario->sensor_noise,
+			  scenario->gyro_noise);
+	systick_interrupt_enable();
+	scenario_run(scenario->maze, scenario->force, 0., result);
+	host_stop_lockstep();
+}
+
+/**
+ * @brief Start simulating a scenario in a child process.
+ *
+ * The result is written by the child to a pipe, which is small enough to
+ * never block.
+ *
+ * @return Whether the child process was started.
+ */
+static bool start_job(const struct scenario *scenario, int index,
+		      struct job *job)
+{
+	struct scenario_result result;
+	int fds[2];
+
+	if (pipe(fds))
+		return false;
+	fflush(stdout);
+	fflush(stderr);
+	job->pid = fork();
+	if (job->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (!job->pid) {
+		close(fds[0]);
+		simulate_scenario(scenario, &result);
+		if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+	close(fds[1]);
+	job->fd = fds[0];
+	job->index = index;
+	return true;
+}
+
+/**
+ * @brief Collect the result of a finished child process.
+ *
+ * Children that exit abnormally get a `failed` status.
+ */
+static void finish_job(struct job *job, struct scenario_result *results)
+{
+	struct scenario_result *result = &results[job->index];
+
+	if (read(job->fd, result, sizeof(*result)) != sizeof(*result)) {
+		memset(result, 0, sizeof(*result));
+		strcpy(result->status, "failed");
+	}
+	result->status[sizeof(result->status) - 1] = '\0';
+	close(job->fd);
+	job->pid = 0;
+}
+
+/**
+ * @brief Write the result of a scenario as a CSV row.
+ */
+static void print_result(const struct scenario *scenario,
+			 const struct scenario_result *result)
+{
+	printf("%u,%s,%.3f,%u,%s,%.3f,%u,%.6f,%.3f,%.3f\n", scenario->line,
+	       scenario->maze, scenario->force, scenario->seed, result->status,
+	       result->explore_time, result->cells_explored,
+	       result->decision_time, result->run_time, result->path_length);
+	fflush(stdout);
+}
+
+/**
+ * @brief Write the aggregated results to the standard error output.
+ *
+ * Scenarios are counted by status. Times are aggregated over the scenarios
+ * that finished without collisions, and the fastest speed run is reported.
+ */
+static void print_summary(const struct scenario *scenarios,
+			  const struct scenario_result *results, int count)
+{
+	double explore_sum = 0.;
+	double run_sum = 0.;
+	double run_min = DBL_MAX;
+	int best = -1;
+	int ok = 0;
+	int counted;
+	int i;
+	int j;
+
+	fprintf(stderr, "%d scenarios\n", count);
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < i; j++)
+			if (!strcmp(results[j].status, results[i].status))
+				break;
+		if (j < i)
+			continue;
+		counted = 0;
+		for (j = i; j < count; j++)
+			if (!strcmp(results[j].status, results[i].status))
+				counted++;
+		fprintf(stderr, "  %s: %d\n", results[i].status, counted);
+	}
+	for (i = 0; i < count; i++) {
+		if (strcmp(results[i].status, "ok"))
+			continue;
+		ok++;
+		explore_sum += results[i].explore_time;
+		run_sum += results[i].run_time;
+		if (results[i].run_time < run_min) {
+			run_min = results[i].run_time;
+			best = i;
+		}
+	}
+	if (!ok)
+		return;
+	fprintf(stderr, "mean explore time: %.3f s\n", explore_sum / ok);
+	fprintf(stderr, "mean run time: %.3f s\n", run_sum / ok);
+	fprintf(stderr, "best run time: %.3f s (line %u, %s, force %.3f)\n",
+		run_min, scenarios[best].line, scenarios[best].maze,
+		scenarios[best].force);
+}
+
+/**
+ * @brief Simulate a batch of scenarios in parallel.
+ *
+ * Usage: `batch [-j JOBS] SCENARIOS_FILE`
+ *
+ * Each line of the scenarios file is a maze file path, a force, a noise
+ * seed and, optionally, `NAME=VALUE` parameters overriding the control
+ * constants (see `parse_scenario()`). For example:
+ *
+ * `mazes/japan2017.txt 0.3 7 kp_linear=900 sensor_noise=5`
+ *
+ * Every scenario is explored, solved and speed run (as `benchmark` does)
+ * in its own process, so firmware state is never shared among them. Up to
+ * `JOBS` scenarios (by default, the number of online processors) are
+ * simulated at the same time. Ticks are always emulated in lockstep (see
+ * `host_start_lockstep()`), so results depend much less on the number of
+ * jobs or the host load than with wall-clock ticks, although they are only
+ * strictly reproducible when every wait busy-polls the cycle counter.
+ *
+ * Results are written to the standard output as CSV, one scenario per line
+ * and in the same order as in the scenarios file, with the same fields as
+ * `benchmark` plus the scenario line, force and seed. A summary is written
+ * to the standard error output at the end.
+ */
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	struct scenario *scenarios;
+	struct scenario_result *results;
+	struct job jobs[MAX_JOBS] = {0};
+	bool *finished;
+	long processors;
+	int max_jobs = 0;
+	int running = 0;
+	int started = 0;
+	int printed = 0;
+	int count;
+	pid_t pid;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			max_jobs = atoi(argv[++i]);
+		else
+			path = argv[i];
+	}
+	if (!max_jobs) {
+		processors = sysconf(_SC_NPROCESSORS_ONLN);
+		max_jobs = processors > 0 ? (int)processors : 1;
+	}
+	if (max_jobs > MAX_JOBS)
+		max_jobs = MAX_JOBS;
+	if (!path || max_jobs < 0) {
+		fprintf(stderr, "Usage: %s [-j JOBS] SCENARIOS_FILE\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+	count = load_scenarios(path, &scenarios);
+	if (count < 0)
+		return EXIT_FAILURE;
+	results = calloc(count, sizeof(*results));
+	finished = calloc(count, sizeof(*finished));
+
+	printf("line,maze,force,seed,status,explore_time,cells_explored,"
+	       "decision_time,run_time,path_length\n");
+	while (printed < count) {
+		for (i = 0; i < max_jobs && started < count; i++) {
+			if (jobs[i].pid)
+				continue;
+			if (!start_job(&scenarios[started], started,
+				       &jobs[i])) {
+				perror("Unable to start a scenario");
+				if (!running)
+					return EXIT_FAILURE;
+				break;
+			}
+			started++;
+			running++;
+		}
+		pid = wait(NULL);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Unable to wait for a scenario");
+			return EXIT_FAILURE;
+		}
+		for (i = 0; i < max_jobs; i++) {
+			if (jobs[i].pid != pid)
+				continue;
+			finished[jobs[i].index] = true;
+			finish_job(&jobs[i], results);
+			running--;
+		}
+		while (printed < count && finished[printed]) {
+			print_result(&scenarios[printed], &results[printed]);
+			printed++;
+		}
+	}
+	print_summary(scenarios, results, count);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "setup.h"
+
+#include "hal.h"
+#include "scenario.h"
+
+#define DEFAULT_FORCE 0.25
+#define MAX_PATH_LENGTH 4096
+
+/**
+ * @brief Only consider non-hidden entries as maze files.
+ */
+static int maze_file(const struct dirent *entry)
+{
+	return entry->d_name[0] != '.';
+}
+
+/**
+ * @brief Benchmark the search and the solver over a directory of mazes.
+ *
+ * Usage: `benchmark [-s TIME_SCALE] [-f FORCE] MAZE_DIRECTORY`
+ *
+ * Each text maze file in the directory (in alphabetical order) is explored,
+ * solved and speed run, as `simulate` does. Results are written to the
+ * standard output as CSV, one maze per line:
+ *
+ * - `status`: `ok`, `invalid` (not a valid maze file), `explore_collision`
+ *   or `run_collision`.
+ * - `explore_time`: simulated exploration time, in seconds.
+ * - `cells_explored`: cells visited during the exploration.
+ * - `decision_time`: host time computing the run sequence (with the ticks
+ *   stopped), in seconds.
+ * - `run_time`: simulated speed run time, in seconds.
+ * - `path_length`: distance traveled during the speed run, in meters.
+ *
+ * Ticks are emulated in lockstep (see `host_start_lockstep()`), unless a
+ * `TIME_SCALE` is given (see `simulate`), so results are mostly
+ * reproducible. Firmware serial output is discarded.
+ */
+int main(int argc, char *argv[])
+{
+	float time_scale = 0.;
+	float force = DEFAULT_FORCE;
+	const char *directory = NULL;
+	char path[MAX_PATH_LENGTH];
+	struct dirent **entries;
+	struct scenario_result result;
+	int count;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			time_scale = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			force = atof(argv[++i]);
+		else
+			directory = argv[i];
+	}
+	if (!directory || time_scale < 0.) {
+		fprintf(stderr,
+			"Usage: %s [-s TIME_SCALE] [-f FORCE] MAZE_DIRECTORY\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+	count = scandir(directory, &entries, maze_file, alphasort);
+	if (count < 0) {
+		fprintf(stderr, "Unable to read %s\n", directory);
+		return EXIT_FAILURE;
+	}
+
+	host_set_serial_output(-1);
+	setup();
+	systick_interrupt_enable();
+
+	printf("maze,status,explore_time,cells_explored,decision_time,"
+	       "run_time,path_length\n");
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/%s", directory,
+			 entries[i]->d_name);
+		scenario_run(path, force, time_scale, &result);
+		printf("%s,%s,%.3f,%u,%.6f,%.3f,%.3f\n", entries[i]->d_name,
+		       result.status, result.explore_time,
+		       result.cells_explored, result.decision_time,
+		       result.run_time, result.path_length);
+		fflush(stdout);
+		free(entries[i]);
+	}
+	free(entries);
+	host_stop_realtime();
+	host_stop_lockstep();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hal.h"
+
+#define INPUT_BUFFER_SIZE 256
+
+int bulebule_main(void);
+
+/**
+ * @brief Forward the standard input to the emulated serial port.
+ *
+ * Line feeds are replaced with the `'\0'` command terminator, so each line is
+ * received as a command. No more bytes than the USART can receive at the
+ * configured baud rate are read on each tick (none before it is enabled).
+ */
+static void receive_stdin(void)
+{
+	char buffer[INPUT_BUFFER_SIZE];
+	size_t limit = sizeof(buffer);
+	ssize_t size;
+	ssize_t i;
+
+	if (host_get_serial_bytes_per_tick() < limit)
+		limit = host_get_serial_bytes_per_tick();
+	size = read(STDIN_FILENO, buffer, limit);
+	if (size <= 0)
+		return;
+	for (i = 0; i < size; i++) {
+		if (buffer[i] == '\n')
+			buffer[i] = '\0';
+	}
+	host_serial_receive(buffer, size);
+}
+
+/**
+ * @brief Run the firmware on the host.
+ *
+ * The firmware `main()` function is executed with SysTick interruptions
+ * emulated at `BULEBULE_TIME_SCALE` times real time (defaults to `1`).
+ * Serial output is written to the standard output and commands are read from
+ * the standard input.
+ */
+int main(void)
+{
+	const char *time_scale = getenv("BULEBULE_TIME_SCALE");
+
+	fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+	host_set_tick_hook(receive_stdin);
+	host_start_realtime(time_scale ? atof(time_scale) : 1.);
+	return bulebule_main();
+}
@@ -0,0 +1,2501 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/sync.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
+
+#include "hal.h"
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define THREAD_MODE_PRIORITY 256
+#define NUM_TIMERS 4
+#define NUM_DMA_CHANNELS 7
+#define REALTIME_MIN_PERIOD_US 10
+#define LOCKSTEP_READ_CYCLES 64
+#define LOCKSTEP_PERIOD_US 100
+#define LOCKSTEP_MIN_POLL_US 10
+#define FLASH_PAGE_SIZE 0x400
+#define FLASH_PROGRAM_US 52
+#define FLASH_ERASE_US 20000
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+
+/*
+ * Register accesses within the host backend must not trigger the side effects
+ * emulated in `host_register()`.
+ */
+static volatile uint32_t *peripheral_register(uint32_t address);
+#undef MMIO32
+#define MMIO32(addr) (*peripheral_register(addr))
+
+#define TIM_CCR(tim, index) MMIO32((tim) + 0x34 + 4 * (index))
+#define ADC_JDR(adc, index) MMIO32((adc) + 0x3c + 4 * (index))
+
+uint32_t rcc_ahb_frequency = 8000000;
+uint32_t rcc_apb1_frequency = 8000000;
+uint32_t rcc_apb2_frequency = 8000000;
+
+static uint32_t peripherals[PERIPH_SIZE / sizeof(uint32_t)];
+static bool usart_status_read;
+static uint32_t usart_transmit_credit;
+
+static uint16_t flash_latch;
+static uint32_t flash_latch_address;
+static bool flash_latched;
+static uint64_t flash_credit;
+
+static volatile uint64_t irq_pending;
+static volatile uint64_t irq_enabled;
+static uint8_t irq_priority[NVIC_IRQ_COUNT];
+static volatile int execution_priority = THREAD_MODE_PRIORITY;
+static volatile bool interrupts_masked;
+
+static volatile uint64_t cycles_base;
+static volatile uint64_t tick_timestamp;
+static volatile uint32_t ticks;
+static uint32_t cycles_per_tick = 8000;
+static bool systick_counter_enabled;
+static bool cycles_override_set;
+static uint64_t cycles_override;
+static volatile uint32_t systick_cycles;
+static float realtime_scale = 1.;
+static volatile bool realtime_running;
+static long realtime_period_us;
+static volatile bool lockstep_running;
+static volatile bool lockstep_ticking;
+static volatile uint32_t lockstep_cycles;
+static volatile uint64_t lockstep_cpu_timestamp;
+static volatile uint32_t lockstep_polls;
+static uint32_t lockstep_checked_polls;
+static void (*tick_hook)(void);
+
+static uint64_t timer_accumulated[NUM_TIMERS];
+static uint32_t timer_oc_active[NUM_TIMERS][4];
+static uint16_t dma_reload[NUM_DMA_CHANNELS + 1];
+
+static uint16_t adc_channel_values[18];
+static uint8_t adc_regular_position[2];
+static uint16_t (*adc_sampler)(uint32_t adc, uint8_t channel);
+
+static uint8_t mpu_registers[128];
+static int mpu_address = -1;
+static bool mpu_reading;
+static uint8_t mpu_fifo[HOST_MPU_FIFO_SIZE];
+static uint16_t mpu_fifo_head;
+static uint16_t mpu_fifo_count;
+static uint64_t mpu_sample_accumulated;
+
+static int serial_output_fd = STDOUT_FILENO;
+
+/*
+ * Timers and SPI trigger ADC conversions and DMA transfers, which are emulated
+ * further below.
+ */
+static void adc_external_trigger_regular(uint32_t extsel);
+static void dma_request(uint8_t channel);
+static uint8_t dma_find_channel(volatile uint32_t *reg, bool from_memory);
+static void lockstep_tick(void);
+
+/**
+ * DMA1 channels serving each timer requests: update event followed by the
+ * compare events of channels 1 to 4 (`0` if there is none).
+ */
+static const uint8_t timer_dma_channels[NUM_TIMERS][5] = {
+    {5, 2, 3, 6, 4},
+    {2, 5, 7, 1, 7},
+    {3, 6, 0, 2, 3},
+    {7, 1, 4, 5, 0},
+};
+
+/**
+ * ADC regular group external trigger selection connected to each timer
+ * compare event (`-1` if there is none).
+ */
+static const int timer_adc_triggers[NUM_TIMERS][4] = {
+    {ADC_CR2_EXTSEL_TIM1_CC1, ADC_CR2_EXTSEL_TIM1_CC2, ADC_CR2_EXTSEL_TIM1_CC3,
+     -1},
+    {-1, ADC_CR2_EXTSEL_TIM2_CC2, -1, -1},
+    {-1, -1, -1, -1},
+    {-1, -1, -1, ADC_CR2_EXTSEL_TIM4_CC4},
+};
+
+static void null_handler(void)
+{
+}
+
+void sys_tick_handler(void) __attribute__((weak, alias("null_handler")));
+void flash_isr(void) __attribute__((weak, alias("null_handler")));
+void dma1_channel1_isr(void) __attribute__((weak, alias("null_handler")));
+void dma1_channel2_isr(void) __attribute__((weak, alias("null_handler")));
+void dma1_channel3_isr(void) __attribute__((weak, alias("null_handler")));
+void dma1_channel4_isr(void) __attribute__((weak, alias("null_handler")));
+void dma1_channel5_isr(void) __attribute__((weak, alias("null_handler")));
+void dma1_channel6_isr(void) __attribute__((weak, alias("null_handler")));
+void dma1_channel7_isr(void) __attribute__((weak, alias("null_handler")));
+void adc1_2_isr(void) __attribute__((weak, alias("null_handler")));
+void exti9_5_isr(void) __attribute__((weak, alias("null_handler")));
+void tim1_up_isr(void) __attribute__((weak, alias("null_handler")));
+void tim1_cc_isr(void) __attribute__((weak, alias("null_handler")));
+void tim2_isr(void) __attribute__((weak, alias("null_handler")));
+void tim3_isr(void) __attribute__((weak, alias("null_handler")));
+void tim4_isr(void) __attribute__((weak, alias("null_handler")));
+void spi2_isr(void) __attribute__((weak, alias("null_handler")));
+void usart3_isr(void) __attribute__((weak, alias("null_handler")));
+void exti15_10_isr(void) __attribute__((weak, alias("null_handler")));
+
+static void (*const vector_table[NVIC_IRQ_COUNT])(void) = {
+    [NVIC_FLASH_IRQ] = flash_isr,
+    [NVIC_DMA1_CHANNEL1_IRQ] = dma1_channel1_isr,
+    [NVIC_DMA1_CHANNEL2_IRQ] = dma1_channel2_isr,
+    [NVIC_DMA1_CHANNEL3_IRQ] = dma1_channel3_isr,
+    [NVIC_DMA1_CHANNEL4_IRQ] = dma1_channel4_isr,
+    [NVIC_DMA1_CHANNEL5_IRQ] = dma1_channel5_isr,
+    [NVIC_DMA1_CHANNEL6_IRQ] = dma1_channel6_isr,
+    [NVIC_DMA1_CHANNEL7_IRQ] = dma1_channel7_isr,
+    [NVIC_ADC1_2_IRQ] = adc1_2_isr,
+    [NVIC_EXTI9_5_IRQ] = exti9_5_isr,
+    [NVIC_TIM1_UP_IRQ] = tim1_up_isr,
+    [NVIC_TIM1_CC_IRQ] = tim1_cc_isr,
+    [NVIC_TIM2_IRQ] = tim2_isr,
+    [NVIC_TIM3_IRQ] = tim3_isr,
+    [NVIC_TIM4_IRQ] = tim4_isr,
+    [NVIC_SPI2_IRQ] = spi2_isr,
+    [NVIC_USART3_IRQ] = usart3_isr,
+    [NVIC_EXTI15_10_IRQ] = exti15_10_isr,
+    [NVIC_SYSTICK_IRQ] = sys_tick_handler,
+};
+
+/**
+ * @brief Host monotonic clock, in nanoseconds.
+ */
+static uint64_t host_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+/**
+ * @brief Convert host nanoseconds to SYSCLK cycles.
+ */
+static uint64_t nanoseconds_to_cycles(uint64_t nanoseconds)
+{
+	return nanoseconds * rcc_ahb_frequency / NANOSECONDS_PER_SECOND;
+}
+
+/**
+ * @brief Map the emulated flash memory at its target address.
+ *
+ * Firmware code accesses flash through absolute addresses (i.e.:
+ * `FLASH_EEPROM_ADDRESS_MAZE`), so the memory is mapped at `FLASH_BASE`. The
+ * host binaries are linked with `-no-pie` so that this address range and the
+ * static data (which is referenced through 32-bit DMA address registers) are
+ * both reachable with 32-bit addresses.
+ */
+__attribute__((constructor)) static void host_init(void)
+{
+	void *flash;
+
+	flash = mmap((void *)(uintptr_t)FLASH_BASE, FLASH_SIZE,
+		     PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (flash != (void *)(uintptr_t)FLASH_BASE) {
+		perror("Unable to map the emulated flash memory");
+		exit(EXIT_FAILURE);
+	}
+	memset(flash, 0xff, FLASH_SIZE);
+
+	/* A charged battery (~4 V) read through the voltage divider */
+	adc_channel_values[ADC_CHANNEL0] = 2482;
+
+	mpu_registers[HOST_MPU_WHO_AM_I] = HOST_MPU_WHO_AM_I_VALUE;
+	tick_timestamp = host_now();
+}
+
+/**
+ * @brief Return a pointer to the backing memory of a peripheral register.
+ *
+ * Unlike `host_register()`, this function has no side effects, so it is the
+ * one to be used within the host backend.
+ */
+static volatile uint32_t *peripheral_register(uint32_t address)
+{
+	if (address < PERIPH_BASE || address >= PERIPH_BASE + PERIPH_SIZE) {
+		fprintf(stderr, "Invalid peripheral address 0x%08x\n",
+			address);
+		abort();
+	}
+	return &peripherals[(address - PERIPH_BASE) / sizeof(uint32_t)];
+}
+
+/**
+ * @brief Access a peripheral register from firmware code.
+ *
+ * Emulates the side effects of register accesses that firmware relies on:
+ *
+ * - Reading the USART status register followed by a read of the data register
+ *   clears the idle line detected flag.
+ */
+volatile uint32_t *host_register(uint32_t address)
+{
+	volatile uint32_t *reg = peripheral_register(address);
+
+	if (reg == &USART_SR(USART3)) {
+		usart_status_read = true;
+	} else if (reg == &USART_DR(USART3)) {
+		if (usart_status_read)
+			USART_SR(USART3) &= ~USART_SR_IDLE;
+		usart_status_read = false;
+	}
+	return reg;
+}
+
+/**
+ * @brief Execute pending interrupts with enough priority to preempt.
+ *
+ * Interrupts are executed synchronously on the host thread. The execution
+ * priority is tracked to emulate NVIC preemption: an interrupt only runs if
+ * its priority is higher (lower value) than the one currently executing.
+ *
+ * Interrupts remain pending while they are masked with
+ * `cm_disable_interrupts()`.
+ */
+static void irq_dispatch(void)
+{
+	int irqn;
+	int selected;
+	int saved_priority;
+	uint64_t mask;
+
+	while (!interrupts_masked) {
+		selected = -1;
+		for (irqn = 0; irqn < NVIC_IRQ_COUNT; irqn++) {
+			mask = 1ULL << irqn;
+			if (!(irq_pending & irq_enabled & mask))
+				continue;
+			if (irq_priority[irqn] >= execution_priority)
+				continue;
+			if (selected < 0 ||
+			    irq_priority[irqn] < irq_priority[selected])
+				selected = irqn;
+		}
+		if (selected < 0)
+			return;
+		mask = 1ULL << selected;
+		if (!(__atomic_fetch_and(&irq_pending, ~mask,
+					 __ATOMIC_SEQ_CST) &
+		      mask))
+			continue;
+		saved_priority = execution_priority;
+		execution_priority = irq_priority[selected];
+		vector_table[selected]();
+		execution_priority = saved_priority;
+	}
+}
+
+/**
+ * @brief Set an interrupt as pending and dispatch it if possible.
+ */
+static void irq_raise(uint8_t irqn)
+{
+	__atomic_fetch_or(&irq_pending, 1ULL << irqn, __ATOMIC_SEQ_CST);
+	irq_dispatch();
+}
+
+void cm_enable_interrupts(void)
+{
+	interrupts_masked = false;
+	irq_dispatch();
+}
+
+void cm_disable_interrupts(void)
+{
+	interrupts_masked = true;
+}
+
+void nvic_enable_irq(uint8_t irqn)
+{
+	__atomic_fetch_or(&irq_enabled, 1ULL << irqn, __ATOMIC_SEQ_CST);
+	irq_dispatch();
+}
+
+void nvic_disable_irq(uint8_t irqn)
+{
+	__atomic_fetch_and(&irq_enabled, ~(1ULL << irqn), __ATOMIC_SEQ_CST);
+}
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority)
+{
+	irq_priority[irqn] = priority;
+}
+
+void nvic_set_pending_irq(uint8_t irqn)
+{
+	irq_raise(irqn);
+}
+
+bool dwt_enable_cycle_counter(void)
+{
+	return true;
+}
+
+/**
+ * @brief Emulated SYSCLK cycles since the start.
+ *
+ * Whole ticks advance the counter by the SysTick reload value. Within a tick,
+ * the host time elapsed since the tick started is added (scaled to SYSCLK
+ * cycles and never reaching the next tick, so the counter is monotonic).
+ *
+ * In lockstep mode, the cycles within a tick are counted by the reads from
+ * thread mode instead (see `dwt_read_cycle_counter()`), so they do not depend
+ * on the host time.
+ *
+ * Input events emulated in the past (i.e.: encoder edges) override the
+ * counter while their interruptions are dispatched.
+ */
+static uint64_t emulated_cycles(void)
+{
+	uint64_t elapsed;
+
+	if (cycles_override_set)
+		return cycles_override;
+	if (lockstep_running) {
+		elapsed = lockstep_cycles;
+	} else {
+		elapsed = nanoseconds_to_cycles(host_now() - tick_timestamp);
+		elapsed = (uint64_t)(elapsed * realtime_scale);
+	}
+	if (elapsed >= cycles_per_tick)
+		elapsed = cycles_per_tick - 1;
+	return cycles_base + elapsed;
+}
+
+/**
+ * @brief Read the emulated cycle counter.
+ *
+ * In lockstep mode, each read from thread mode (with interruptions enabled)
+ * is a busy-poll point: it advances the counter by `LOCKSTEP_READ_CYCLES` and
+ * emulates a tick when the SysTick period is completed.
+ */
+uint32_t dwt_read_cycle_counter(void)
+{
+	if (lockstep_running && !lockstep_ticking && !interrupts_masked &&
+	    execution_priority == THREAD_MODE_PRIORITY) {
+		lockstep_polls++;
+		lockstep_cycles += LOCKSTEP_READ_CYCLES;
+		if (lockstep_cycles >= cycles_per_tick)
+			lockstep_tick();
+	}
+	return (uint32_t)emulated_cycles();
+}
+
+bool systick_set_frequency(uint32_t freq, uint32_t ahb)
+{
+	cycles_per_tick = ahb / freq;
+	return true;
+}
+
+void systick_counter_enable(void)
+{
+	systick_counter_enabled = true;
+}
+
+void systick_counter_disable(void)
+{
+	systick_counter_enabled = false;
+}
+
+void systick_interrupt_enable(void)
+{
+	nvic_enable_irq(NVIC_SYSTICK_IRQ);
+}
+
+void systick_interrupt_disable(void)
+{
+	nvic_disable_irq(NVIC_SYSTICK_IRQ);
+}
+
+void mutex_lock(mutex_t *m)
+{
+	while (!mutex_trylock(m))
+		;
+}
+
+uint32_t mutex_trylock(mutex_t *m)
+{
+	return __atomic_exchange_n(m, MUTEX_LOCKED, __ATOMIC_SEQ_CST) ==
+	       MUTEX_UNLOCKED;
+}
+
+void mutex_unlock(mutex_t *m)
+{
+	__atomic_store_n(m, MUTEX_UNLOCKED, __ATOMIC_SEQ_CST);
+}
+
+void rcc_clock_setup_in_hse_8mhz_out_72mhz(void)
+{
+	rcc_ahb_frequency = 72000000;
+	rcc_apb1_frequency = 36000000;
+	rcc_apb2_frequency = 72000000;
+}
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken)
+{
+	(void)clken;
+}
+
+static int timer_index(uint32_t timer_peripheral)
+{
+	switch (timer_peripheral) {
+	case TIM1:
+		return 0;
+	case TIM2:
+		return 1;
+	case TIM3:
+		return 2;
+	case TIM4:
+		return 3;
+	default:
+		abort();
+	}
+}
+
+static uint8_t timer_irq(uint32_t timer_peripheral)
+{
+	switch (timer_peripheral) {
+	case TIM1:
+		return NVIC_TIM1_UP_IRQ;
+	case TIM2:
+		return NVIC_TIM2_IRQ;
+	case TIM3:
+		return NVIC_TIM3_IRQ;
+	default:
+		return NVIC_TIM4_IRQ;
+	}
+}
+
+static void timer_reset(uint32_t timer_peripheral)
+{
+	int index = timer_index(timer_peripheral);
+
+	memset((void *)peripheral_register(timer_peripheral), 0, 0x50);
+	timer_accumulated[index] = 0;
+	memset(timer_oc_active[index], 0, sizeof(timer_oc_active[index]));
+}
+
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst)
+{
+	switch (rst) {
+	case RST_TIM1:
+		timer_reset(TIM1);
+		break;
+	case RST_TIM2:
+		timer_reset(TIM2);
+		break;
+	case RST_TIM3:
+		timer_reset(TIM3);
+		break;
+	case RST_TIM4:
+		timer_reset(TIM4);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Handle the MPU chip select line.
+ *
+ * Selecting the device starts a new transaction, in which the first byte
+ * received is the register address (with the read bit).
+ */
+static void mpu_select(bool selected)
+{
+	if (selected)
+		mpu_address = -1;
+}
+
+void gpio_set_mode(uint32_t gpioport, uint8_t mode, uint8_t cnf,
+		   uint16_t gpios)
+{
+	(void)gpioport;
+	(void)mode;
+	(void)cnf;
+	(void)gpios;
+}
+
+void gpio_primary_remap(uint32_t swjenable, uint32_t maps)
+{
+	AFIO_MAPR = swjenable | maps;
+}
+
+void gpio_set(uint32_t gpioport, uint16_t gpios)
+{
+	GPIO_ODR(gpioport) |= gpios;
+	if (gpioport == HOST_MPU_CS_PORT && (gpios & HOST_MPU_CS_PIN))
+		mpu_select(false);
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios)
+{
+	GPIO_ODR(gpioport) &= ~gpios;
+	if (gpioport == HOST_MPU_CS_PORT && (gpios & HOST_MPU_CS_PIN))
+		mpu_select(true);
+}
+
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios)
+{
+	return GPIO_IDR(gpioport) & gpios;
+}
+
+void gpio_toggle(uint32_t gpioport, uint16_t gpios)
+{
+	GPIO_ODR(gpioport) ^= gpios;
+}
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig)
+{
+	if (trig == EXTI_TRIGGER_RISING || trig == EXTI_TRIGGER_BOTH)
+		EXTI_RTSR |= extis;
+	else
+		EXTI_RTSR &= ~extis;
+	if (trig == EXTI_TRIGGER_FALLING || trig == EXTI_TRIGGER_BOTH)
+		EXTI_FTSR |= extis;
+	else
+		EXTI_FTSR &= ~extis;
+}
+
+void exti_enable_request(uint32_t extis)
+{
+	EXTI_IMR |= extis;
+	EXTI_EMR |= extis;
+}
+
+void exti_disable_request(uint32_t extis)
+{
+	EXTI_IMR &= ~extis;
+	EXTI_EMR &= ~extis;
+}
+
+void exti_reset_request(uint32_t extis)
+{
+	EXTI_PR = extis;
+}
+
+void exti_select_source(uint32_t exti, uint32_t gpioport)
+{
+	int line = __builtin_ctz(exti);
+	uint32_t shift = (line % 4) * 4;
+	uint32_t port = (gpioport - GPIOA) / (GPIOB - GPIOA);
+
+	AFIO_EXTICR(line / 4) &= ~(0xf << shift);
+	AFIO_EXTICR(line / 4) |= port << shift;
+}
+
+uint32_t exti_get_flag_status(uint32_t exti)
+{
+	return EXTI_PR & exti;
+}
+
+/**
+ * @brief Change the level of a GPIO input, raising its EXTI interruption.
+ *
+ * The EXTI line is only triggered if the GPIO port is its selected source and
+ * the edge is enabled. Lines 5 to 9 and 10 to 15 share an interruption.
+ */
+static void gpio_input_edge(uint32_t gpioport, uint16_t gpio, bool level)
+{
+	int line = __builtin_ctz(gpio);
+	uint32_t port = (gpioport - GPIOA) / (GPIOB - GPIOA);
+	uint32_t trigger = level ? EXTI_RTSR : EXTI_FTSR;
+
+	host_set_gpio_input(gpioport, gpio, level);
+	if (((AFIO_EXTICR(line / 4) >> (line % 4) * 4) & 0xf) != port)
+		return;
+	if (!(EXTI_IMR & trigger & gpio))
+		return;
+	EXTI_PR |= gpio;
+	if (line >= 10)
+		irq_raise(NVIC_EXTI15_10_IRQ);
+	else if (line >= 5)
+		irq_raise(NVIC_EXTI9_5_IRQ);
+}
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div,
+		    uint32_t alignment, uint32_t direction)
+{
+	TIM_CR1(timer_peripheral) &= ~(0x3ff & ~(TIM_CR1_CEN | TIM_CR1_ARPE));
+	TIM_CR1(timer_peripheral) |= clock_div | alignment | direction;
+}
+
+void timer_set_clock_division(uint32_t timer_peripheral, uint32_t clock_div)
+{
+	TIM_CR1(timer_peripheral) |= clock_div;
+}
+
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value)
+{
+	TIM_PSC(timer_peripheral) = value;
+}
+
+void timer_set_repetition_counter(uint32_t timer_peripheral, uint32_t value)
+{
+	TIM_RCR(timer_peripheral) = value;
+}
+
+void timer_set_period(uint32_t timer_peripheral, uint32_t period)
+{
+	TIM_ARR(timer_peripheral) = period;
+}
+
+void timer_enable_preload(uint32_t timer_peripheral)
+{
+	TIM_CR1(timer_peripheral) |= TIM_CR1_ARPE;
+}
+
+void timer_disable_preload(uint32_t timer_peripheral)
+{
+	TIM_CR1(timer_peripheral) &= ~TIM_CR1_ARPE;
+}
+
+void timer_continuous_mode(uint32_t timer_peripheral)
+{
+	TIM_CR1(timer_peripheral) &= ~TIM_CR1_OPM;
+}
+
+void timer_enable_update_event(uint32_t timer_peripheral)
+{
+	TIM_CR1(timer_peripheral) &= ~TIM_CR1_UDIS;
+}
+
+void timer_disable_update_event(uint32_t timer_peripheral)
+{
+	TIM_CR1(timer_peripheral) |= TIM_CR1_UDIS;
+}
+
+void timer_enable_counter(uint32_t timer_peripheral)
+{
+	TIM_CR1(timer_peripheral) |= TIM_CR1_CEN;
+}
+
+void timer_disable_counter(uint32_t timer_peripheral)
+{
+	TIM_CR1(timer_peripheral) &= ~TIM_CR1_CEN;
+}
+
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq)
+{
+	TIM_DIER(timer_peripheral) |= irq;
+}
+
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq)
+{
+	TIM_DIER(timer_peripheral) &= ~irq;
+}
+
+bool timer_get_flag(uint32_t timer_peripheral, uint32_t flag)
+{
+	return (TIM_SR(timer_peripheral) & flag) != 0;
+}
+
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag)
+{
+	TIM_SR(timer_peripheral) &= ~flag;
+}
+
+uint32_t timer_get_counter(uint32_t timer_peripheral)
+{
+	return TIM_CNT(timer_peripheral);
+}
+
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count)
+{
+	TIM_CNT(timer_peripheral) = count;
+}
+
+/**
+ * @brief Return the CCMRx register and the bit shift of the output compare
+ * channel configuration within it.
+ */
+static volatile uint32_t *oc_ccmr(uint32_t timer_peripheral,
+				  enum tim_oc_id oc_id, int *shift)
+{
+	switch (oc_id) {
+	case TIM_OC1:
+		*shift = 0;
+		return &TIM_CCMR1(timer_peripheral);
+	case TIM_OC2:
+		*shift = 8;
+		return &TIM_CCMR1(timer_peripheral);
+	case TIM_OC3:
+		*shift = 0;
+		return &TIM_CCMR2(timer_peripheral);
+	case TIM_OC4:
+		*shift = 8;
+		return &TIM_CCMR2(timer_peripheral);
+	default:
+		abort();
+	}
+}
+
+static int oc_index(enum tim_oc_id oc_id)
+{
+	return oc_id / 2;
+}
+
+/**
+ * @brief Emulate a timer update event.
+ *
+ * Preloaded compare values become active, and the update interrupt is raised
+ * if enabled.
+ */
+static void timer_update_event(uint32_t timer_peripheral)
+{
+	int index = timer_index(timer_peripheral);
+	int oc;
+
+	if (TIM_CR1(timer_peripheral) & TIM_CR1_UDIS)
+		return;
+	for (oc = 0; oc < 4; oc++)
+		timer_oc_active[index][oc] = TIM_CCR(timer_peripheral, oc);
+	TIM_SR(timer_peripheral) |= TIM_SR_UIF;
+	if (TIM_DIER(timer_peripheral) & TIM_DIER_UDE)
+		dma_request(timer_dma_channels[index][0]);
+	if (TIM_DIER(timer_peripheral) & TIM_DIER_UIE)
+		irq_raise(timer_irq(timer_peripheral));
+}
+
+/**
+ * @brief Emulate a timer compare event on an output compare channel.
+ *
+ * Sets the flag and, if enabled, raises the interrupt and the DMA request.
+ * ADC conversions are triggered if the event is selected as their external
+ * trigger.
+ */
+static void timer_compare_event(uint32_t timer_peripheral, int oc)
+{
+	int index = timer_index(timer_peripheral);
+	uint32_t dier = TIM_DIER(timer_peripheral);
+
+	TIM_SR(timer_peripheral) |= TIM_SR_CC1IF << oc;
+	if (dier & (TIM_DIER_CC1DE << oc))
+		dma_request(timer_dma_channels[index][oc + 1]);
+	if (timer_adc_triggers[index][oc] >= 0)
+		adc_external_trigger_regular(
+		    (uint32_t)timer_adc_triggers[index][oc]);
+	if (!(dier & (TIM_DIER_CC1IE << oc)))
+		return;
+	if (timer_peripheral == TIM1)
+		irq_raise(NVIC_TIM1_CC_IRQ);
+	else
+		irq_raise(timer_irq(timer_peripheral));
+}
+
+/**
+ * @brief Generate timer events by software.
+ *
+ * As in the hardware, the update generation re-initializes the counter.
+ */
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event)
+{
+	if (event & TIM_EGR_UG) {
+		TIM_CNT(timer_peripheral) = 0;
+		timer_accumulated[timer_index(timer_peripheral)] = 0;
+		timer_update_event(timer_peripheral);
+	}
+}
+
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id,
+		       enum tim_oc_mode oc_mode)
+{
+	int shift;
+	volatile uint32_t *ccmr = oc_ccmr(timer_peripheral, oc_id, &shift);
+
+	*ccmr &= ~(0x7 << (shift + 4));
+	*ccmr |= oc_mode << (shift + 4);
+}
+
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+	int shift;
+	volatile uint32_t *ccmr = oc_ccmr(timer_peripheral, oc_id, &shift);
+
+	*ccmr |= 1 << (shift + 3);
+}
+
+void timer_disable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+	int shift;
+	volatile uint32_t *ccmr = oc_ccmr(timer_peripheral, oc_id, &shift);
+
+	*ccmr &= ~(1 << (shift + 3));
+}
+
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id,
+			uint32_t value)
+{
+	int shift;
+	volatile uint32_t *ccmr = oc_ccmr(timer_peripheral, oc_id, &shift);
+
+	TIM_CCR(timer_peripheral, oc_index(oc_id)) = value;
+	if (!(*ccmr & (1 << (shift + 3))))
+		timer_oc_active[timer_index(timer_peripheral)]
+			       [oc_index(oc_id)] = value;
+}
+
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+	TIM_CCER(timer_peripheral) |= 1 << (2 * oc_id);
+}
+
+void timer_disable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+	TIM_CCER(timer_peripheral) &= ~(1 << (2 * oc_id));
+}
+
+void timer_enable_break_main_output(uint32_t timer_peripheral)
+{
+	TIM_BDTR(timer_peripheral) |= TIM_BDTR_MOE;
+}
+
+void timer_slave_set_mode(uint32_t timer_peripheral, uint8_t mode)
+{
+	TIM_SMCR(timer_peripheral) &= ~0x7;
+	TIM_SMCR(timer_peripheral) |= mode;
+}
+
+void timer_ic_set_input(uint32_t timer_peripheral, enum tim_ic_id ic,
+			enum tim_ic_input in)
+{
+	(void)timer_peripheral;
+	(void)ic;
+	(void)in;
+}
+
+/**
+ * @brief Return the compare channels of a timer whose events have an effect.
+ *
+ * Those are the channels with the interrupt or the DMA request enabled, or
+ * selected as the external trigger of an enabled ADC.
+ */
+static uint32_t timer_compare_mask(uint32_t timer_peripheral)
+{
+	int index = timer_index(timer_peripheral);
+	uint32_t dier = TIM_DIER(timer_peripheral);
+	uint32_t mask = 0;
+	uint32_t adc;
+	int oc;
+
+	for (oc = 0; oc < 4; oc++) {
+		if (dier & ((TIM_DIER_CC1IE | TIM_DIER_CC1DE) << oc))
+			mask |= 1 << oc;
+		if (timer_adc_triggers[index][oc] < 0)
+			continue;
+		for (adc = ADC1; adc <= ADC2; adc += ADC2 - ADC1) {
+			if (!(ADC_CR2(adc) & ADC_CR2_EXTTRIG))
+				continue;
+			if ((ADC_CR2(adc) & ADC_CR2_EXTSEL_MASK) ==
+			    (uint32_t)timer_adc_triggers[index][oc])
+				mask |= 1 << oc;
+		}
+	}
+	return mask;
+}
+
+/**
+ * @brief Advance an internally clocked timer a number of SYSCLK cycles.
+ *
+ * The counter is only stepped from event to event when compare events have an
+ * effect. Otherwise only update events are generated.
+ *
+ * Timers in encoder mode are clocked by the encoder signals instead and are
+ * left untouched.
+ */
+static void timer_advance(uint32_t timer_peripheral, uint32_t cycles)
+{
+	int index = timer_index(timer_peripheral);
+	uint32_t prescaler = TIM_PSC(timer_peripheral) + 1;
+	uint32_t period = TIM_ARR(timer_peripheral) + 1;
+	uint32_t mask;
+	uint32_t counter;
+	uint32_t compare;
+	uint64_t counts;
+	uint64_t step;
+	int oc;
+
+	if (!(TIM_CR1(timer_peripheral) & TIM_CR1_CEN))
+		return;
+	if ((TIM_SMCR(timer_peripheral) & 0x7) == 0x3)
+		return;
+	timer_accumulated[index] += cycles;
+	counts = timer_accumulated[index] / prescaler;
+	timer_accumulated[index] %= prescaler;
+
+	mask = timer_compare_mask(timer_peripheral);
+	if (!mask) {
+		counts += TIM_CNT(timer_peripheral);
+		while (counts >= period) {
+			counts -= period;
+			timer_update_event(timer_peripheral);
+		}
+		TIM_CNT(timer_peripheral) = (uint32_t)counts;
+		return;
+	}
+
+	while (counts > 0) {
+		counter = TIM_CNT(timer_peripheral);
+		step = period - counter;
+		for (oc = 0; oc < 4; oc++) {
+			compare = timer_oc_active[index][oc];
+			if ((mask & (1 << oc)) && compare > counter &&
+			    compare - counter < step)
+				step = compare - counter;
+		}
+		if (step > counts) {
+			TIM_CNT(timer_peripheral) = counter + (uint32_t)counts;
+			return;
+		}
+		counts -= step;
+		counter = (counter + (uint32_t)step) % period;
+		TIM_CNT(timer_peripheral) = counter;
+		if (counter == 0)
+			timer_update_event(timer_peripheral);
+		for (oc = 0; oc < 4; oc++)
+			if ((mask & (1 << oc)) &&
+			    timer_oc_active[index][oc] == counter)
+				timer_compare_event(timer_peripheral, oc);
+	}
+}
+
+/**
+ * @brief Sample an analog channel.
+ */
+static uint16_t adc_sample(uint32_t adc, uint8_t channel)
+{
+	if (adc_sampler)
+		return adc_sampler(adc, channel);
+	return adc_channel_values[channel];
+}
+
+void adc_power_on(uint32_t adc)
+{
+	ADC_CR2(adc) |= ADC_CR2_ADON;
+}
+
+static int adc_index(uint32_t adc)
+{
+	return adc == ADC1 ? 0 : 1;
+}
+
+/**
+ * @brief Power off the ADC.
+ *
+ * Any regular sequence in progress is aborted.
+ */
+void adc_power_off(uint32_t adc)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_ADON;
+	adc_regular_position[adc_index(adc)] = 0;
+}
+
+void adc_reset_calibration(uint32_t adc)
+{
+	(void)adc;
+}
+
+void adc_calibrate(uint32_t adc)
+{
+	(void)adc;
+}
+
+void adc_enable_scan_mode(uint32_t adc)
+{
+	ADC_CR1(adc) |= ADC_CR1_SCAN;
+}
+
+void adc_disable_scan_mode(uint32_t adc)
+{
+	ADC_CR1(adc) &= ~ADC_CR1_SCAN;
+}
+
+void adc_set_single_conversion_mode(uint32_t adc)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_CONT;
+}
+
+void adc_set_continuous_conversion_mode(uint32_t adc)
+{
+	ADC_CR2(adc) |= ADC_CR2_CONT;
+}
+
+void adc_set_right_aligned(uint32_t adc)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_ALIGN;
+}
+
+void adc_enable_discontinuous_mode_regular(uint32_t adc, uint8_t length)
+{
+	ADC_CR1(adc) &= ~ADC_CR1_DISCNUM_MASK;
+	ADC_CR1(adc) |= ADC_CR1_DISCEN |
+			((uint32_t)(length - 1) << ADC_CR1_DISCNUM_SHIFT);
+}
+
+void adc_disable_discontinuous_mode_regular(uint32_t adc)
+{
+	ADC_CR1(adc) &= ~ADC_CR1_DISCEN;
+}
+
+void adc_enable_dma(uint32_t adc)
+{
+	ADC_CR2(adc) |= ADC_CR2_DMA;
+}
+
+void adc_disable_dma(uint32_t adc)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_DMA;
+}
+
+void adc_set_sample_time_on_all_channels(uint32_t adc, uint8_t time)
+{
+	(void)adc;
+	(void)time;
+}
+
+void adc_enable_external_trigger_injected(uint32_t adc, uint32_t trigger)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_JEXTSEL_MASK;
+	ADC_CR2(adc) |= trigger | ADC_CR2_JEXTTRIG;
+}
+
+void adc_disable_external_trigger_injected(uint32_t adc)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_JEXTTRIG;
+}
+
+void adc_enable_external_trigger_regular(uint32_t adc, uint32_t trigger)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_EXTSEL_MASK;
+	ADC_CR2(adc) |= trigger | ADC_CR2_EXTTRIG;
+}
+
+void adc_disable_external_trigger_regular(uint32_t adc)
+{
+	ADC_CR2(adc) &= ~ADC_CR2_EXTTRIG;
+}
+
+/**
+ * @brief Set the injected sequence.
+ *
+ * As in the hardware, a sequence shorter than 4 conversions is placed at the
+ * end of the JSQR register.
+ */
+void adc_set_injected_sequence(uint32_t adc, uint8_t length, uint8_t channel[])
+{
+	uint32_t jsqr = (uint32_t)(length - 1) << 20;
+	int i;
+
+	for (i = 0; i < length; i++)
+		jsqr |= (uint32_t)channel[i] << (5 * (4 - length + i));
+	ADC_JSQR(adc) = jsqr;
+}
+
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[])
+{
+	uint32_t sqr[3] = {0};
+	int i;
+
+	for (i = 0; i < length; i++)
+		sqr[i / 6] |= (uint32_t)channel[i] << (5 * (i % 6));
+	ADC_SQR3(adc) = sqr[0];
+	ADC_SQR2(adc) = sqr[1];
+	ADC_SQR1(adc) = sqr[2] | ((uint32_t)(length - 1) << 20);
+	adc_regular_position[adc_index(adc)] = 0;
+}
+
+/**
+ * @brief Convert the whole injected sequence immediately.
+ */
+void adc_start_conversion_injected(uint32_t adc)
+{
+	uint32_t jsqr = ADC_JSQR(adc);
+	int length = ((jsqr >> 20) & 0x3) + 1;
+	uint8_t channel;
+	int i;
+
+	for (i = 0; i < length; i++) {
+		channel = (jsqr >> (5 * (4 - length + i))) & 0x1f;
+		ADC_JDR(adc, i) = adc_sample(adc, channel);
+	}
+	ADC_SR(adc) |= ADC_SR_JSTRT | ADC_SR_JEOC;
+	if (ADC_CR1(adc) & ADC_CR1_JEOCIE)
+		irq_raise(NVIC_ADC1_2_IRQ);
+}
+
+/**
+ * @brief Convert a channel of the regular group.
+ *
+ * Only ADC1 can request a DMA transfer of the result.
+ */
+static void adc_convert_regular(uint32_t adc, uint8_t channel)
+{
+	ADC_DR(adc) = adc_sample(adc, channel);
+	ADC_SR(adc) |= ADC_SR_STRT | ADC_SR_EOC;
+	if (adc == ADC1 && (ADC_CR2(adc) & ADC_CR2_DMA))
+		dma_request(1);
+	if (ADC_CR1(adc) & ADC_CR1_EOCIE)
+		irq_raise(NVIC_ADC1_2_IRQ);
+}
+
+/**
+ * @brief Return a channel of the regular sequence.
+ */
+static uint8_t adc_regular_channel(uint32_t adc, int rank)
+{
+	uint32_t sqr;
+
+	if (rank < 6)
+		sqr = ADC_SQR3(adc);
+	else if (rank < 12)
+		sqr = ADC_SQR2(adc);
+	else
+		sqr = ADC_SQR1(adc);
+	return (sqr >> (5 * (rank % 6))) & 0x1f;
+}
+
+/**
+ * @brief Convert the regular sequence after a trigger.
+ *
+ * In discontinuous mode, each trigger converts the next `DISCNUM` channels of
+ * the sequence, which restarts once completed. Otherwise, the whole sequence
+ * is converted in scan mode or only the first channel if scan mode is
+ * disabled.
+ */
+static void adc_trigger_regular(uint32_t adc)
+{
+	int index = adc_index(adc);
+	int length = ((ADC_SQR1(adc) >> 20) & 0xf) + 1;
+	int count;
+
+	if (!(ADC_CR2(adc) & ADC_CR2_ADON))
+		return;
+	if (ADC_CR1(adc) & ADC_CR1_DISCEN)
+		count = ((ADC_CR1(adc) & ADC_CR1_DISCNUM_MASK) >>
+			 ADC_CR1_DISCNUM_SHIFT) +
+			1;
+	else if (ADC_CR1(adc) & ADC_CR1_SCAN)
+		count = length;
+	else
+		count = 1;
+	if (!(ADC_CR1(adc) & ADC_CR1_DISCEN))
+		adc_regular_position[index] = 0;
+	while (count-- > 0) {
+		adc_convert_regular(
+		    adc, adc_regular_channel(adc, adc_regular_position[index]));
+		adc_regular_position[index]++;
+		if (adc_regular_position[index] >= length) {
+			adc_regular_position[index] = 0;
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Handle an external event for the regular group of the ADCs.
+ *
+ * @param[in] extsel External event, as an `ADC_CR2_EXTSEL_*` value.
+ */
+static void adc_external_trigger_regular(uint32_t extsel)
+{
+	uint32_t adc;
+
+	for (adc = ADC1; adc <= ADC2; adc += ADC2 - ADC1) {
+		if (!(ADC_CR2(adc) & ADC_CR2_EXTTRIG))
+			continue;
+		if ((ADC_CR2(adc) & ADC_CR2_EXTSEL_MASK) == extsel)
+			adc_trigger_regular(adc);
+	}
+}
+
+/**
+ * @brief Convert the first channel of the regular sequence immediately.
+ */
+void adc_start_conversion_direct(uint32_t adc)
+{
+	adc_convert_regular(adc, ADC_SQR3(adc) & 0x1f);
+}
+
+bool adc_eoc(uint32_t adc)
+{
+	return (ADC_SR(adc) & ADC_SR_EOC) != 0;
+}
+
+bool adc_eoc_injected(uint32_t adc)
+{
+	return (ADC_SR(adc) & ADC_SR_JEOC) != 0;
+}
+
+uint32_t adc_read_injected(uint32_t adc, uint8_t reg)
+{
+	return ADC_JDR(adc, reg - 1);
+}
+
+uint32_t adc_read_regular(uint32_t adc)
+{
+	ADC_SR(adc) &= ~ADC_SR_EOC;
+	return ADC_DR(adc);
+}
+
+/**
+ * @brief Pop a byte from the MPU FIFO (`0` if it is empty).
+ */
+static uint8_t mpu_fifo_pop(void)
+{
+	uint8_t byte;
+
+	if (!mpu_fifo_count)
+		return 0x00;
+	byte = mpu_fifo[mpu_fifo_head];
+	mpu_fifo_head = (mpu_fifo_head + 1) % HOST_MPU_FIFO_SIZE;
+	mpu_fifo_count--;
+	return byte;
+}
+
+/**
+ * @brief Push a byte to the MPU FIFO, overwriting the oldest one if full.
+ */
+static void mpu_fifo_push(uint8_t byte)
+{
+	if (mpu_fifo_count == HOST_MPU_FIFO_SIZE)
+		mpu_fifo_pop();
+	mpu_fifo[(mpu_fifo_head + mpu_fifo_count) % HOST_MPU_FIFO_SIZE] = byte;
+	mpu_fifo_count++;
+}
+
+/**
+ * @brief MPU gyroscope output data rate, in samples per second.
+ *
+ * It is 8 kHz with the digital low pass filter disabled (`DLPF_CFG` 0 or 7)
+ * and 1 kHz divided by `1 + SMPLRT_DIV` otherwise.
+ */
+static uint32_t mpu_sample_rate(void)
+{
+	uint8_t dlpf = mpu_registers[HOST_MPU_CONFIG] & 0x7;
+
+	if (dlpf == 0 || dlpf == 7)
+		return 8000;
+	return 1000 / (1 + mpu_registers[HOST_MPU_SMPLRT_DIV]);
+}
+
+/**
+ * @brief Push the gyroscope Z-axis samples of a tick to the MPU FIFO.
+ *
+ * Samples are pushed at the output data rate, while the FIFO is enabled and
+ * configured to store the gyroscope Z-axis.
+ */
+static void mpu_service(void)
+{
+	if (!(mpu_registers[HOST_MPU_USER_CTRL] & HOST_MPU_USER_CTRL_FIFO_EN) ||
+	    !(mpu_registers[HOST_MPU_FIFO_EN] & HOST_MPU_FIFO_EN_ZG)) {
+		mpu_sample_accumulated = 0;
+		return;
+	}
+	mpu_sample_accumulated += (uint64_t)cycles_per_tick * mpu_sample_rate();
+	while (mpu_sample_accumulated >= rcc_ahb_frequency) {
+		mpu_sample_accumulated -= rcc_ahb_frequency;
+		mpu_fifo_push(mpu_registers[HOST_MPU_GYRO_ZOUT_H]);
+		mpu_fifo_push(mpu_registers[HOST_MPU_GYRO_ZOUT_L]);
+	}
+}
+
+/**
+ * @brief Process a byte sent to the MPU and return the byte it clocks out.
+ */
+static uint8_t mpu_transfer(uint8_t data)
+{
+	uint8_t response = 0x00;
+
+	if (mpu_address < 0) {
+		mpu_reading = (data & 0x80) != 0;
+		mpu_address = data & 0x7f;
+		return response;
+	}
+	if (mpu_reading && mpu_address == HOST_MPU_FIFO_R_W) {
+		return mpu_fifo_pop();
+	} else if (mpu_reading && mpu_address == HOST_MPU_FIFO_COUNTH) {
+		response = (uint8_t)(mpu_fifo_count >> 8);
+	} else if (mpu_reading && mpu_address == HOST_MPU_FIFO_COUNTL) {
+		response = (uint8_t)mpu_fifo_count;
+	} else if (mpu_reading) {
+		response = mpu_registers[mpu_address];
+	} else if (mpu_address == HOST_MPU_PWR_MGMT_1 &&
+		   (data & HOST_MPU_DEVICE_RESET)) {
+		memset(mpu_registers, 0, sizeof(mpu_registers));
+		mpu_registers[HOST_MPU_WHO_AM_I] = HOST_MPU_WHO_AM_I_VALUE;
+		mpu_registers[HOST_MPU_PWR_MGMT_1] = 0x01;
+		mpu_fifo_count = 0;
+	} else if (mpu_address == HOST_MPU_USER_CTRL) {
+		if (data & HOST_MPU_USER_CTRL_FIFO_RST)
+			mpu_fifo_count = 0;
+		mpu_registers[mpu_address] =
+		    data & ~HOST_MPU_USER_CTRL_FIFO_RST;
+	} else if (mpu_address != HOST_MPU_WHO_AM_I) {
+		mpu_registers[mpu_address] = data;
+	}
+	mpu_address = (mpu_address + 1) & 0x7f;
+	return response;
+}
+
+void spi_reset(uint32_t spi_peripheral)
+{
+	memset((void *)peripheral_register(spi_peripheral), 0, 0x10);
+}
+
+int spi_init_master(uint32_t spi, uint32_t br, uint32_t cpol, uint32_t cpha,
+		    uint32_t dff, uint32_t lsbfirst)
+{
+	SPI_CR1(spi) = br | cpol | cpha | dff | lsbfirst;
+	SPI_SR(spi) = SPI_SR_TXE;
+	return 0;
+}
+
+/**
+ * @brief Receive a byte in master receive-only mode.
+ *
+ * The byte is stored in the data register or, if the previous one has not
+ * been read yet, lost with an overrun.
+ */
+static void spi_receive_only_byte(uint32_t spi)
+{
+	uint8_t byte = mpu_transfer(0x00);
+
+	if (SPI_SR(spi) & SPI_SR_RXNE) {
+		SPI_SR(spi) |= SPI_SR_OVR;
+		return;
+	}
+	SPI_DR(spi) = byte;
+	SPI_SR(spi) |= SPI_SR_RXNE;
+}
+
+/**
+ * @brief Whether the SPI is generating the clock in receive-only mode.
+ */
+static bool spi_receiving_only(uint32_t spi)
+{
+	return (SPI_CR1(spi) & (SPI_CR1_SPE | SPI_CR1_RXONLY)) ==
+	       (SPI_CR1_SPE | SPI_CR1_RXONLY);
+}
+
+/**
+ * @brief Receive data with DMA in master receive-only mode.
+ *
+ * In the hardware, the clock is generated continuously while the SPI is
+ * enabled in receive-only mode. Here, bytes are received and served to DMA
+ * until the SPI is disabled or there are no more DMA requests to serve. As
+ * the clock keeps running while the DMA request is served, disabling the SPI
+ * always completes the reception of one more byte (see `spi_disable()`).
+ */
+static void spi_receive_only_service(uint32_t spi)
+{
+	uint8_t channel;
+
+	while (spi_receiving_only(spi) && SPI_CR2(spi) & SPI_CR2_RXDMAEN) {
+		channel = dma_find_channel(&SPI_DR(spi), false);
+		if (!channel || !DMA_CNDTR(DMA1, channel))
+			return;
+		spi_receive_only_byte(spi);
+		SPI_SR(spi) &= ~SPI_SR_RXNE;
+		dma_request(channel);
+	}
+}
+
+void spi_enable(uint32_t spi)
+{
+	SPI_CR1(spi) |= SPI_CR1_SPE;
+	spi_receive_only_service(spi);
+}
+
+/**
+ * @brief Disable the SPI.
+ *
+ * In receive-only mode, the byte being received is completed first.
+ */
+void spi_disable(uint32_t spi)
+{
+	if (spi_receiving_only(spi))
+		spi_receive_only_byte(spi);
+	SPI_CR1(spi) &= ~SPI_CR1_SPE;
+}
+
+void spi_enable_software_slave_management(uint32_t spi)
+{
+	SPI_CR1(spi) |= SPI_CR1_SSM;
+}
+
+void spi_set_nss_high(uint32_t spi)
+{
+	SPI_CR1(spi) |= SPI_CR1_SSI;
+}
+
+void spi_send(uint32_t spi, uint16_t data)
+{
+	uint8_t response = 0xff;
+
+	if (!(GPIO_ODR(HOST_MPU_CS_PORT) & HOST_MPU_CS_PIN))
+		response = mpu_transfer((uint8_t)data);
+	SPI_DR(spi) = response;
+	SPI_SR(spi) |= SPI_SR_RXNE | SPI_SR_TXE;
+}
+
+uint16_t spi_read(uint32_t spi)
+{
+	SPI_SR(spi) &= ~SPI_SR_RXNE;
+	return (uint16_t)SPI_DR(spi);
+}
+
+uint16_t spi_xfer(uint32_t spi, uint16_t data)
+{
+	spi_send(spi, data);
+	return spi_read(spi);
+}
+
+void spi_set_receive_only_mode(uint32_t spi)
+{
+	SPI_CR1(spi) |= SPI_CR1_RXONLY;
+}
+
+void spi_set_full_duplex_mode(uint32_t spi)
+{
+	SPI_CR1(spi) &= ~SPI_CR1_RXONLY;
+}
+
+void spi_enable_rx_dma(uint32_t spi)
+{
+	SPI_CR2(spi) |= SPI_CR2_RXDMAEN;
+}
+
+void spi_disable_rx_dma(uint32_t spi)
+{
+	SPI_CR2(spi) &= ~SPI_CR2_RXDMAEN;
+}
+
+static uint8_t dma_irq(uint8_t channel)
+{
+	return NVIC_DMA1_CHANNEL1_IRQ + channel - 1;
+}
+
+/**
+ * @brief Set DMA channel interrupt flags and raise the interrupt if enabled.
+ */
+static void dma_flag(uint8_t channel, uint32_t flags)
+{
+	uint32_t ccr = DMA_CCR(DMA1, channel);
+
+	DMA_ISR(DMA1) |= (flags | DMA_GIF) << DMA_FLAG_OFFSET(channel);
+	if (((flags & DMA_TCIF) && (ccr & DMA_CCR_TCIE)) ||
+	    ((flags & DMA_HTIF) && (ccr & DMA_CCR_HTIE)))
+		irq_raise(dma_irq(channel));
+}
+
+/**
+ * @brief Account for one DMA item transferred.
+ *
+ * Updates the counter (reloading it in circular mode) and sets the half and
+ * complete transfer flags.
+ */
+static void dma_count(uint8_t channel)
+{
+	uint32_t remaining = DMA_CNDTR(DMA1, channel) - 1;
+
+	DMA_CNDTR(DMA1, channel) = remaining;
+	if (remaining == dma_reload[channel] / 2)
+		dma_flag(channel, DMA_HTIF);
+	if (remaining == 0) {
+		if (DMA_CCR(DMA1, channel) & DMA_CCR_CIRC)
+			DMA_CNDTR(DMA1, channel) = dma_reload[channel];
+		dma_flag(channel, DMA_TCIF);
+	}
+}
+
+/**
+ * @brief Return the memory pointer for the next DMA item.
+ */
+static uint8_t *dma_memory(uint8_t channel)
+{
+	uint32_t index = 0;
+	uint32_t size = 1 << ((DMA_CCR(DMA1, channel) & DMA_CCR_MSIZE_MASK) >> 10);
+
+	if (DMA_CCR(DMA1, channel) & DMA_CCR_MINC)
+		index = dma_reload[channel] - DMA_CNDTR(DMA1, channel);
+	return (uint8_t *)(uintptr_t)DMA_CMAR(DMA1, channel) + index * size;
+}
+
+/**
+ * @brief Find the enabled DMA channel serving a peripheral register.
+ *
+ * @param[in] reg Peripheral register.
+ * @param[in] from_memory Whether the transfer direction is memory to
+ * peripheral.
+ * @return The channel number or `0` if there is none.
+ */
+static uint8_t dma_find_channel(volatile uint32_t *reg, bool from_memory)
+{
+	uint8_t channel;
+	uint32_t ccr;
+
+	for (channel = 1; channel <= NUM_DMA_CHANNELS; channel++) {
+		ccr = DMA_CCR(DMA1, channel);
+		if (!(ccr & DMA_CCR_EN))
+			continue;
+		if (((ccr & DMA_CCR_DIR) != 0) != from_memory)
+			continue;
+		if (DMA_CPAR(DMA1, channel) == (uint32_t)(uintptr_t)reg)
+			return channel;
+	}
+	return 0;
+}
+
+/**
+ * @brief Write a peripheral register on behalf of the DMA controller.
+ *
+ * GPIO bit set/reset registers are applied to the output data register.
+ */
+static void dma_peripheral_write(volatile uint32_t *reg, uint32_t value)
+{
+	const uint32_t ports[] = {GPIOA, GPIOB, GPIOC};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+		if (reg != &GPIO_BSRR(ports[i]))
+			continue;
+		gpio_clear(ports[i], (uint16_t)(value >> 16));
+		gpio_set(ports[i], (uint16_t)value);
+		return;
+	}
+	*reg = value;
+}
+
+/**
+ * @brief Read a peripheral register on behalf of the DMA controller.
+ *
+ * Reading the ADC data register clears the end of conversion flag.
+ */
+static uint32_t dma_peripheral_read(volatile uint32_t *reg)
+{
+	if (reg == &ADC_DR(ADC1))
+		ADC_SR(ADC1) &= ~ADC_SR_EOC;
+	return *reg;
+}
+
+/**
+ * @brief Transfer one item after a peripheral DMA request.
+ *
+ * Requests on disabled channels are ignored, as the hardware does.
+ */
+static void dma_request(uint8_t channel)
+{
+	uint32_t ccr = DMA_CCR(DMA1, channel);
+	uint32_t size = 1 << ((ccr & DMA_CCR_MSIZE_MASK) >> 10);
+	volatile uint32_t *reg;
+	uint32_t value = 0;
+
+	if (!channel || !(ccr & DMA_CCR_EN) || !DMA_CNDTR(DMA1, channel))
+		return;
+	reg = (volatile uint32_t *)(uintptr_t)DMA_CPAR(DMA1, channel);
+	if (ccr & DMA_CCR_DIR) {
+		memcpy(&value, dma_memory(channel), size);
+		dma_peripheral_write(reg, value);
+	} else {
+		value = dma_peripheral_read(reg);
+		memcpy(dma_memory(channel), &value, size);
+	}
+	dma_count(channel);
+}
+
+/**
+ * @brief Number of SYSCLK cycles it takes to transmit a USART3 byte.
+ *
+ * Each byte is framed with a start and a stop bit.
+ */
+static uint32_t usart_byte_cycles(void)
+{
+	return 10 * USART_BRR(USART3) *
+	       (rcc_ahb_frequency / rcc_apb1_frequency);
+}
+
+/**
+ * @brief Service pending DMA requests from peripherals.
+ *
+ * USART transmissions are written to the serial output file descriptor at
+ * the configured baud rate: each tick grants one SysTick period of
+ * transmission time, which is not accumulated beyond that while the USART is
+ * idle.
+ */
+static void dma_service(void)
+{
+	uint8_t channel;
+	uint8_t byte;
+	uint32_t byte_cycles = usart_byte_cycles();
+
+	if (!(USART_CR3(USART3) & USART_CR3_DMAT))
+		return;
+	channel = dma_find_channel(&USART_DR(USART3), true);
+	if (!channel)
+		return;
+	while (DMA_CNDTR(DMA1, channel) > 0 &&
+	       (DMA_CCR(DMA1, channel) & DMA_CCR_EN) &&
+	       usart_transmit_credit >= byte_cycles) {
+		byte = *dma_memory(channel);
+		if (serial_output_fd >= 0 &&
+		    write(serial_output_fd, &byte, 1) < 0)
+			serial_output_fd = -1;
+		usart_transmit_credit -= byte_cycles;
+		dma_count(channel);
+		if (DMA_CCR(DMA1, channel) & DMA_CCR_CIRC)
+			break;
+	}
+}
+
+void dma_channel_reset(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(dma, channel) = 0;
+	DMA_CNDTR(dma, channel) = 0;
+	DMA_CPAR(dma, channel) = 0;
+	DMA_CMAR(dma, channel) = 0;
+	DMA_ISR(dma) &= ~(0xf << DMA_FLAG_OFFSET(channel));
+	dma_reload[channel] = 0;
+}
+
+void dma_clear_interrupt_flags(uint32_t dma, uint8_t channel,
+			       uint32_t interrupts)
+{
+	DMA_ISR(dma) &= ~(interrupts << DMA_FLAG_OFFSET(channel));
+}
+
+bool dma_get_interrupt_flag(uint32_t dma, uint8_t channel, uint32_t interrupts)
+{
+	return ((DMA_ISR(dma) >> DMA_FLAG_OFFSET(channel)) & interrupts) !=
+	       0;
+}
+
+void dma_set_priority(uint32_t dma, uint8_t channel, uint32_t prio)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_PL_MASK;
+	DMA_CCR(DMA1, channel) |= prio;
+	(void)dma;
+}
+
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t mem_size)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_MSIZE_MASK;
+	DMA_CCR(DMA1, channel) |= mem_size;
+	(void)dma;
+}
+
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel,
+			     uint32_t peripheral_size)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_PSIZE_MASK;
+	DMA_CCR(DMA1, channel) |= peripheral_size;
+	(void)dma;
+}
+
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_MINC;
+	(void)dma;
+}
+
+void dma_disable_memory_increment_mode(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_MINC;
+	(void)dma;
+}
+
+void dma_enable_peripheral_increment_mode(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_PINC;
+	(void)dma;
+}
+
+void dma_disable_peripheral_increment_mode(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_PINC;
+	(void)dma;
+}
+
+void dma_enable_circular_mode(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_CIRC;
+	(void)dma;
+}
+
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_DIR;
+	(void)dma;
+}
+
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_DIR;
+	(void)dma;
+}
+
+void dma_enable_transfer_error_interrupt(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_TEIE;
+	(void)dma;
+}
+
+void dma_disable_transfer_error_interrupt(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_TEIE;
+	(void)dma;
+}
+
+void dma_enable_half_transfer_interrupt(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_HTIE;
+	(void)dma;
+}
+
+void dma_disable_half_transfer_interrupt(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_HTIE;
+	(void)dma;
+}
+
+void dma_enable_transfer_complete_interrupt(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_TCIE;
+	(void)dma;
+}
+
+void dma_disable_transfer_complete_interrupt(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_TCIE;
+	(void)dma;
+}
+
+void dma_enable_channel(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) |= DMA_CCR_EN;
+	(void)dma;
+}
+
+void dma_disable_channel(uint32_t dma, uint8_t channel)
+{
+	DMA_CCR(DMA1, channel) &= ~DMA_CCR_EN;
+	(void)dma;
+}
+
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel,
+				uint32_t address)
+{
+	DMA_CPAR(DMA1, channel) = address;
+	(void)dma;
+}
+
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uint32_t address)
+{
+	DMA_CMAR(DMA1, channel) = address;
+	(void)dma;
+}
+
+uint16_t dma_get_number_of_data(uint32_t dma, uint8_t channel)
+{
+	(void)dma;
+	return (uint16_t)DMA_CNDTR(DMA1, channel);
+}
+
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number)
+{
+	DMA_CNDTR(DMA1, channel) = number;
+	dma_reload[channel] = number;
+	(void)dma;
+}
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud)
+{
+	USART_BRR(usart) = rcc_apb1_frequency / baud;
+}
+
+void usart_set_databits(uint32_t usart, uint32_t bits)
+{
+	(void)usart;
+	(void)bits;
+}
+
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits)
+{
+	(void)usart;
+	(void)stopbits;
+}
+
+void usart_set_parity(uint32_t usart, uint32_t parity)
+{
+	(void)usart;
+	(void)parity;
+}
+
+void usart_set_mode(uint32_t usart, uint32_t mode)
+{
+	USART_CR1(usart) &= ~USART_MODE_TX_RX;
+	USART_CR1(usart) |= mode;
+}
+
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol)
+{
+	(void)usart;
+	(void)flowcontrol;
+}
+
+/**
+ * @brief Enable the USART.
+ *
+ * As in the hardware, an idle frame is detected when the receiver is enabled.
+ */
+void usart_enable(uint32_t usart)
+{
+	USART_CR1(usart) |= USART_CR1_UE;
+	USART_SR(usart) |= USART_SR_TXE | USART_SR_TC | USART_SR_IDLE;
+	if ((usart == USART3) && (USART_CR1(usart) & USART_CR1_IDLEIE))
+		irq_raise(NVIC_USART3_IRQ);
+}
+
+void usart_disable(uint32_t usart)
+{
+	USART_CR1(usart) &= ~USART_CR1_UE;
+}
+
+void usart_enable_rx_dma(uint32_t usart)
+{
+	USART_CR3(usart) |= USART_CR3_DMAR;
+}
+
+void usart_disable_rx_dma(uint32_t usart)
+{
+	USART_CR3(usart) &= ~USART_CR3_DMAR;
+}
+
+void usart_enable_tx_dma(uint32_t usart)
+{
+	USART_CR3(usart) |= USART_CR3_DMAT;
+	dma_service();
+}
+
+void usart_disable_tx_dma(uint32_t usart)
+{
+	USART_CR3(usart) &= ~USART_CR3_DMAT;
+}
+
+void flash_unlock(void)
+{
+	FLASH_CR &= ~FLASH_CR_LOCK;
+}
+
+void flash_lock(void)
+{
+	FLASH_CR |= FLASH_CR_LOCK;
+}
+
+/**
+ * @brief Check a flash operation can be performed on an address.
+ */
+static bool flash_check(uint32_t address)
+{
+	if (FLASH_CR & FLASH_CR_LOCK ||
+	    address < FLASH_BASE || address >= FLASH_BASE + FLASH_SIZE) {
+		FLASH_SR = FLASH_SR_WRPRTERR;
+		return false;
+	}
+	return true;
+}
+
+void flash_erase_page(uint32_t page_address)
+{
+	if (!flash_check(page_address))
+		return;
+	page_address &= ~(FLASH_PAGE_SIZE - 1);
+	memset((void *)(uintptr_t)page_address, 0xff, FLASH_PAGE_SIZE);
+	FLASH_SR = FLASH_SR_EOP;
+}
+
+/**
+ * @brief Program a half word.
+ *
+ * As in the hardware, programming a non-erased half word fails (unless the
+ * value to write is zero).
+ */
+void flash_program_half_word(uint32_t address, uint16_t data)
+{
+	uint16_t *target = (uint16_t *)(uintptr_t)address;
+
+	if (!flash_check(address))
+		return;
+	if (*target != 0xffff && data != 0x0000) {
+		FLASH_SR = FLASH_SR_PGERR;
+		return;
+	}
+	*target = data;
+	FLASH_SR = FLASH_SR_EOP;
+}
+
+/**
+ * @brief Access a half word from firmware code.
+ *
+ * Only flash programming is supported: with `FLASH_CR_PG` set, writing a half
+ * word starts programming it. The write is latched and the operation is
+ * completed later by `flash_service()`, like the hardware would (the flash
+ * controller is busy meanwhile).
+ */
+volatile uint16_t *host_register16(uint32_t address)
+{
+	if (!(FLASH_CR & FLASH_CR_PG) || flash_latched ||
+	    address < FLASH_BASE || address >= FLASH_BASE + FLASH_SIZE) {
+		fprintf(stderr, "Invalid half word access to 0x%08x\n",
+			address);
+		abort();
+	}
+	flash_latch_address = address;
+	flash_latched = true;
+	FLASH_SR |= FLASH_SR_BSY;
+	return &flash_latch;
+}
+
+/**
+ * @brief Complete flash operations started by firmware code.
+ *
+ * Page erases (started with `FLASH_CR_STRT`) and half word programming (see
+ * `host_register16()`) take the typical times from the datasheet. When an
+ * operation completes, the end of operation flag is set and, if enabled, the
+ * flash interruption is raised (which may start the next operation).
+ */
+static void flash_service(void)
+{
+	uint64_t cycles;
+	bool erase;
+
+	flash_credit += cycles_per_tick;
+	while (true) {
+		erase = (FLASH_CR & (FLASH_CR_PER | FLASH_CR_STRT)) ==
+			(FLASH_CR_PER | FLASH_CR_STRT);
+		if (!erase && !flash_latched) {
+			flash_credit = 0;
+			return;
+		}
+		cycles = (uint64_t)rcc_ahb_frequency *
+			 (erase ? FLASH_ERASE_US : FLASH_PROGRAM_US) / 1000000;
+		if (flash_credit < cycles) {
+			FLASH_SR |= FLASH_SR_BSY;
+			return;
+		}
+		flash_credit -= cycles;
+		if (erase) {
+			FLASH_CR &= ~FLASH_CR_STRT;
+			flash_erase_page(FLASH_AR);
+		} else {
+			flash_latched = false;
+			flash_program_half_word(flash_latch_address,
+						flash_latch);
+		}
+		if (FLASH_SR == FLASH_SR_EOP && FLASH_CR & FLASH_CR_EOPIE)
+			irq_raise(NVIC_FLASH_IRQ);
+		else if (FLASH_SR != FLASH_SR_EOP && FLASH_CR & FLASH_CR_ERRIE)
+			irq_raise(NVIC_FLASH_IRQ);
+	}
+}
+
+void flash_program_word(uint32_t address, uint32_t data)
+{
+	flash_program_half_word(address, (uint16_t)data);
+	if (FLASH_SR != FLASH_SR_EOP)
+		return;
+	flash_program_half_word(address + 2, (uint16_t)(data >> 16));
+}
+
+uint32_t flash_get_status_flags(void)
+{
+	return FLASH_SR &
+	       (FLASH_SR_PGERR | FLASH_SR_EOP | FLASH_SR_WRPRTERR |
+		FLASH_SR_BSY);
+}
+
+void flash_clear_status_flags(void)
+{
+	FLASH_SR = 0;
+}
+
+/**
+ * @brief Advance the emulated time by one SysTick period.
+ *
+ * - Execute the tick hook, which may update the peripheral inputs.
+ * - Advance the internally clocked timers (raising their interruptions).
+ * - Service pending DMA requests (granting USART transmission time).
+ * - Complete the started flash operations.
+ * - Push the MPU samples to its FIFO.
+ * - Raise the SysTick exception, measuring its execution time.
+ */
+void host_tick(void)
+{
+	uint64_t start;
+
+	cycles_base += cycles_per_tick;
+	tick_timestamp = host_now();
+	lockstep_cycles = 0;
+	ticks++;
+
+	if (tick_hook)
+		tick_hook();
+	timer_advance(TIM1, cycles_per_tick);
+	timer_advance(TIM2, cycles_per_tick);
+	timer_advance(TIM3, cycles_per_tick);
+	timer_advance(TIM4, cycles_per_tick);
+	usart_transmit_credit += cycles_per_tick;
+	if (usart_transmit_credit > cycles_per_tick + usart_byte_cycles())
+		usart_transmit_credit = cycles_per_tick + usart_byte_cycles();
+	dma_service();
+	flash_service();
+	mpu_service();
+
+	if (!systick_counter_enabled)
+		return;
+	start = host_now();
+	irq_raise(NVIC_SYSTICK_IRQ);
+	systick_cycles = (uint32_t)nanoseconds_to_cycles(host_now() - start);
+}
+
+/**
+ * @brief Number of ticks emulated so far.
+ */
+uint32_t host_get_ticks(void)
+{
+	return ticks;
+}
+
+/**
+ * @brief Set a function to be called at the beginning of each tick.
+ */
+void host_set_tick_hook(void (*hook)(void))
+{
+	tick_hook = hook;
+}
+
+/**
+ * @brief Arm the timer for the next tick.
+ *
+ * @param[in] busy_us Host time spent processing the last tick.
+ */
+static void realtime_arm(long busy_us)
+{
+	struct itimerval timer;
+	long period_us = realtime_period_us;
+
+	if (period_us < busy_us)
+		period_us = busy_us;
+	if (period_us < REALTIME_MIN_PERIOD_US)
+		period_us = REALTIME_MIN_PERIOD_US;
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = period_us / 1000000;
+	timer.it_value.tv_usec = period_us % 1000000;
+	setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+static void realtime_handler(int signum)
+{
+	uint64_t start = host_now();
+
+	(void)signum;
+	host_tick();
+	if (realtime_running)
+		realtime_arm((long)((host_now() - start) / 1000));
+}
+
+/**
+ * @brief Emulate ticks periodically, like the real SysTick timer would.
+ *
+ * Ticks are delivered with a `SIGALRM` signal, which interrupts the main
+ * thread the same way an interruption would.
+ *
+ * The timer is re-armed after each tick is processed, for at least as long as
+ * the tick took, so the main thread is never starved. With large time scales
+ * the effective speed is then limited by the host.
+ *
+ * @param[in] time_scale Emulated time speed relative to real time.
+ */
+void host_start_realtime(float time_scale)
+{
+	struct sigaction action;
+
+	realtime_scale = time_scale;
+	realtime_period_us = (long)(1000000. /
+				    (rcc_ahb_frequency / cycles_per_tick) /
+				    time_scale);
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = realtime_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGALRM, &action, NULL);
+
+	realtime_running = true;
+	realtime_arm(0);
+}
+
+/**
+ * @brief Stop the periodic ticks.
+ */
+void host_stop_realtime(void)
+{
+	struct itimerval timer;
+
+	realtime_running = false;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_REAL, &timer, NULL);
+	realtime_scale = 1.;
+}
+
+/**
+ * @brief Host CPU time consumed by the process, in nanoseconds.
+ */
+static uint64_t host_cpu_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+/**
+ * @brief Arm the timer to check whether a lockstep tick is due.
+ *
+ * CPU time timers have the resolution of the host scheduler ticks, so the
+ * CPU time is checked with a wall-clock timer instead. The CPU time never
+ * runs faster than the wall clock, so the check is armed for the CPU time
+ * left to the next tick.
+ */
+static void lockstep_arm(void)
+{
+	struct itimerval timer;
+	uint64_t consumed_us;
+	long wait_us = LOCKSTEP_MIN_POLL_US;
+
+	consumed_us = (host_cpu_now() - lockstep_cpu_timestamp) / 1000;
+	if (consumed_us + LOCKSTEP_MIN_POLL_US < LOCKSTEP_PERIOD_US)
+		wait_us = LOCKSTEP_PERIOD_US - (long)consumed_us;
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_usec = wait_us;
+	setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/**
+ * @brief Emulate a lockstep tick and restart the CPU time count.
+ */
+static void lockstep_tick(void)
+{
+	lockstep_ticking = true;
+	host_tick();
+	lockstep_cpu_timestamp = host_cpu_now();
+	lockstep_ticking = false;
+}
+
+static void lockstep_handler(int signum)
+{
+	(void)signum;
+	if (lockstep_ticking || !lockstep_running)
+		return;
+	if (lockstep_polls != lockstep_checked_polls ||
+	    !(irq_enabled & (1ULL << NVIC_SYSTICK_IRQ))) {
+		lockstep_checked_polls = lockstep_polls;
+		lockstep_cpu_timestamp = host_cpu_now();
+	} else if (host_cpu_now() - lockstep_cpu_timestamp >=
+		   LOCKSTEP_PERIOD_US * 1000ULL) {
+		lockstep_tick();
+	}
+	lockstep_arm();
+}
+
+/**
+ * @brief Emulate ticks when the thread mode waits, independently of the wall
+ * time.
+ *
+ * Ticks are emulated when the thread mode busy-polls the cycle counter (see
+ * `dwt_read_cycle_counter()`), or after it runs for `LOCKSTEP_PERIOD_US` of
+ * host CPU time without polling it, which is how waits for variables updated
+ * by the SysTick handler are detected (only once its interruption is
+ * enabled).
+ *
+ * Only busy-polls of the cycle counter are deterministic. The CPU time
+ * fallback depends on the host speed and load, so waits for variables (and
+ * any thread mode code that runs for longer than `LOCKSTEP_PERIOD_US`
+ * between polls) may see a different number of ticks from run to run.
+ *
+ * The effective speed is limited by the host.
+ */
+void host_start_lockstep(void)
+{
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = lockstep_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGALRM, &action, NULL);
+
+	lockstep_cycles = 0;
+	lockstep_cpu_timestamp = host_cpu_now();
+	lockstep_running = true;
+	lockstep_arm();
+}
+
+/**
+ * @brief Stop the lockstep ticks.
+ */
+void host_stop_lockstep(void)
+{
+	struct itimerval timer;
+
+	lockstep_running = false;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/**
+ * @brief Host time spent in the last SysTick handler, in SYSCLK cycles.
+ */
+uint32_t host_get_systick_cycles(void)
+{
+	return systick_cycles;
+}
+
+/**
+ * @brief Set a function to sample analog inputs.
+ *
+ * When no sampler is set, values set with `host_set_adc_channel()` are used.
+ */
+void host_set_adc_sampler(uint16_t (*sampler)(uint32_t adc, uint8_t channel))
+{
+	adc_sampler = sampler;
+}
+
+void host_set_adc_channel(uint8_t channel, uint16_t value)
+{
+	adc_channel_values[channel] = value;
+}
+
+void host_set_gpio_input(uint32_t gpioport, uint16_t gpios, bool value)
+{
+	if (value)
+		GPIO_IDR(gpioport) |= gpios;
+	else
+		GPIO_IDR(gpioport) &= ~gpios;
+}
+
+uint16_t host_get_gpio_output(uint32_t gpioport)
+{
+	return (uint16_t)GPIO_ODR(gpioport);
+}
+
+/** Encoder positions (in counts) and emulated time of their last update */
+static double encoder_position[NUM_TIMERS];
+static uint64_t encoder_update[NUM_TIMERS];
+
+/**
+ * Encoder signals connected to each timer in encoder mode.
+ */
+static const struct encoder_pins {
+	uint32_t timer;
+	uint32_t ti1_port;
+	uint16_t ti1_pin;
+	uint32_t ti2_port;
+	uint16_t ti2_pin;
+} encoder_pins[] = {
+    {TIM2, GPIOA, GPIO15, GPIOB, GPIO3},
+    {TIM4, GPIOB, GPIO6, GPIOB, GPIO7},
+};
+
+/**
+ * @brief Encoder TI1 signal level for a counter value (counting both edges).
+ */
+static bool encoder_ti1(uint16_t counter)
+{
+	return ((counter + 1) >> 1) & 1;
+}
+
+/**
+ * @brief Encoder TI2 signal level for a counter value (counting both edges).
+ */
+static bool encoder_ti2(uint16_t counter)
+{
+	return (counter >> 1) & 1;
+}
+
+/**
+ * @brief Set the position of an encoder, in counts.
+ *
+ * The counter of the timer in encoder mode is set to the integer part of the
+ * position. The encoder signals (TI1 and TI2, in quadrature) are stepped
+ * through every count in between, so the EXTI lines connected to them are
+ * triggered too. Each edge is timestamped interpolating its position between
+ * the previous update and this one, and the cycle counter is set to that time
+ * while its interruptions are dispatched, as if they happened in the target.
+ */
+void host_set_encoder_position(uint32_t timer_peripheral, double position)
+{
+	int index = timer_index(timer_peripheral);
+	const struct encoder_pins *pins = NULL;
+	uint64_t now = emulated_cycles();
+	double previous = encoder_position[index];
+	int64_t from = (int64_t)floor(previous);
+	int64_t to = (int64_t)floor(position);
+	int64_t step = to < from ? -1 : 1;
+	int64_t counter;
+	double edge;
+	bool ti1;
+	int i;
+
+	for (i = 0; i < (int)(sizeof(encoder_pins) / sizeof(encoder_pins[0]));
+	     i++)
+		if (encoder_pins[i].timer == timer_peripheral)
+			pins = &encoder_pins[i];
+	for (counter = from; pins && counter != to;) {
+		ti1 = encoder_ti1((uint16_t)counter);
+		edge = step > 0 ? (double)(counter + 1) : (double)counter;
+		counter += step;
+		TIM_CNT(timer_peripheral) = (uint16_t)counter;
+		cycles_override = encoder_update[index] +
+				  (uint64_t)((now - encoder_update[index]) *
+					     (edge - previous) /
+					     (position - previous));
+		cycles_override_set = true;
+		if (encoder_ti1((uint16_t)counter) != ti1)
+			gpio_input_edge(pins->ti1_port, pins->ti1_pin, !ti1);
+		else
+			gpio_input_edge(pins->ti2_port, pins->ti2_pin,
+					encoder_ti2((uint16_t)counter));
+		cycles_override_set = false;
+	}
+	TIM_CNT(timer_peripheral) = (uint16_t)to;
+	encoder_position[index] = position;
+	encoder_update[index] = now;
+}
+
+/**
+ * @brief Set the counter of a timer in encoder mode.
+ *
+ * The position is moved the (shortest) difference between counter values.
+ */
+void host_set_encoder_counter(uint32_t timer_peripheral, uint16_t count)
+{
+	int64_t counter =
+	    (int64_t)floor(encoder_position[timer_index(timer_peripheral)]);
+
+	host_set_encoder_position(
+	    timer_peripheral,
+	    (double)(counter + (int16_t)(count - (uint16_t)counter)));
+}
+
+/**
+ * @brief Return the active (not the preloaded) output compare value.
+ */
+uint32_t host_get_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id)
+{
+	return timer_oc_active[timer_index(timer_peripheral)][oc_index(oc_id)];
+}
+
+uint32_t host_get_timer_period(uint32_t timer_peripheral)
+{
+	return TIM_ARR(timer_peripheral);
+}
+
+void host_set_mpu_register(uint8_t address, uint8_t value)
+{
+	mpu_registers[address & 0x7f] = value;
+}
+
+uint8_t host_get_mpu_register(uint8_t address)
+{
+	return mpu_registers[address & 0x7f];
+}
+
+/**
+ * @brief Receive data through the emulated USART3.
+ *
+ * Data is written by the DMA if reception through DMA is enabled. An idle
+ * line is detected after the last byte.
+ */
+void host_serial_receive(const char *data, int size)
+{
+	uint8_t channel;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		channel = dma_find_channel(&USART_DR(USART3), false);
+		if ((USART_CR3(USART3) & USART_CR3_DMAR) && channel &&
+		    DMA_CNDTR(DMA1, channel) > 0) {
+			*dma_memory(channel) = (uint8_t)data[i];
+			dma_count(channel);
+			continue;
+		}
+		if (USART_SR(USART3) & USART_SR_RXNE)
+			USART_SR(USART3) |= USART_SR_ORE;
+		USART_DR(USART3) = (uint8_t)data[i];
+		USART_SR(USART3) |= USART_SR_RXNE;
+		if (USART_CR1(USART3) & USART_CR1_RXNEIE)
+			irq_raise(NVIC_USART3_IRQ);
+	}
+	USART_SR(USART3) |= USART_SR_IDLE;
+	if (USART_CR1(USART3) & USART_CR1_IDLEIE)
+		irq_raise(NVIC_USART3_IRQ);
+}
+
+/**
+ * @brief Number of bytes USART3 can receive (or transmit) in a SysTick
+ * period at the configured baud rate.
+ *
+ * It is `0` while USART3 is disabled.
+ */
+uint32_t host_get_serial_bytes_per_tick(void)
+{
+	uint32_t byte_cycles = usart_byte_cycles();
+
+	if (!(USART_CR1(USART3) & USART_CR1_UE))
+		return 0;
+	if (!byte_cycles)
+		return UINT32_MAX;
+	return cycles_per_tick / byte_cycles;
+}
+
+/**
+ * @brief Set the file descriptor where USART3 output is written.
+ *
+ * @param[in] fd File descriptor, or `-1` to discard the output.
+ */
+void host_set_serial_output(int fd)
+{
+	serial_output_fd = fd;
+}
@@ -0,0 +1,53 @@
+#ifndef __HOST_HAL_H
+#define __HOST_HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libopencm3/stm32/timer.h>
+
+/** Board wiring that the host backend needs to know about */
+#define HOST_MPU_CS_PORT GPIOB
+#define HOST_MPU_CS_PIN GPIO12
+#define HOST_MPU_WHO_AM_I 0x75
+#define HOST_MPU_WHO_AM_I_VALUE 0x70
+#define HOST_MPU_PWR_MGMT_1 0x6b
+#define HOST_MPU_DEVICE_RESET 0x80
+#define HOST_MPU_SMPLRT_DIV 0x19
+#define HOST_MPU_CONFIG 0x1a
+#define HOST_MPU_FIFO_EN 0x23
+#define HOST_MPU_FIFO_EN_ZG 0x10
+#define HOST_MPU_GYRO_ZOUT_H 0x47
+#define HOST_MPU_GYRO_ZOUT_L 0x48
+#define HOST_MPU_USER_CTRL 0x6a
+#define HOST_MPU_USER_CTRL_FIFO_EN 0x40
+#define HOST_MPU_USER_CTRL_FIFO_RST 0x04
+#define HOST_MPU_FIFO_COUNTH 0x72
+#define HOST_MPU_FIFO_COUNTL 0x73
+#define HOST_MPU_FIFO_R_W 0x74
+#define HOST_MPU_FIFO_SIZE 512
+
+void host_tick(void);
+uint32_t host_get_ticks(void);
+void host_set_tick_hook(void (*hook)(void));
+void host_start_realtime(float time_scale);
+void host_stop_realtime(void);
+void host_start_lockstep(void);
+void host_stop_lockstep(void);
+uint32_t host_get_systick_cycles(void);
+
+void host_set_adc_sampler(uint16_t (*sampler)(uint32_t adc, uint8_t channel));
+void host_set_adc_channel(uint8_t channel, uint16_t value);
+void host_set_gpio_input(uint32_t gpioport, uint16_t gpios, bool value);
+uint16_t host_get_gpio_output(uint32_t gpioport);
+void host_set_encoder_position(uint32_t timer_peripheral, double position);
+void host_set_encoder_counter(uint32_t timer_peripheral, uint16_t count);
+uint32_t host_get_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+uint32_t host_get_timer_period(uint32_t timer_peripheral);
+void host_set_mpu_register(uint8_t address, uint8_t value);
+uint8_t host_get_mpu_register(uint8_t address);
+void host_serial_receive(const char *data, int size);
+uint32_t host_get_serial_bytes_per_tick(void);
+void host_set_serial_output(int fd);
+
+#endif /* __HOST_HAL_H */
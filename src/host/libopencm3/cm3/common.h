@@ -0,0 +1,22 @@
+#ifndef __HOST_LIBOPENCM3_COMMON_H
+#define __HOST_LIBOPENCM3_COMMON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Peripheral registers are backed by host memory.
+ *
+ * `MMIO32()` keeps the same semantics as in libopencm3 (an lvalue for the
+ * register at the given address) so register macros can be used unchanged.
+ *
+ * `MMIO16()` is only used to program flash memory, so it is backed by the
+ * emulated flash programming latch.
+ */
+volatile uint32_t *host_register(uint32_t address);
+volatile uint16_t *host_register16(uint32_t address);
+
+#define MMIO32(addr) (*host_register(addr))
+#define MMIO16(addr) (*host_register16(addr))
+
+#endif /* __HOST_LIBOPENCM3_COMMON_H */
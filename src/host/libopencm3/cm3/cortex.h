@@ -0,0 +1,9 @@
+#ifndef __HOST_LIBOPENCM3_CORTEX_H
+#define __HOST_LIBOPENCM3_CORTEX_H
+
+#include <libopencm3/cm3/common.h>
+
+void cm_enable_interrupts(void);
+void cm_disable_interrupts(void);
+
+#endif /* __HOST_LIBOPENCM3_CORTEX_H */
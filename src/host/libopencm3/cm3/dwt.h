@@ -0,0 +1,9 @@
+#ifndef __HOST_LIBOPENCM3_DWT_H
+#define __HOST_LIBOPENCM3_DWT_H
+
+#include <libopencm3/cm3/common.h>
+
+bool dwt_enable_cycle_counter(void);
+uint32_t dwt_read_cycle_counter(void);
+
+#endif /* __HOST_LIBOPENCM3_DWT_H */
@@ -0,0 +1,35 @@
+#ifndef __HOST_LIBOPENCM3_NVIC_H
+#define __HOST_LIBOPENCM3_NVIC_H
+
+#include <libopencm3/cm3/common.h>
+
+/** Interrupt numbers (same as in the STM32F1 vector table) */
+#define NVIC_FLASH_IRQ 4
+#define NVIC_EXTI15_10_IRQ 40
+#define NVIC_DMA1_CHANNEL1_IRQ 11
+#define NVIC_DMA1_CHANNEL2_IRQ 12
+#define NVIC_DMA1_CHANNEL3_IRQ 13
+#define NVIC_DMA1_CHANNEL4_IRQ 14
+#define NVIC_DMA1_CHANNEL5_IRQ 15
+#define NVIC_DMA1_CHANNEL6_IRQ 16
+#define NVIC_DMA1_CHANNEL7_IRQ 17
+#define NVIC_ADC1_2_IRQ 18
+#define NVIC_EXTI9_5_IRQ 23
+#define NVIC_TIM1_UP_IRQ 25
+#define NVIC_TIM1_CC_IRQ 27
+#define NVIC_TIM2_IRQ 28
+#define NVIC_TIM3_IRQ 29
+#define NVIC_TIM4_IRQ 30
+#define NVIC_SPI2_IRQ 36
+#define NVIC_USART3_IRQ 39
+
+/** System exceptions are mapped after the last device interrupt */
+#define NVIC_SYSTICK_IRQ 63
+#define NVIC_IRQ_COUNT 64
+
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+void nvic_set_priority(uint8_t irqn, uint8_t priority);
+void nvic_set_pending_irq(uint8_t irqn);
+
+#endif /* __HOST_LIBOPENCM3_NVIC_H */
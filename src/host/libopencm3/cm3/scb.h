@@ -0,0 +1,6 @@
+#ifndef __HOST_LIBOPENCM3_SCB_H
+#define __HOST_LIBOPENCM3_SCB_H
+
+#include <libopencm3/cm3/common.h>
+
+#endif /* __HOST_LIBOPENCM3_SCB_H */
@@ -0,0 +1,17 @@
+#ifndef __HOST_LIBOPENCM3_SYNC_H
+#define __HOST_LIBOPENCM3_SYNC_H
+
+#include <libopencm3/cm3/common.h>
+
+typedef uint32_t mutex_t;
+
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1
+
+#define __dmb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+void mutex_lock(mutex_t *m);
+uint32_t mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+#endif /* __HOST_LIBOPENCM3_SYNC_H */
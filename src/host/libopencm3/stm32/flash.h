@@ -0,0 +1,35 @@
+#ifndef __HOST_LIBOPENCM3_FLASH_H
+#define __HOST_LIBOPENCM3_FLASH_H
+
+#include <libopencm3/stm32/memorymap.h>
+
+#define FLASH_ACR MMIO32(FLASH_MEM_INTERFACE_BASE + 0x00)
+#define FLASH_KEYR MMIO32(FLASH_MEM_INTERFACE_BASE + 0x04)
+#define FLASH_SR MMIO32(FLASH_MEM_INTERFACE_BASE + 0x0c)
+#define FLASH_CR MMIO32(FLASH_MEM_INTERFACE_BASE + 0x10)
+#define FLASH_AR MMIO32(FLASH_MEM_INTERFACE_BASE + 0x14)
+
+#define FLASH_SR_BSY (1 << 0)
+#define FLASH_SR_PGERR (1 << 2)
+#define FLASH_SR_WRPRTERR (1 << 4)
+#define FLASH_SR_EOP (1 << 5)
+
+#define FLASH_CR_PG (1 << 0)
+#define FLASH_CR_PER (1 << 1)
+#define FLASH_CR_STRT (1 << 6)
+#define FLASH_CR_LOCK (1 << 7)
+#define FLASH_CR_ERRIE (1 << 10)
+#define FLASH_CR_EOPIE (1 << 12)
+
+#define FLASH_KEYR_KEY1 ((uint32_t)0x45670123)
+#define FLASH_KEYR_KEY2 ((uint32_t)0xcdef89ab)
+
+void flash_unlock(void);
+void flash_lock(void);
+void flash_erase_page(uint32_t page_address);
+void flash_program_word(uint32_t address, uint32_t data);
+void flash_program_half_word(uint32_t address, uint16_t data);
+uint32_t flash_get_status_flags(void);
+void flash_clear_status_flags(void);
+
+#endif /* __HOST_LIBOPENCM3_FLASH_H */
@@ -0,0 +1,29 @@
+#ifndef __HOST_LIBOPENCM3_MEMORYMAP_H
+#define __HOST_LIBOPENCM3_MEMORYMAP_H
+
+#include <libopencm3/cm3/common.h>
+
+/** STM32F1 memory map (medium-density devices) */
+#define FLASH_BASE 0x08000000U
+#define FLASH_SIZE 0x00010000U
+#define PERIPH_BASE 0x40000000U
+#define PERIPH_SIZE 0x00023000U
+
+#define TIM2_BASE (PERIPH_BASE + 0x0000)
+#define TIM3_BASE (PERIPH_BASE + 0x0400)
+#define TIM4_BASE (PERIPH_BASE + 0x0800)
+#define SPI2_BASE (PERIPH_BASE + 0x3800)
+#define USART3_BASE (PERIPH_BASE + 0x4800)
+#define AFIO_BASE (PERIPH_BASE + 0x10000)
+#define EXTI_BASE (PERIPH_BASE + 0x10400)
+#define GPIO_PORT_A_BASE (PERIPH_BASE + 0x10800)
+#define GPIO_PORT_B_BASE (PERIPH_BASE + 0x10c00)
+#define GPIO_PORT_C_BASE (PERIPH_BASE + 0x11000)
+#define ADC1_BASE (PERIPH_BASE + 0x12400)
+#define ADC2_BASE (PERIPH_BASE + 0x12800)
+#define TIM1_BASE (PERIPH_BASE + 0x12c00)
+#define DMA1_BASE (PERIPH_BASE + 0x20000)
+#define RCC_BASE (PERIPH_BASE + 0x21000)
+#define FLASH_MEM_INTERFACE_BASE (PERIPH_BASE + 0x22000)
+
+#endif /* __HOST_LIBOPENCM3_MEMORYMAP_H */
@@ -0,0 +1,41 @@
+#ifndef __HOST_LIBOPENCM3_RCC_H
+#define __HOST_LIBOPENCM3_RCC_H
+
+#include <libopencm3/stm32/memorymap.h>
+
+enum rcc_periph_clken {
+	RCC_GPIOA,
+	RCC_GPIOB,
+	RCC_GPIOC,
+	RCC_AFIO,
+	RCC_USART3,
+	RCC_SPI2,
+	RCC_TIM1,
+	RCC_TIM2,
+	RCC_TIM3,
+	RCC_TIM4,
+	RCC_ADC1,
+	RCC_ADC2,
+	RCC_DMA1,
+};
+
+enum rcc_periph_rst {
+	RST_TIM1,
+	RST_TIM2,
+	RST_TIM3,
+	RST_TIM4,
+	RST_ADC1,
+	RST_ADC2,
+	RST_SPI2,
+	RST_USART3,
+};
+
+extern uint32_t rcc_ahb_frequency;
+extern uint32_t rcc_apb1_frequency;
+extern uint32_t rcc_apb2_frequency;
+
+void rcc_clock_setup_in_hse_8mhz_out_72mhz(void);
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst);
+
+#endif /* __HOST_LIBOPENCM3_RCC_H */
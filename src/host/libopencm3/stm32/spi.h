@@ -0,0 +1,61 @@
+#ifndef __HOST_LIBOPENCM3_SPI_H
+#define __HOST_LIBOPENCM3_SPI_H
+
+#include <libopencm3/stm32/memorymap.h>
+
+#define SPI2 SPI2_BASE
+
+#define SPI_CR1(spi) MMIO32((spi) + 0x00)
+#define SPI_CR2(spi) MMIO32((spi) + 0x04)
+#define SPI_SR(spi) MMIO32((spi) + 0x08)
+#define SPI_DR(spi) MMIO32((spi) + 0x0c)
+
+#define SPI2_DR SPI_DR(SPI2)
+
+#define SPI_CR1_SPE (1 << 6)
+#define SPI_CR1_SSI (1 << 8)
+#define SPI_CR1_SSM (1 << 9)
+#define SPI_CR1_RXONLY (1 << 10)
+
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_2 (0x00 << 3)
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_4 (0x01 << 3)
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_8 (0x02 << 3)
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_16 (0x03 << 3)
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_32 (0x04 << 3)
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_64 (0x05 << 3)
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_128 (0x06 << 3)
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_256 (0x07 << 3)
+
+#define SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE (0 << 1)
+#define SPI_CR1_CPOL_CLK_TO_1_WHEN_IDLE (1 << 1)
+#define SPI_CR1_CPHA_CLK_TRANSITION_1 (0 << 0)
+#define SPI_CR1_CPHA_CLK_TRANSITION_2 (1 << 0)
+#define SPI_CR1_DFF_8BIT (0 << 11)
+#define SPI_CR1_DFF_16BIT (1 << 11)
+#define SPI_CR1_MSBFIRST (0 << 7)
+#define SPI_CR1_LSBFIRST (1 << 7)
+
+#define SPI_CR2_RXDMAEN (1 << 0)
+#define SPI_CR2_TXDMAEN (1 << 1)
+
+#define SPI_SR_RXNE (1 << 0)
+#define SPI_SR_TXE (1 << 1)
+#define SPI_SR_OVR (1 << 6)
+#define SPI_SR_BSY (1 << 7)
+
+void spi_reset(uint32_t spi_peripheral);
+int spi_init_master(uint32_t spi, uint32_t br, uint32_t cpol, uint32_t cpha,
+		    uint32_t dff, uint32_t lsbfirst);
+void spi_enable(uint32_t spi);
+void spi_disable(uint32_t spi);
+void spi_enable_software_slave_management(uint32_t spi);
+void spi_set_nss_high(uint32_t spi);
+void spi_send(uint32_t spi, uint16_t data);
+uint16_t spi_read(uint32_t spi);
+uint16_t spi_xfer(uint32_t spi, uint16_t data);
+void spi_set_receive_only_mode(uint32_t spi);
+void spi_set_full_duplex_mode(uint32_t spi);
+void spi_enable_rx_dma(uint32_t spi);
+void spi_disable_rx_dma(uint32_t spi);
+
+#endif /* __HOST_LIBOPENCM3_SPI_H */
@@ -0,0 +1,136 @@
+#ifndef __HOST_LIBOPENCM3_TIMER_H
+#define __HOST_LIBOPENCM3_TIMER_H
+
+#include <libopencm3/stm32/memorymap.h>
+
+#define TIM1 TIM1_BASE
+#define TIM2 TIM2_BASE
+#define TIM3 TIM3_BASE
+#define TIM4 TIM4_BASE
+
+#define TIM_CR1(tim) MMIO32((tim) + 0x00)
+#define TIM_CR2(tim) MMIO32((tim) + 0x04)
+#define TIM_SMCR(tim) MMIO32((tim) + 0x08)
+#define TIM_DIER(tim) MMIO32((tim) + 0x0c)
+#define TIM_SR(tim) MMIO32((tim) + 0x10)
+#define TIM_EGR(tim) MMIO32((tim) + 0x14)
+#define TIM_CCMR1(tim) MMIO32((tim) + 0x18)
+#define TIM_CCMR2(tim) MMIO32((tim) + 0x1c)
+#define TIM_CCER(tim) MMIO32((tim) + 0x20)
+#define TIM_CNT(tim) MMIO32((tim) + 0x24)
+#define TIM_PSC(tim) MMIO32((tim) + 0x28)
+#define TIM_ARR(tim) MMIO32((tim) + 0x2c)
+#define TIM_RCR(tim) MMIO32((tim) + 0x30)
+#define TIM_CCR1(tim) MMIO32((tim) + 0x34)
+#define TIM_CCR2(tim) MMIO32((tim) + 0x38)
+#define TIM_CCR3(tim) MMIO32((tim) + 0x3c)
+#define TIM_CCR4(tim) MMIO32((tim) + 0x40)
+#define TIM_BDTR(tim) MMIO32((tim) + 0x44)
+
+#define TIM_CR1_CEN (1 << 0)
+#define TIM_CR1_UDIS (1 << 1)
+#define TIM_CR1_URS (1 << 2)
+#define TIM_CR1_OPM (1 << 3)
+#define TIM_CR1_DIR_UP (0 << 4)
+#define TIM_CR1_DIR_DOWN (1 << 4)
+#define TIM_CR1_CMS_EDGE (0 << 5)
+#define TIM_CR1_ARPE (1 << 7)
+#define TIM_CR1_CKD_CK_INT (0 << 8)
+
+#define TIM_DIER_UIE (1 << 0)
+#define TIM_DIER_CC1IE (1 << 1)
+#define TIM_DIER_CC2IE (1 << 2)
+#define TIM_DIER_CC3IE (1 << 3)
+#define TIM_DIER_CC4IE (1 << 4)
+#define TIM_DIER_UDE (1 << 8)
+#define TIM_DIER_CC1DE (1 << 9)
+#define TIM_DIER_CC2DE (1 << 10)
+#define TIM_DIER_CC3DE (1 << 11)
+#define TIM_DIER_CC4DE (1 << 12)
+
+#define TIM_SR_UIF (1 << 0)
+#define TIM_SR_CC1IF (1 << 1)
+#define TIM_SR_CC2IF (1 << 2)
+#define TIM_SR_CC3IF (1 << 3)
+#define TIM_SR_CC4IF (1 << 4)
+
+#define TIM_EGR_UG (1 << 0)
+
+#define TIM_CCMR1_OC1PE (1 << 3)
+#define TIM_CCMR1_OC2PE (1 << 11)
+#define TIM_CCMR2_OC3PE (1 << 3)
+#define TIM_CCMR2_OC4PE (1 << 11)
+
+#define TIM_BDTR_MOE (1 << 15)
+
+enum tim_oc_id {
+	TIM_OC1 = 0,
+	TIM_OC1N,
+	TIM_OC2,
+	TIM_OC2N,
+	TIM_OC3,
+	TIM_OC3N,
+	TIM_OC4,
+};
+
+enum tim_oc_mode {
+	TIM_OCM_FROZEN,
+	TIM_OCM_ACTIVE,
+	TIM_OCM_INACTIVE,
+	TIM_OCM_TOGGLE,
+	TIM_OCM_FORCE_LOW,
+	TIM_OCM_FORCE_HIGH,
+	TIM_OCM_PWM1,
+	TIM_OCM_PWM2,
+};
+
+enum tim_ic_id {
+	TIM_IC1,
+	TIM_IC2,
+	TIM_IC3,
+	TIM_IC4,
+};
+
+enum tim_ic_input {
+	TIM_IC_OUT = 0,
+	TIM_IC_IN_TI1 = 1,
+	TIM_IC_IN_TI2 = 2,
+	TIM_IC_IN_TRC = 3,
+	TIM_IC_IN_TI3 = 5,
+	TIM_IC_IN_TI4 = 6,
+};
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div,
+		    uint32_t alignment, uint32_t direction);
+void timer_set_clock_division(uint32_t timer_peripheral, uint32_t clock_div);
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value);
+void timer_set_repetition_counter(uint32_t timer_peripheral, uint32_t value);
+void timer_set_period(uint32_t timer_peripheral, uint32_t period);
+void timer_enable_preload(uint32_t timer_peripheral);
+void timer_disable_preload(uint32_t timer_peripheral);
+void timer_continuous_mode(uint32_t timer_peripheral);
+void timer_enable_update_event(uint32_t timer_peripheral);
+void timer_disable_update_event(uint32_t timer_peripheral);
+void timer_enable_counter(uint32_t timer_peripheral);
+void timer_disable_counter(uint32_t timer_peripheral);
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq);
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq);
+bool timer_get_flag(uint32_t timer_peripheral, uint32_t flag);
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag);
+uint32_t timer_get_counter(uint32_t timer_peripheral);
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count);
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event);
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id,
+		       enum tim_oc_mode oc_mode);
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id,
+			uint32_t value);
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_enable_break_main_output(uint32_t timer_peripheral);
+void timer_slave_set_mode(uint32_t timer_peripheral, uint8_t mode);
+void timer_ic_set_input(uint32_t timer_peripheral, enum tim_ic_id ic,
+			enum tim_ic_input in);
+
+#endif /* __HOST_LIBOPENCM3_TIMER_H */
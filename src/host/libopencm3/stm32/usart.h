@@ -0,0 +1,52 @@
+#ifndef __HOST_LIBOPENCM3_USART_H
+#define __HOST_LIBOPENCM3_USART_H
+
+#include <libopencm3/stm32/memorymap.h>
+
+#define USART3 USART3_BASE
+
+#define USART_SR(usart) MMIO32((usart) + 0x00)
+#define USART_DR(usart) MMIO32((usart) + 0x04)
+#define USART_BRR(usart) MMIO32((usart) + 0x08)
+#define USART_CR1(usart) MMIO32((usart) + 0x0c)
+#define USART_CR2(usart) MMIO32((usart) + 0x10)
+#define USART_CR3(usart) MMIO32((usart) + 0x14)
+
+#define USART3_DR USART_DR(USART3)
+
+#define USART_SR_ORE (1 << 3)
+#define USART_SR_IDLE (1 << 4)
+#define USART_SR_RXNE (1 << 5)
+#define USART_SR_TC (1 << 6)
+#define USART_SR_TXE (1 << 7)
+
+#define USART_CR1_RE (1 << 2)
+#define USART_CR1_TE (1 << 3)
+#define USART_CR1_IDLEIE (1 << 4)
+#define USART_CR1_RXNEIE (1 << 5)
+#define USART_CR1_TCIE (1 << 6)
+#define USART_CR1_TXEIE (1 << 7)
+#define USART_CR1_UE (1 << 13)
+
+#define USART_CR3_DMAR (1 << 6)
+#define USART_CR3_DMAT (1 << 7)
+
+#define USART_STOPBITS_1 0
+#define USART_PARITY_NONE 0
+#define USART_MODE_TX_RX (USART_CR1_RE | USART_CR1_TE)
+#define USART_FLOWCONTROL_NONE 0
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud);
+void usart_set_databits(uint32_t usart, uint32_t bits);
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits);
+void usart_set_parity(uint32_t usart, uint32_t parity);
+void usart_set_mode(uint32_t usart, uint32_t mode);
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol);
+void usart_enable(uint32_t usart);
+void usart_disable(uint32_t usart);
+void usart_enable_rx_dma(uint32_t usart);
+void usart_disable_rx_dma(uint32_t usart);
+void usart_enable_tx_dma(uint32_t usart);
+void usart_disable_tx_dma(uint32_t usart);
+
+#endif /* __HOST_LIBOPENCM3_USART_H */
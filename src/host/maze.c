@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "maze.h"
+
+#define MAX_LINE_LENGTH (4 * SIM_MAZE_MAX_SIZE + 8)
+#define MAX_LINES (2 * SIM_MAZE_MAX_SIZE + 1)
+
+/**
+ * @brief Whether there is a wall drawn at the given text position.
+ */
+static bool drawn(char lines[][MAX_LINE_LENGTH], int line, int column)
+{
+	if ((int)strlen(lines[line]) <= column)
+		return false;
+	return lines[line][column] != ' ';
+}
+
+/**
+ * @brief Load a maze from a text file.
+ *
+ * The file format is the commonly used text representation of micromouse
+ * mazes, where posts are drawn with `o`, horizontal walls with `---` and
+ * vertical walls with `|`:
+ *
+ *     o---o---o
+ *     |       |
+ *     o   o   o
+ *     |   |   |
+ *     o---o---o
+ *
+ * Any non-space character is considered a wall. Cell contents (i.e.: goal
+ * markers) are ignored.
+ *
+ * @param[in] path Path to the maze file.
+ * @param[out] maze Loaded maze.
+ * @return Zero on success, `-1` if the file could not be read or parsed.
+ */
+int sim_maze_load(const char *path, struct sim_maze *maze)
+{
+	static char lines[MAX_LINES][MAX_LINE_LENGTH];
+	FILE *file;
+	int count = 0;
+	int line;
+	int x;
+	int y;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+	while (count < MAX_LINES &&
+	       fgets(lines[count], MAX_LINE_LENGTH, file)) {
+		lines[count][strcspn(lines[count], "\r\n")] = '\0';
+		if (strlen(lines[count]) == 0)
+			continue;
+		count++;
+	}
+	fclose(file);
+
+	if (count < 3 || count % 2 == 0)
+		return -1;
+	memset(maze, 0, sizeof(*maze));
+	maze->size = (count - 1) / 2;
+
+	for (y = 0; y < maze->size; y++) {
+		line = 2 * (maze->size - 1 - y) + 1;
+		for (x = 0; x < maze->size; x++) {
+			if (drawn(lines, line - 1, 4 * x + 2))
+				maze->walls[x][y] |= SIM_MAZE_NORTH;
+			if (drawn(lines, line + 1, 4 * x + 2))
+				maze->walls[x][y] |= SIM_MAZE_SOUTH;
+			if (drawn(lines, line, 4 * x))
+				maze->walls[x][y] |= SIM_MAZE_WEST;
+			if (drawn(lines, line, 4 * x + 4))
+				maze->walls[x][y] |= SIM_MAZE_EAST;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Check whether a cell has a wall.
+ *
+ * Positions out of the maze are considered to be surrounded by walls.
+ *
+ * @param[in] maze The maze.
+ * @param[in] x Cell column.
+ * @param[in] y Cell row.
+ * @param[in] wall Wall bit (i.e.: `SIM_MAZE_NORTH`).
+ */
+bool sim_maze_has_wall(const struct sim_maze *maze, int x, int y,
+		       uint8_t wall)
+{
+	if (x < 0 || y < 0 || x >= maze->size || y >= maze->size)
+		return true;
+	return (maze->walls[x][y] & wall) != 0;
+}
@@ -0,0 +1,30 @@
+#ifndef __HOST_MAZE_H
+#define __HOST_MAZE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIM_MAZE_MAX_SIZE 32
+
+/** Wall bits for each cell */
+#define SIM_MAZE_EAST 0x01
+#define SIM_MAZE_SOUTH 0x02
+#define SIM_MAZE_WEST 0x04
+#define SIM_MAZE_NORTH 0x08
+
+/**
+ * A simulated maze.
+ *
+ * Cells are indexed with `x` increasing to the east and `y` increasing to the
+ * north. The starting cell is `(0, 0)`, at the south-west corner.
+ */
+struct sim_maze {
+	int size;
+	uint8_t walls[SIM_MAZE_MAX_SIZE][SIM_MAZE_MAX_SIZE];
+};
+
+int sim_maze_load(const char *path, struct sim_maze *maze);
+bool sim_maze_has_wall(const struct sim_maze *maze, int x, int y,
+		       uint8_t wall);
+
+#endif /* __HOST_MAZE_H */
@@ -0,0 +1,576 @@
+#include <math.h>
+#include <string.h>
+
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "config.h"
+#include "detection.h"
+#include "setup.h"
+
+#include "hal.h"
+#include "physics.h"
+
+/** Faulhaber 1524B009SR motors with a 15:60 gear reduction */
+#define MOTOR_RESISTANCE 10.6
+#define MOTOR_TORQUE_CONSTANT 0.00859
+#define GEAR_RATIO 4.
+#define ENCODER_COUNTS_PER_MOTOR_TURN (512 * 4)
+
+/** Integration steps per SysTick period */
+#define PHYSICS_SUBSTEPS 10
+
+/** Body and sensor geometry, relative to the center of the wheels axis */
+#define MOUSE_WIDTH 0.07
+#define SIDE_SENSOR_SHIFT 0.03
+#define FRONT_SENSOR_SEPARATION 0.03
+
+/** Sensor model */
+#define SENSOR_AMBIENT 100
+#define SENSOR_MAX_RANGE 0.5
+#define BATTERY_VOLTAGE 4.
+
+/** MPU registers */
+#define MPU_GYRO_CONFIG 0x1b
+#define MPU_GYRO_ZOUT_H 0x47
+#define MPU_GYRO_ZOUT_L 0x48
+
+#define MAX_NEARBY_BOXES 128
+#define CONTACT_TOLERANCE 1e-6
+
+struct box {
+	double x0;
+	double y0;
+	double x1;
+	double y1;
+};
+
+/**
+ * Phototransistor, emitter and geometry of each sensor.
+ *
+ * Distances are measured from the center of the wheels axis, which is how the
+ * wall distances are interpreted by the control (i.e.: a centered mouse reads
+ * `MIDDLE_MAZE_DISTANCE` on both sides).
+ */
+struct sensor {
+	uint8_t channel;
+	uint32_t emitter_port;
+	uint16_t emitter_pin;
+	float a;
+	float b;
+	double forward;
+	double left;
+	double angle;
+};
+
+static const struct sensor sensors[NUM_SENSOR] = {
+    [SENSOR_SIDE_LEFT_ID] = {ADC_CHANNEL4, GPIOA, GPIO9, SENSOR_SIDE_LEFT_A,
+			     SENSOR_SIDE_LEFT_B, SIDE_SENSOR_SHIFT, 0.,
+			     M_PI / 2.},
+    [SENSOR_SIDE_RIGHT_ID] = {ADC_CHANNEL3, GPIOB, GPIO8, SENSOR_SIDE_RIGHT_A,
+			      SENSOR_SIDE_RIGHT_B, SIDE_SENSOR_SHIFT, 0.,
+			      -M_PI / 2.},
+    [SENSOR_FRONT_LEFT_ID] = {ADC_CHANNEL5, GPIOA, GPIO8, SENSOR_FRONT_LEFT_A,
+			      SENSOR_FRONT_LEFT_B, 0.,
+			      FRONT_SENSOR_SEPARATION / 2., 0.},
+    [SENSOR_FRONT_RIGHT_ID] = {ADC_CHANNEL2, GPIOB, GPIO9,
+			       SENSOR_FRONT_RIGHT_A, SENSOR_FRONT_RIGHT_B, 0.,
+			       -FRONT_SENSOR_SEPARATION / 2., 0.},
+};
+
+static const struct sim_maze *maze;
+static struct physics_state state;
+static uint16_t sensor_on[NUM_SENSOR];
+static bool visited[SIM_MAZE_MAX_SIZE][SIM_MAZE_MAX_SIZE];
+
+/* Measurement noise, deterministic for a given seed */
+static uint64_t noise_state;
+static double sensor_noise;
+static double gyro_noise;
+
+/**
+ * @brief Wheel radius, derived from the calibrated encoder resolution.
+ */
+static double wheel_radius(void)
+{
+	return get_micrometers_per_count() * ENCODER_COUNTS_PER_MOTOR_TURN *
+	       GEAR_RATIO / (2 * M_PI * MICROMETERS_PER_METER);
+}
+
+/**
+ * @brief Whether a wall is standing on a horizontal boundary.
+ *
+ * @param[in] x Cell column.
+ * @param[in] y Boundary row (`0` is the south border of the maze).
+ */
+static bool horizontal_wall(int x, int y)
+{
+	if (x < 0 || x >= maze->size || y < 0 || y > maze->size)
+		return false;
+	if (y == maze->size)
+		return sim_maze_has_wall(maze, x, y - 1, SIM_MAZE_NORTH);
+	return sim_maze_has_wall(maze, x, y, SIM_MAZE_SOUTH);
+}
+
+/**
+ * @brief Whether a wall is standing on a vertical boundary.
+ *
+ * @param[in] x Boundary column (`0` is the west border of the maze).
+ * @param[in] y Cell row.
+ */
+static bool vertical_wall(int x, int y)
+{
+	if (x < 0 || x > maze->size || y < 0 || y >= maze->size)
+		return false;
+	if (x == maze->size)
+		return sim_maze_has_wall(maze, x - 1, y, SIM_MAZE_EAST);
+	return sim_maze_has_wall(maze, x, y, SIM_MAZE_WEST);
+}
+
+/**
+ * @brief Collect the posts and walls close to a position.
+ *
+ * @param[in] x Position coordinate, in meters.
+ * @param[in] y Position coordinate, in meters.
+ * @param[in] radius Number of cells around the position to consider.
+ * @param[out] boxes Bounding boxes of the posts and walls found.
+ * @return Number of boxes found.
+ */
+static int nearby_boxes(double x, double y, int radius, struct box *boxes)
+{
+	const double half = WALL_WIDTH / 2.;
+	int cx = (int)floor(x / CELL_DIMENSION);
+	int cy = (int)floor(y / CELL_DIMENSION);
+	int count = 0;
+	int i;
+	int j;
+
+	for (i = cx - radius; i <= cx + radius + 1; i++) {
+		for (j = cy - radius; j <= cy + radius + 1; j++) {
+			if (count + 3 > MAX_NEARBY_BOXES)
+				return count;
+			if (i >= 0 && i <= maze->size && j >= 0 &&
+			    j <= maze->size)
+				boxes[count++] = (struct box){
+				    i * CELL_DIMENSION - half,
+				    j * CELL_DIMENSION - half,
+				    i * CELL_DIMENSION + half,
+				    j * CELL_DIMENSION + half};
+			if (horizontal_wall(i, j))
+				boxes[count++] = (struct box){
+				    i * CELL_DIMENSION,
+				    j * CELL_DIMENSION - half,
+				    (i + 1) * CELL_DIMENSION,
+				    j * CELL_DIMENSION + half};
+			if (vertical_wall(i, j))
+				boxes[count++] = (struct box){
+				    i * CELL_DIMENSION - half,
+				    j * CELL_DIMENSION,
+				    i * CELL_DIMENSION + half,
+				    (j + 1) * CELL_DIMENSION};
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Distance from a point to a box along a ray.
+ *
+ * @return The distance, or `INFINITY` if the ray does not hit the box.
+ */
+static double ray_box(double x, double y, double dx, double dy,
+		      const struct box *box)
+{
+	double near = 0.;
+	double far = INFINITY;
+	double t0;
+	double t1;
+	double swap;
+
+	if (fabs(dx) < 1e-12) {
+		if (x < box->x0 || x > box->x1)
+			return INFINITY;
+	} else {
+		t0 = (box->x0 - x) / dx;
+		t1 = (box->x1 - x) / dx;
+		if (t0 > t1) {
+			swap = t0;
+			t0 = t1;
+			t1 = swap;
+		}
+		near = fmax(near, t0);
+		far = fmin(far, t1);
+	}
+	if (fabs(dy) < 1e-12) {
+		if (y < box->y0 || y > box->y1)
+			return INFINITY;
+	} else {
+		t0 = (box->y0 - y) / dy;
+		t1 = (box->y1 - y) / dy;
+		if (t0 > t1) {
+			swap = t0;
+			t0 = t1;
+			t1 = swap;
+		}
+		near = fmax(near, t0);
+		far = fmin(far, t1);
+	}
+	if (near > far)
+		return INFINITY;
+	return near;
+}
+
+/**
+ * @brief Whether a point is inside a post or a wall.
+ *
+ * Points touching a surface (i.e.: the tail at the starting position) are not
+ * considered to be inside.
+ */
+static bool inside_wall(double x, double y)
+{
+	struct box boxes[MAX_NEARBY_BOXES];
+	int count;
+	int i;
+
+	count = nearby_boxes(x, y, 0, boxes);
+	for (i = 0; i < count; i++) {
+		if (x > boxes[i].x0 + CONTACT_TOLERANCE &&
+		    x < boxes[i].x1 - CONTACT_TOLERANCE &&
+		    y > boxes[i].y0 + CONTACT_TOLERANCE &&
+		    y < boxes[i].y1 - CONTACT_TOLERANCE)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Whether the mouse body is overlapping a post or a wall.
+ *
+ * The body is approximated with a rectangle and checked at its corners and
+ * at the middle of its sides.
+ */
+static bool body_collides(double x, double y, double theta)
+{
+	const double forward[] = {MOUSE_HEAD, MOUSE_HEAD, -MOUSE_TAIL,
+				  -MOUSE_TAIL, MOUSE_HEAD, 0., 0.};
+	const double left[] = {MOUSE_WIDTH / 2., -MOUSE_WIDTH / 2.,
+			       MOUSE_WIDTH / 2., -MOUSE_WIDTH / 2.,
+			       0., MOUSE_WIDTH / 2., -MOUSE_WIDTH / 2.};
+	double c = cos(theta);
+	double s = sin(theta);
+	unsigned int i;
+
+	for (i = 0; i < sizeof(forward) / sizeof(forward[0]); i++) {
+		if (inside_wall(x + forward[i] * c - left[i] * s,
+				y + forward[i] * s + left[i] * c))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Distance measured by a sensor to the closest post or wall.
+ */
+static double sensor_distance(const struct sensor *sensor)
+{
+	struct box boxes[MAX_NEARBY_BOXES];
+	double c = cos(state.theta);
+	double s = sin(state.theta);
+	double x = state.x + sensor->forward * c - sensor->left * s;
+	double y = state.y + sensor->forward * s + sensor->left * c;
+	double distance = SENSOR_MAX_RANGE;
+	int count;
+	int i;
+
+	count = nearby_boxes(x, y, 2, boxes);
+	for (i = 0; i < count; i++)
+		distance = fmin(distance,
+				ray_box(x, y, cos(state.theta + sensor->angle),
+					sin(state.theta + sensor->angle),
+					&boxes[i]));
+	return distance;
+}
+
+/**
+ * @brief Normally distributed random number, with zero mean and unit variance.
+ *
+ * A xorshift64* generator is used with the Box-Muller transform, so the
+ * sequence only depends on the noise seed.
+ */
+static double gaussian(void)
+{
+	double u[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		noise_state ^= noise_state >> 12;
+		noise_state ^= noise_state << 25;
+		noise_state ^= noise_state >> 27;
+		u[i] = ((noise_state * 0x2545f4914f6cdd1dULL) >> 11) /
+		       9007199254740992.;
+	}
+	return sqrt(-2. * log(1. - u[0])) * cos(2. * M_PI * u[1]);
+}
+
+/**
+ * @brief Update the phototransistor readings with the emitters on.
+ *
+ * The readings follow the model used for calibration, where the distance is
+ * `a / log(on - off) - b`.
+ */
+static void update_sensors(void)
+{
+	double difference;
+	int i;
+
+	for (i = 0; i < NUM_SENSOR; i++) {
+		state.sensor_distance[i] = (float)sensor_distance(&sensors[i]);
+		difference = exp(sensors[i].a /
+				 (state.sensor_distance[i] + sensors[i].b));
+		if (sensor_noise > 0.)
+			difference += sensor_noise * gaussian();
+		difference = fmin(difference, ADC_RESOLUTION - 1 - SENSOR_AMBIENT);
+		difference = fmax(difference, 0.);
+		sensor_on[i] = (uint16_t)(SENSOR_AMBIENT + difference);
+	}
+}
+
+/**
+ * @brief Update the gyroscope Z-axis rate registers.
+ *
+ * The full scale range configured in the MPU is taken into account.
+ */
+static void update_gyro(void)
+{
+	const double sensitivity[] = {131., 65.5, 32.8, 16.4};
+	uint8_t full_scale;
+	double rate;
+
+	full_scale = (host_get_mpu_register(MPU_GYRO_CONFIG) >> 3) & 0x3;
+	rate = state.angular_velocity;
+	if (gyro_noise > 0.)
+		rate += gyro_noise * gaussian();
+	rate = round(rate * 180. / M_PI * sensitivity[full_scale]);
+	rate = fmax(fmin(rate, INT16_MAX), INT16_MIN);
+	host_set_mpu_register(MPU_GYRO_ZOUT_H, (uint8_t)((int16_t)rate >> 8));
+	host_set_mpu_register(MPU_GYRO_ZOUT_L, (uint8_t)(int16_t)rate);
+}
+
+/**
+ * @brief Update the encoder counters with the distance traveled.
+ *
+ * Both encoders count up when the mouse moves forward.
+ */
+static void update_encoders(void)
+{
+	double counts_per_meter =
+	    MICROMETERS_PER_METER / get_micrometers_per_count();
+
+	host_set_encoder_position(TIM2,
+				  state.left_distance * counts_per_meter);
+	host_set_encoder_position(TIM4,
+				  state.right_distance * counts_per_meter);
+}
+
+/**
+ * @brief Motor voltage from the H-bridge PWM duty cycles.
+ */
+static double motor_voltage(enum tim_oc_id in_a, enum tim_oc_id in_b)
+{
+	double period = host_get_timer_period(TIM3) + 1.;
+
+	return ((double)host_get_oc_value(TIM3, in_a) -
+		(double)host_get_oc_value(TIM3, in_b)) /
+	       period * MOTOR_DRIVER_INPUT_VOLTAGE;
+}
+
+/**
+ * @brief Force applied by a wheel on the ground.
+ *
+ * @param[in] voltage Motor voltage.
+ * @param[in] velocity Wheel linear velocity.
+ */
+static double wheel_force(double voltage, double velocity)
+{
+	double radius = wheel_radius();
+	double motor_speed = velocity * GEAR_RATIO / radius;
+	double current;
+
+	current = (voltage - MOTOR_TORQUE_CONSTANT * motor_speed) /
+		  MOTOR_RESISTANCE;
+	return current * MOTOR_TORQUE_CONSTANT * GEAR_RATIO / radius;
+}
+
+/**
+ * @brief Integrate the differential drive dynamics for a time step.
+ *
+ * If the mouse runs into a post or a wall it stops there, which results in
+ * stalled wheels (and saturated motor drivers) just like in a real collision.
+ */
+static void integrate(double left_voltage, double right_voltage, double dt)
+{
+	const double half_separation = MOUSE_WHEELS_SEPARATION / 2.;
+	double left_velocity;
+	double right_velocity;
+	double left_force;
+	double right_force;
+	double x;
+	double y;
+	double theta;
+
+	left_velocity =
+	    state.linear_velocity - state.angular_velocity * half_separation;
+	right_velocity =
+	    state.linear_velocity + state.angular_velocity * half_separation;
+	left_force = wheel_force(left_voltage, left_velocity);
+	right_force = wheel_force(right_voltage, right_velocity);
+
+	state.linear_velocity += (left_force + right_force) / MOUSE_MASS * dt;
+	state.angular_velocity += (right_force - left_force) *
+				  half_separation / MOUSE_MOMENT_OF_INERTIA *
+				  dt;
+
+	theta = state.theta + state.angular_velocity * dt;
+	x = state.x + state.linear_velocity * cos(theta) * dt;
+	y = state.y + state.linear_velocity * sin(theta) * dt;
+	if (body_collides(x, y, theta)) {
+		state.linear_velocity = 0.;
+		state.angular_velocity = 0.;
+		state.crashed = true;
+		return;
+	}
+	state.x = x;
+	state.y = y;
+	state.theta = theta;
+	state.left_distance +=
+	    (state.linear_velocity - state.angular_velocity * half_separation) *
+	    dt;
+	state.right_distance +=
+	    (state.linear_velocity + state.angular_velocity * half_separation) *
+	    dt;
+	state.traveled_distance += fabs(state.linear_velocity) * dt;
+}
+
+/**
+ * @brief Account for the cell the mouse is in as visited.
+ */
+static void visit_cell(void)
+{
+	int x = (int)floor(state.x / CELL_DIMENSION);
+	int y = (int)floor(state.y / CELL_DIMENSION);
+
+	if (x < 0 || y < 0 || x >= maze->size || y >= maze->size)
+		return;
+	if (visited[x][y])
+		return;
+	visited[x][y] = true;
+	state.visited_cells++;
+}
+
+/**
+ * @brief Advance the simulation by one SysTick period.
+ *
+ * The motor voltages are sampled from the PWM outputs and the resulting
+ * encoder counts, gyroscope rate and phototransistor readings are updated
+ * before the SysTick handler executes.
+ */
+static void physics_tick(void)
+{
+	double dt = 1. / SYSTICK_FREQUENCY_HZ / PHYSICS_SUBSTEPS;
+	double left_voltage;
+	double right_voltage;
+	int i;
+
+	left_voltage = motor_voltage(TIM_OC1, TIM_OC2);
+	right_voltage = motor_voltage(TIM_OC3, TIM_OC4);
+	for (i = 0; i < PHYSICS_SUBSTEPS; i++)
+		integrate(left_voltage, right_voltage, dt);
+	visit_cell();
+
+	update_encoders();
+	update_gyro();
+	update_sensors();
+}
+
+/**
+ * @brief Sample the analog inputs.
+ *
+ * Phototransistors read the ambient light unless their emitter is on.
+ */
+static uint16_t physics_adc_sample(uint32_t adc, uint8_t channel)
+{
+	int i;
+
+	(void)adc;
+	if (channel == ADC_CHANNEL0)
+		return (uint16_t)(BATTERY_VOLTAGE / VOLT_DIV_FACTOR / ADC_LSB);
+	for (i = 0; i < NUM_SENSOR; i++) {
+		if (sensors[i].channel != channel)
+			continue;
+		if (host_get_gpio_output(sensors[i].emitter_port) &
+		    sensors[i].emitter_pin)
+			return sensor_on[i];
+		return SENSOR_AMBIENT;
+	}
+	return 0;
+}
+
+/**
+ * @brief Place the mouse at the starting position of a maze, stopped.
+ *
+ * The mouse starts in the south-west cell, facing north, with its tail
+ * touching the back wall. The simulation hooks are installed in the host
+ * backend, so the simulation advances with each tick.
+ *
+ * Wheel distances are kept, as a real mouse keeps its encoder counts when
+ * placed back at the start.
+ *
+ * @param[in] simulated_maze Maze to simulate.
+ */
+void physics_reset(const struct sim_maze *simulated_maze)
+{
+	double left_distance = state.left_distance;
+	double right_distance = state.right_distance;
+
+	maze = simulated_maze;
+	memset(&state, 0, sizeof(state));
+	state.x = CELL_DIMENSION / 2.;
+	state.y = MOUSE_START_SHIFT;
+	state.theta = M_PI / 2.;
+	state.left_distance = left_distance;
+	state.right_distance = right_distance;
+	memset(visited, 0, sizeof(visited));
+	visit_cell();
+
+	update_encoders();
+	update_gyro();
+	update_sensors();
+	host_set_adc_sampler(physics_adc_sample);
+	host_set_tick_hook(physics_tick);
+}
+
+/**
+ * @brief Set the measurement noise.
+ *
+ * Gaussian noise is added to the phototransistor readings and to the
+ * gyroscope rate. Noise is disabled by default.
+ *
+ * @param[in] seed Random generator seed, so simulations can be reproduced.
+ * @param[in] sensor Phototransistor noise standard deviation, in ADC counts.
+ * @param[in] gyro Gyroscope noise standard deviation, in radians per second.
+ */
+void physics_set_noise(uint32_t seed, double sensor, double gyro)
+{
+	noise_state = ((uint64_t)seed << 1) | 1;
+	sensor_noise = sensor;
+	gyro_noise = gyro;
+}
+
+/**
+ * @brief Get the current simulated state.
+ */
+struct physics_state physics_get_state(void)
+{
+	return state;
+}
@@ -0,0 +1,37 @@
+#ifndef __HOST_PHYSICS_H
+#define __HOST_PHYSICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "maze.h"
+
+/**
+ * Simulated mouse state.
+ *
+ * Position is in meters, with the origin at the south-west corner of the maze
+ * (at the center of the posts). Orientation is in radians, counter-clockwise
+ * from the east.
+ *
+ * The traveled distance and the number of visited cells are accounted since
+ * the last reset.
+ */
+struct physics_state {
+	double x;
+	double y;
+	double theta;
+	double linear_velocity;
+	double angular_velocity;
+	double left_distance;
+	double right_distance;
+	float sensor_distance[4];
+	double traveled_distance;
+	uint32_t visited_cells;
+	bool crashed;
+};
+
+void physics_reset(const struct sim_maze *maze);
+void physics_set_noise(uint32_t seed, double sensor, double gyro);
+struct physics_state physics_get_state(void);
+
+#endif /* __HOST_PHYSICS_H */
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmlib/control.h"
+#include "mmlib/logging.h"
+#include "mmlib/speed.h"
+
+#include "profiling.h"
+#include "setup.h"
+
+#include "hal.h"
+
+#define DEFAULT_TICKS 10000
+#define TICK_BUDGET_CYCLES (SYSCLK_FREQUENCY_HZ / SYSTICK_FREQUENCY_HZ)
+
+static int compare_cycles(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Profile the SysTick handler on the host.
+ *
+ * Usage: `profile [-t MAX_P99] [TICKS]`
+ *
+ * The firmware is configured as in `main()`, with motor control and data
+ * logging enabled, and a number of ticks (`DEFAULT_TICKS` or `TICKS`) are
+ * emulated. Statistics of the host execution time of `sys_tick_handler()`
+ * are reported in SYSCLK cycles, together with the number of ticks exceeding
+ * the SysTick period.
+ *
+ * The statistics of each stage, as recorded by the firmware profiling, are
+ * reported as well.
+ *
+ * Host execution times depend on the host load, so overruns are only
+ * reported. The program only fails if `-t` is given and the 99th percentile
+ * exceeds `MAX_P99` cycles.
+ */
+int main(int argc, char *argv[])
+{
+	uint32_t ticks = DEFAULT_TICKS;
+	uint32_t max_p99 = 0;
+	uint32_t p99;
+	uint32_t overruns = 0;
+	uint64_t total = 0;
+	struct profiling_statistics statistics;
+	enum profiling_stage stage;
+	uint32_t *cycles;
+	uint32_t i;
+
+	for (i = 1; i < (uint32_t)argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < (uint32_t)argc)
+			max_p99 = (uint32_t)atoi(argv[++i]);
+		else
+			ticks = (uint32_t)atoi(argv[i]);
+	}
+	if (ticks == 0) {
+		fprintf(stderr, "Usage: %s [-t MAX_P99] [TICKS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	cycles = malloc(ticks * sizeof(*cycles));
+	if (!cycles)
+		return EXIT_FAILURE;
+
+	host_set_serial_output(-1);
+	setup();
+	kinematic_configuration(0.25, false);
+	enable_motor_control();
+	start_data_logging(log_data_control);
+	enable_systick_interruption();
+
+	for (i = 0; i < ticks; i++) {
+		host_tick();
+		cycles[i] = host_get_systick_cycles();
+		total += cycles[i];
+		if (cycles[i] > TICK_BUDGET_CYCLES)
+			overruns++;
+	}
+	qsort(cycles, ticks, sizeof(*cycles), compare_cycles);
+
+	printf("ticks: %u\n", ticks);
+	printf("budget: %u\n", TICK_BUDGET_CYCLES);
+	printf("min: %u\n", cycles[0]);
+	printf("avg: %u\n", (uint32_t)(total / ticks));
+	p99 = cycles[(uint32_t)(ticks * 0.99)];
+	printf("p99: %u\n", p99);
+	printf("max: %u\n", cycles[ticks - 1]);
+	printf("overruns: %u\n", overruns);
+	for (stage = 0; stage < PROFILING_NUM_STAGES; stage++) {
+		statistics = get_profiling_statistics(stage);
+		printf("%s: min %u, avg %u, p99 %u, max %u\n",
+		       get_profiling_stage_name(stage), statistics.min,
+		       statistics.avg, statistics.p99, statistics.max);
+	}
+
+	free(cycles);
+	if (max_p99 && p99 > max_p99) {
+		fprintf(stderr, "p99 exceeds %u cycles\n", max_p99);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
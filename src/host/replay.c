@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmlib/control.h"
+#include "mmlib/encoder.h"
+#include "mmlib/move.h"
+#include "mmlib/walls.h"
+
+#include "collision.h"
+#include "crc.h"
+#include "motor.h"
+#include "platform.h"
+#include "replay.h"
+#include "setup.h"
+#include "telemetry.h"
+
+#include "hal.h"
+
+/**
+ * @brief Read a whole file into memory.
+ *
+ * @param[in] path File path.
+ * @param[out] size Size (number of bytes) of the file.
+ * @return The file contents (to be freed) or `NULL` on error.
+ */
+static uint8_t *read_file(const char *path, uint32_t *size)
+{
+	FILE *file;
+	uint8_t *data = NULL;
+	long length;
+
+	file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+	if (fseek(file, 0, SEEK_END) || (length = ftell(file)) < 0 ||
+	    fseek(file, 0, SEEK_SET))
+		goto out;
+	data = malloc(length ? length : 1);
+	if (data && fread(data, 1, length, file) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+	*size = length;
+out:
+	fclose(file);
+	return data;
+}
+
+/**
+ * @brief Extract the replay entries from a recorded serial stream.
+ *
+ * Text messages and other telemetry frames are skipped, as well as frames
+ * with a wrong CRC. Entries are extracted in place, up to the first lost
+ * frame, as the following ticks could not be played consistently.
+ *
+ * @param[in,out] stream Recorded stream, overwritten with the entries.
+ * @param[in] size Size (number of bytes) of the stream.
+ * @param[out] lost Whether frames were lost.
+ * @return Size (number of bytes) of the entries.
+ */
+static uint32_t extract_entries(uint8_t *stream, uint32_t size, bool *lost)
+{
+	struct telemetry_header header;
+	uint32_t entries = 0;
+	uint32_t position = 0;
+	uint32_t length;
+	uint16_t crc;
+	bool synchronized = false;
+	uint16_t sequence = 0;
+
+	*lost = false;
+	while (position + sizeof(header) <= size) {
+		memcpy(&header, &stream[position], sizeof(header));
+		length = sizeof(header) + header.size + sizeof(crc);
+		if (header.sync[0] != TELEMETRY_SYNC_0 ||
+		    header.sync[1] != TELEMETRY_SYNC_1 ||
+		    position + length > size) {
+			position++;
+			continue;
+		}
+		memcpy(&crc, &stream[position + length - sizeof(crc)],
+		       sizeof(crc));
+		if (crc != crc16(CRC16_INIT, &stream[position + 2],
+				 length - 2 - sizeof(crc))) {
+			position++;
+			continue;
+		}
+		if (synchronized && header.sequence != sequence) {
+			*lost = true;
+			break;
+		}
+		synchronized = true;
+		sequence = header.sequence + 1;
+		if (header.type == TELEMETRY_REPLAY) {
+			memmove(&stream[entries],
+				&stream[position + sizeof(header)],
+				header.size);
+			entries += header.size;
+		}
+		position += length;
+	}
+	return entries;
+}
+
+/**
+ * @brief Restore the state recorded in the replay header.
+ *
+ * The control is configured as in `configure_speed()` and `before_moving()`,
+ * with the recorded configuration, force and movement kind. The emulated
+ * encoder counters are set to the recorded ones and read twice, so the
+ * encoder readings start from the recorded counters at rest.
+ */
+static void restore(const struct replay_header *header)
+{
+	struct config *update = begin_config_update();
+
+	*update = header->config;
+	commit_config_update(update);
+	kinematic_configuration(header->force, header->run);
+	host_set_mpu_register(MPU_GYRO_Z_OFFSET_ADDRESS,
+			      header->gyro_z_offset[0]);
+	host_set_mpu_register(MPU_GYRO_Z_OFFSET_ADDRESS + 1,
+			      header->gyro_z_offset[1]);
+	host_set_encoder_counter(TIM2, header->encoder_left);
+	host_set_encoder_counter(TIM4, header->encoder_right);
+	update_encoder_readings();
+	update_encoder_readings();
+	reset_motion();
+	disable_walls_control();
+	reset_collision_detector();
+	enable_motor_control();
+	set_starting_position();
+}
+
+/**
+ * @brief Replay a recorded run on the host.
+ *
+ * Usage: `replay [-o OUTPUT] RECORDING`
+ *
+ * The recording is the serial output of a run with `REPLAY_RECORDING`
+ * enabled. The state recorded in its header is restored and then the
+ * SysTick handler is executed once per recorded tick, with the peripheral
+ * reads and movement targets taken from the recording.
+ *
+ * The motor powers are compared with the recorded ones and, optionally,
+ * written to `OUTPUT` (one tick per line), so they can be compared between
+ * builds too. Host execution time of the SysTick handler is reported.
+ */
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	const char *output_path = NULL;
+	struct replay_statistics statistics;
+	struct replay_header header;
+	FILE *output = NULL;
+	uint64_t total = 0;
+	uint32_t max = 0;
+	uint32_t cycles;
+	uint32_t size;
+	uint8_t *recording;
+	bool lost;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			output_path = argv[++i];
+		else
+			path = argv[i];
+	}
+	if (!path) {
+		fprintf(stderr, "Usage: %s [-o OUTPUT] RECORDING\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	recording = read_file(path, &size);
+	if (!recording) {
+		fprintf(stderr, "Unable to read %s\n", path);
+		return EXIT_FAILURE;
+	}
+	size = extract_entries(recording, size, &lost);
+	if (lost)
+		fprintf(stderr, "Frames lost, replaying up to the first gap\n");
+	if (output_path) {
+		output = fopen(output_path, "w");
+		if (!output) {
+			fprintf(stderr, "Unable to write %s\n", output_path);
+			return EXIT_FAILURE;
+		}
+	}
+
+	host_set_serial_output(-1);
+	setup();
+	replay_start_playback(recording, size);
+	if (!get_replay_header(&header)) {
+		fprintf(stderr, "Recording header not found\n");
+		return EXIT_FAILURE;
+	}
+	restore(&header);
+	systick_interrupt_enable();
+
+	while (!replay_playback_finished()) {
+		host_tick();
+		cycles = host_get_systick_cycles();
+		total += cycles;
+		if (cycles > max)
+			max = cycles;
+		if (output)
+			fprintf(output, "%d %d\n", get_left_power(),
+				get_right_power());
+	}
+	statistics = get_replay_statistics();
+
+	printf("ticks: %u\n", statistics.ticks);
+	printf("input mismatches: %u\n", statistics.input_mismatches);
+	printf("output mismatches: %u\n", statistics.output_mismatches);
+	if (statistics.input_mismatches || statistics.output_mismatches)
+		printf("first mismatch: tick %u\n",
+		       statistics.first_mismatch_tick);
+	if (statistics.ticks)
+		printf("cycles: avg %u, max %u\n",
+		       (uint32_t)(total / statistics.ticks), max);
+
+	if (output)
+		fclose(output);
+	free(recording);
+	return statistics.input_mismatches || statistics.output_mismatches
+		   ? EXIT_FAILURE
+		   : EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mmlib/calibration.h"
+#include "mmlib/control.h"
+#include "mmlib/move.h"
+#include "mmlib/search.h"
+#include "mmlib/solve.h"
+#include "mmlib/speed.h"
+#include "mmlib/walls.h"
+
+#include "setup.h"
+
+#include "hal.h"
+#include "maze.h"
+#include "physics.h"
+#include "scenario.h"
+
+static struct sim_maze maze;
+
+/**
+ * @brief Host monotonic clock, in seconds.
+ */
+static double wall_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Stop the emulated ticks, whichever the mode.
+ */
+static void stop_ticks(void)
+{
+	host_stop_realtime();
+	host_stop_lockstep();
+}
+
+/**
+ * @brief Simulate an exploration or a speed run.
+ *
+ * The same steps as in `configure_speed()` are executed, skipping the user
+ * interaction. The mouse is placed at the start first, which resets the
+ * simulated traveled distance and visited cells.
+ *
+ * @param[in] do_run Whether the robot should be running.
+ * @param[in] force Force to apply to the tires.
+ * @param[in] time_scale Simulated time speed relative to real time, or `0` to
+ * emulate the ticks in lockstep.
+ * @param[out] duration Simulated duration, in seconds.
+ * @return Whether the mouse finished without collisions.
+ */
+static bool simulate_phase(bool do_run, float force, float time_scale,
+			   double *duration)
+{
+	uint32_t start_ticks;
+	bool collision;
+
+	stop_ticks();
+	physics_reset(&maze);
+	if (time_scale)
+		host_start_realtime(time_scale);
+	else
+		host_start_lockstep();
+	kinematic_configuration(force, do_run);
+	reset_motion();
+	disable_walls_control();
+	calibrate();
+	enable_motor_control();
+	set_starting_position();
+
+	start_ticks = host_get_ticks();
+	if (!do_run)
+		explore(force);
+	else
+		run(force);
+	collision = collision_detected();
+	reset_motion();
+
+	*duration =
+	    (double)(host_get_ticks() - start_ticks) / SYSTICK_FREQUENCY_HZ;
+	return !(collision || physics_get_state().crashed);
+}
+
+/**
+ * @brief Explore a maze, solve it and speed run it.
+ *
+ * The firmware must be set up and the SysTick interruption enabled. The maze
+ * knowledge from previous scenarios is discarded first. Result status is
+ * `ok`, `invalid` (not a valid maze file), `explore_collision` or
+ * `run_collision`. The ticks are stopped while the run sequence is computed,
+ * so the decision time only accounts for the solver.
+ *
+ * @param[in] path Maze file path.
+ * @param[in] force Force to apply to the tires.
+ * @param[in] time_scale Simulated time speed relative to real time, or `0` to
+ * emulate the ticks in lockstep.
+ * @param[out] result Scenario results.
+ */
+void scenario_run(const char *path, float force, float time_scale,
+		  struct scenario_result *result)
+{
+	double start;
+
+	memset(result, 0, sizeof(*result));
+	if (sim_maze_load(path, &maze) || maze.size * maze.size != MAZE_AREA) {
+		strcpy(result->status, "invalid");
+		return;
+	}
+
+	reset_maze();
+	set_search_initial_direction(NORTH);
+	set_goal_classic();
+	set_target_goal();
+	strcpy(result->status, "explore_collision");
+	if (!simulate_phase(false, force, time_scale, &result->explore_time))
+		return;
+	result->cells_explored = physics_get_state().visited_cells;
+
+	stop_ticks();
+	start = wall_clock();
+	set_run_sequence();
+	result->decision_time = wall_clock() - start;
+
+	strcpy(result->status, "run_collision");
+	if (!simulate_phase(true, force, time_scale, &result->run_time))
+		return;
+	result->path_length = physics_get_state().traveled_distance;
+	strcpy(result->status, "ok");
+}
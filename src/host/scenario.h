@@ -0,0 +1,24 @@
+#ifndef __HOST_SCENARIO_H
+#define __HOST_SCENARIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Results of a simulated exploration and speed run in a maze.
+ *
+ * Times are in seconds and lengths in meters.
+ */
+struct scenario_result {
+	char status[20];
+	double explore_time;
+	uint32_t cells_explored;
+	double decision_time;
+	double run_time;
+	double path_length;
+};
+
+void scenario_run(const char *path, float force, float time_scale,
+		  struct scenario_result *result);
+
+#endif /* __HOST_SCENARIO_H */
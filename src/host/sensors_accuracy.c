@@ -0,0 +1,46 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "detection.h"
+
+/** Step of the logarithm conversion table */
+#define LOG_STEP 4
+
+/** Table values are rounded to 4 decimals */
+#define LOG_TOLERANCE 0.0001
+
+/**
+ * @brief Check the sensors logarithm conversion table against `log()`.
+ *
+ * Every possible difference between the readings with the emitter on and off
+ * is converted with `sensors_raw_log()`, and compared with the floating point
+ * logarithm of the difference rounded down to the table step. The maximum
+ * error is reported. The error against the logarithm of the actual
+ * difference, which includes the table quantization, is reported as well.
+ */
+int main(void)
+{
+	float log_error = 0.;
+	float quantization_error = 0.;
+	float log;
+	float error;
+	uint16_t diff;
+
+	for (diff = LOG_STEP; diff < ADC_RESOLUTION; diff++) {
+		log = sensors_raw_log(diff, 0);
+		error = fabsf(log - logf(diff - diff % LOG_STEP));
+		if (error > log_error)
+			log_error = error;
+		error = fabsf(log - logf(diff));
+		if (error > quantization_error)
+			quantization_error = error;
+	}
+
+	printf("log max error: %f (tolerance %f)\n", log_error, LOG_TOLERANCE);
+	printf("log max error with quantization: %f\n", quantization_error);
+
+	if (log_error > LOG_TOLERANCE)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
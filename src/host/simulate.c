@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mmlib/calibration.h"
+#include "mmlib/control.h"
+#include "mmlib/move.h"
+#include "mmlib/search.h"
+#include "mmlib/solve.h"
+#include "mmlib/speed.h"
+#include "mmlib/walls.h"
+
+#include "setup.h"
+
+#include "hal.h"
+#include "maze.h"
+#include "physics.h"
+
+#define DEFAULT_FORCE 0.25
+
+static struct sim_maze maze;
+static float time_scale;
+
+/**
+ * @brief Host monotonic clock, in seconds.
+ */
+static double wall_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Place the mouse at the start, as the user would before moving.
+ *
+ * Ticks are stopped while the simulation is reset, so that it is never
+ * updated halfway. They are emulated in lockstep unless a time scale is set.
+ */
+static void place_at_start(void)
+{
+	host_stop_realtime();
+	host_stop_lockstep();
+	physics_reset(&maze);
+	if (time_scale)
+		host_start_realtime(time_scale);
+	else
+		host_start_lockstep();
+}
+
+/**
+ * @brief Simulate an exploration or a run and report its duration.
+ *
+ * The same steps as in `configure_speed()` are executed, skipping the user
+ * interaction.
+ *
+ * @param[in] do_run Whether the robot should be running.
+ * @param[in] force Force to apply to the tires.
+ * @return Whether the mouse reached the end without collisions.
+ */
+static bool simulate(bool do_run, float force)
+{
+	struct physics_state state;
+	uint32_t start_ticks;
+	double start;
+	bool collision;
+
+	place_at_start();
+	kinematic_configuration(force, do_run);
+	reset_motion();
+	disable_walls_control();
+	calibrate();
+	enable_motor_control();
+	set_starting_position();
+
+	start_ticks = host_get_ticks();
+	start = wall_clock();
+	if (!do_run) {
+		explore(force);
+		set_run_sequence();
+	} else {
+		run(force);
+	}
+	collision = collision_detected();
+	reset_motion();
+
+	state = physics_get_state();
+	printf("%s: %.3f s simulated, %.3f s wall-clock",
+	       do_run ? "run" : "explore",
+	       (double)(host_get_ticks() - start_ticks) / SYSTICK_FREQUENCY_HZ,
+	       wall_clock() - start);
+	if (collision || state.crashed)
+		printf(" (collision at x=%.3f y=%.3f)", state.x, state.y);
+	printf("\n");
+	return !(collision || state.crashed);
+}
+
+/**
+ * @brief Simulate an exploration followed by a run in a maze.
+ *
+ * Usage: `simulate [-s TIME_SCALE] [-f FORCE] MAZE_FILE`
+ *
+ * The firmware is executed against the physics simulation in lockstep (see
+ * `host_start_lockstep()`), so results are mostly reproducible, or at
+ * `TIME_SCALE` times real time if given. Simulated and wall-clock durations
+ * are reported for each phase. Firmware serial output is discarded.
+ */
+int main(int argc, char *argv[])
+{
+	float force = DEFAULT_FORCE;
+	const char *path = NULL;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			time_scale = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			force = atof(argv[++i]);
+		else
+			path = argv[i];
+	}
+	if (!path || time_scale < 0.) {
+		fprintf(stderr, "Usage: %s [-s TIME_SCALE] [-f FORCE] MAZE\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (sim_maze_load(path, &maze) || maze.size * maze.size != MAZE_AREA) {
+		fprintf(stderr, "Unable to load a %d cells maze from %s\n",
+			MAZE_AREA, path);
+		return EXIT_FAILURE;
+	}
+
+	host_set_serial_output(-1);
+	place_at_start();
+	setup();
+	systick_interrupt_enable();
+
+	set_search_initial_direction(NORTH);
+	set_goal_classic();
+	set_target_goal();
+	if (!simulate(false, force))
+		return EXIT_FAILURE;
+	if (!simulate(true, force))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -1,3 +1,5 @@
+#include <libopencm3/cm3/cortex.h>
+
 #include "mmlib/calibration.h"
 #include "mmlib/clock.h"
 #include "mmlib/command.h"
@@ -11,22 +13,124 @@
 #include "mmlib/speed.h"
 #include "mmlib/walls.h"
 
+#include "capture.h"
+#include "collision.h"
+#include "detection.h"
 #include "eeprom.h"
+#include "maze_store.h"
 #include "motor.h"
+#include "profiling.h"
+#include "replay.h"
 #include "setup.h"
+#include "telemetry.h"
+#include "tuning.h"
 #include "voltage.h"
 
+#define CLOCK_DECIMATION (SYSTICK_FREQUENCY_HZ / CLOCK_FREQUENCY_HZ)
+#define DISTANCE_DECIMATION (SYSTICK_FREQUENCY_HZ / DISTANCE_FREQUENCY_HZ)
+#define LOG_DECIMATION (SYSTICK_FREQUENCY_HZ / LOG_FREQUENCY_HZ)
+#define BATTERY_DECIMATION (SYSTICK_FREQUENCY_HZ / BATTERY_FREQUENCY_HZ)
+#define CHECKPOINT_DECIMATION                                                  \
+	(SYSTICK_FREQUENCY_HZ / MAZE_CHECKPOINT_FREQUENCY_HZ)
+
+#if SYSTICK_FREQUENCY_HZ % CLOCK_FREQUENCY_HZ ||                               \
+    SYSTICK_FREQUENCY_HZ % DISTANCE_FREQUENCY_HZ ||                            \
+    SYSTICK_FREQUENCY_HZ % LOG_FREQUENCY_HZ ||                                 \
+    SYSTICK_FREQUENCY_HZ % BATTERY_FREQUENCY_HZ ||                             \
+    SYSTICK_FREQUENCY_HZ % MAZE_CHECKPOINT_FREQUENCY_HZ
+#error "Decimated stages frequencies must divide SYSTICK_FREQUENCY_HZ"
+#endif
+
+static volatile bool checkpointing;
+
+/**
+ * @brief Whether a decimated stage must be executed on a given tick.
+ *
+ * @param[in] tick SysTick handler execution count.
+ * @param[in] decimation Number of ticks between executions of the stage.
+ * @param[in] phase Tick, within the decimation period, on which the stage is
+ * executed.
+ */
+static bool scheduled(uint32_t tick, uint32_t decimation, uint32_t phase)
+{
+	return tick % decimation == phase % decimation;
+}
+
+/**
+ * @brief Save a maze checkpoint, without waiting for the flash writes.
+ */
+static void checkpoint_maze(void)
+{
+	maze_store_set_checkpoint(true);
+	save_maze();
+	maze_store_set_checkpoint(false);
+}
+
 /**
  * @brief Handle the SysTick interruptions.
+ *
+ * Gyroscope and encoders readings and motor control are executed on every
+ * tick, while the clock, the distance processing, the battery sampling and
+ * the logging are decimated (see `SYSTICK_FREQUENCY_HZ`). Logging is executed
+ * half a period away from the distance processing to spread the load among
+ * ticks. While exploring, the maze is checkpointed too (see
+ * `MAZE_CHECKPOINT_FREQUENCY_HZ`).
+ *
+ * The MPU registers are read with DMA first thing, so the transfer overlaps
+ * with the clock and distance stages and the gyroscope readings do not wait
+ * for SPI transactions.
+ *
+ * When the collision detector reports a collision, the motor control is
+ * disabled and the motors are stopped, as when the motor control detects a
+ * saturation itself.
+ *
+ * Every executed stage is profiled (see `execute_profiling_command()`).
  */
 void sys_tick_handler(void)
 {
-	clock_tick();
-	update_distance_readings();
+	static uint32_t tick;
+
+	profiling_tick_start();
+	replay_tick_start();
+	mpu_start_burst_read();
+	profiling_stage_end(PROFILING_MPU);
+	if (scheduled(tick, CLOCK_DECIMATION, 0)) {
+		clock_tick();
+		profiling_stage_end(PROFILING_CLOCK);
+	}
+	if (scheduled(tick, DISTANCE_DECIMATION, 0)) {
+		update_distance_readings();
+		profiling_stage_end(PROFILING_DISTANCE);
+	}
+	if (scheduled(tick, BATTERY_DECIMATION, 0)) {
+		update_battery_voltage();
+		profiling_stage_end(PROFILING_BATTERY);
+	}
 	update_gyro_readings();
+	mpu_end_burst_read();
+	profiling_stage_end(PROFILING_GYRO);
 	update_encoder_readings();
+	profiling_stage_end(PROFILING_ENCODER);
+	begin_motor_update();
 	motor_control();
-	log_data();
+	commit_motor_update();
+	replay_tick_end();
+	if (update_collision_detector()) {
+		disable_motor_control();
+		drive_off();
+	}
+	capture_tick();
+	profiling_stage_end(PROFILING_MOTOR);
+	if (scheduled(tick, LOG_DECIMATION, LOG_DECIMATION / 2)) {
+		log_data();
+		profiling_stage_end(PROFILING_LOG);
+	}
+	if (checkpointing && scheduled(tick, CHECKPOINT_DECIMATION, 1)) {
+		checkpoint_maze();
+		profiling_stage_end(PROFILING_CHECKPOINT);
+	}
+	profiling_tick_end();
+	tick++;
 }
 
 /**
@@ -49,9 +153,17 @@ static void check_battery_voltage(void)
 
 /**
  * @brief Includes the functions to be executed before robot starts to move.
+ *
+ * The selected tuning profile is saved first, while the robot is still.
+ * When recording for replay, the recording starts along with the motor
+ * control, so the first recorded tick is the first controlled one.
+ *
+ * @param[in] force Force of the movements.
+ * @param[in] run Whether the movements are a run instead of an exploration.
  */
-static void before_moving(void)
+static void before_moving(float force, bool run)
 {
+	tuning_save_selection();
 	reset_motion();
 	disable_walls_control();
 	repeat_blink(10, 100);
@@ -65,9 +177,15 @@ static void before_moving(void)
 	led_left_off();
 	led_right_off();
 	sleep_us(2000000);
+	mpu_resynchronize_fifo();
 	calibrate();
+	reset_collision_detector();
+	cm_disable_interrupts();
+	if (REPLAY_RECORDING)
+		replay_start_recording(force, run);
 	enable_motor_control();
 	set_starting_position();
+	cm_enable_interrupts();
 }
 
 /**
@@ -76,7 +194,8 @@ static void before_moving(void)
 static void after_moving(void)
 {
 	reset_motion();
-	if (collision_detected())
+	log_collision_report();
+	if (collision_detected() || collision_reported())
 		blink_collision();
 	else
 		speaker_play_success();
@@ -88,7 +207,10 @@ static void after_moving(void)
  *
  * The user selects the force to apply to the tires while exploring or running.
  *
- * Data logging is always active during movement phase.
+ * Data logging (or replay recording, see `REPLAY_RECORDING`) is always active
+ * during movement phase. The capture is stopped as soon as the exploration or
+ * the speed run ends, so it keeps their last records and not the idle ones
+ * taken afterwards.
  *
  * @param[in] run Whether the robot should be running.
  */
@@ -99,18 +221,26 @@ static void configure_speed(bool do_run)
 	force = hmi_configure_force(0.1, 0.05);
 	kinematic_configuration(force, do_run);
 
-	start_data_logging(log_data_control);
-	before_moving();
+	if (!REPLAY_RECORDING)
+		start_data_logging(log_telemetry_control);
+	capture_start();
+	before_moving(force, do_run);
 	if (!do_run) {
+		checkpointing = true;
 		explore(force);
+		checkpointing = false;
+		capture_stop();
 		set_run_sequence();
 		save_maze();
 	} else {
 		run(force);
+		capture_stop();
 		run_back(force);
 	}
 	after_moving();
 	stop_data_logging();
+	replay_stop_recording();
+	capture_dump();
 }
 
 /**
@@ -164,23 +294,48 @@ static void configure_start(void)
 	}
 }
 
+/**
+ * @brief Select the next tuning profile, blinking its number.
+ */
+static void configure_tuning(void)
+{
+	tuning_select_next();
+	repeat_blink(tuning_get_selected() + 1, 200);
+}
+
 /**
  * @brief Initial setup and infinite wait.
+ *
+ * A short button press starts the configuration process, while a long press
+ * selects the next tuning profile.
+ *
+ * Each received command is offered to the command handlers in order, so it
+ * is executed by the one it belongs to, no matter when it is completed.
  */
 int main(void)
 {
 	setup();
+	tuning_load();
 	kinematic_configuration(0.25, false);
 	systick_interrupt_enable();
 	while (1) {
+		mpu_resynchronize_fifo();
 		switch (button_user_response()) {
 		case BUTTON_NONE:
 			break;
+		case BUTTON_LONG:
+			configure_tuning();
+			break;
 		default:
 			configure_start();
 			break;
 		}
-		execute_command();
+		if (!get_received_command_flag())
+			continue;
+		if (!execute_profiling_command() && !execute_tuning_command() &&
+		    !execute_capture_command() && !execute_motor_command() &&
+		    !execute_sensors_command())
+			execute_command();
 	}
 
 	return 0;
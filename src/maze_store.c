@@ -0,0 +1,344 @@
+#include "maze_store.h"
+
+#define PAGE_MAGIC 0x314A5A4D
+#define RECORD_ERASED 0xFFFF
+
+/**
+ * Journal page layout: header, snapshot of the whole maze, snapshot CRC (and
+ * padding) and records.
+ */
+#define SNAPSHOT_OFFSET (sizeof(struct page_header))
+#define RECORDS_OFFSET                                                         \
+	(SNAPSHOT_OFFSET + MAZE_STORE_SIZE + 2 * sizeof(uint16_t))
+#define RECORDS_PER_PAGE                                                       \
+	((FLASH_EEPROM_PAGE_SIZE - RECORDS_OFFSET) / sizeof(struct record))
+
+/**
+ * Journal page header.
+ *
+ * It is programmed after the snapshot, so a page with a valid magic number
+ * always contains a complete snapshot.
+ */
+struct page_header {
+	uint32_t sequence;
+	uint32_t magic;
+};
+
+/**
+ * Journal record, appended for every changed cell.
+ *
+ * The CRC is programmed last, so interrupted writes are detected.
+ */
+struct record {
+	uint16_t offset;
+	uint16_t sequence;
+	uint16_t value;
+	uint16_t crc;
+};
+
+static uint8_t image[MAZE_STORE_SIZE];
+static bool mounted;
+static uint8_t page;
+static uint32_t page_sequence;
+static uint16_t next_record;
+static uint16_t record_sequence;
+static uint32_t last_ticket;
+static bool checkpoint;
+
+/*
+ * Data being written asynchronously, which must remain unchanged until the
+ * writes complete.
+ */
+static uint8_t snapshot[MAZE_STORE_SIZE + sizeof(uint16_t)];
+static struct page_header header;
+static struct record records[RECORDS_PER_PAGE];
+
+/**
+ * @brief Return the address of a journal page.
+ */
+static uint32_t page_address(uint8_t index)
+{
+	return FLASH_EEPROM_ADDRESS_MAZE + index * FLASH_EEPROM_PAGE_SIZE;
+}
+
+/**
+ * @brief Return the address of a journal record.
+ */
+static uint32_t record_address(uint8_t index, uint16_t record)
+{
+	return page_address(index) + RECORDS_OFFSET +
+	       record * sizeof(struct record);
+}
+
+/**
+ * @brief Queue an asynchronous write, waiting for room in the queue.
+ */
+static void program(uint32_t address, const void *data, uint16_t num_bytes,
+		    bool erase)
+{
+	uint32_t ticket;
+
+	do {
+		if (erase)
+			ticket = eeprom_flash_page_async(address, data,
+							 num_bytes);
+		else
+			ticket = eeprom_program_async(address, data,
+						      num_bytes);
+	} while (!ticket);
+	last_ticket = ticket;
+}
+
+/**
+ * @brief Check whether a page contains a valid header and snapshot.
+ *
+ * @param[in] index Page index.
+ * @param[out] sequence Page sequence number.
+ */
+static bool page_is_valid(uint8_t index, uint32_t *sequence)
+{
+	const struct page_header *header =
+	    (const struct page_header *)(uintptr_t)page_address(index);
+	const uint8_t *snapshot =
+	    (const uint8_t *)(page_address(index) + SNAPSHOT_OFFSET);
+	uint16_t crc;
+
+	if (header->magic != PAGE_MAGIC)
+		return false;
+	memcpy(&crc, snapshot + MAZE_STORE_SIZE, sizeof(crc));
+	if (crc != crc16(CRC16_INIT, snapshot, MAZE_STORE_SIZE))
+		return false;
+	*sequence = header->sequence;
+	return true;
+}
+
+/**
+ * @brief Load the snapshot of a page and replay its records.
+ *
+ * Replay stops on the first erased record or on a sequence gap. Records with
+ * a wrong CRC (interrupted writes) are skipped.
+ *
+ * After a sequence gap, the slots that follow are already programmed, so the
+ * page is considered full and the next save starts a new page.
+ */
+static void replay(uint8_t index)
+{
+	const struct record *record;
+	bool first = true;
+	uint16_t i;
+
+	memcpy(image, (const uint8_t *)(page_address(index) + SNAPSHOT_OFFSET),
+	       MAZE_STORE_SIZE);
+	for (i = 0; i < RECORDS_PER_PAGE; i++) {
+		record =
+		    (const struct record *)(uintptr_t)record_address(index, i);
+		if (record->offset == RECORD_ERASED &&
+		    record->sequence == RECORD_ERASED &&
+		    record->value == RECORD_ERASED &&
+		    record->crc == RECORD_ERASED)
+			break;
+		if (record->crc !=
+		    crc16(CRC16_INIT, record, offsetof(struct record, crc)))
+			continue;
+		if (!first &&
+		    record->sequence != (uint16_t)(record_sequence + 1)) {
+			i = RECORDS_PER_PAGE;
+			break;
+		}
+		if (record->offset < MAZE_STORE_SIZE)
+			image[record->offset] = (uint8_t)record->value;
+		record_sequence = record->sequence;
+		first = false;
+	}
+	next_record = i;
+}
+
+/**
+ * @brief Mount the journal, recovering the latest stored maze.
+ *
+ * The valid page with the highest sequence number is the current one. Its
+ * snapshot is loaded and its records replayed. If there is no valid page,
+ * the maze is considered erased and the next write starts a new page.
+ */
+static void mount(void)
+{
+	uint32_t sequence;
+	bool found = false;
+	uint8_t i;
+
+	mounted = true;
+	for (i = 0; i < FLASH_EEPROM_MAZE_PAGES; i++) {
+		if (!page_is_valid(i, &sequence))
+			continue;
+		if (found && (int32_t)(sequence - page_sequence) <= 0)
+			continue;
+		found = true;
+		page = i;
+		page_sequence = sequence;
+	}
+	if (!found) {
+		memset(image, 0xFF, MAZE_STORE_SIZE);
+		page = FLASH_EEPROM_MAZE_PAGES - 1;
+		next_record = RECORDS_PER_PAGE;
+		return;
+	}
+	replay(page);
+}
+
+/**
+ * @brief Start a new journal page with a snapshot of the current image.
+ *
+ * Pages are used in a round-robin fashion, so erases are evenly distributed
+ * among them. This is the only operation requiring a page erase.
+ *
+ * The buffers are reused, so pending writes are completed first. Then the
+ * page erase and snapshot writes are queued, followed by the header.
+ *
+ * @note The page is not erased with `eeprom_erase_page()`, as it redirects
+ * the maze pages to `maze_store_reset()`.
+ */
+static void rotate(void)
+{
+	uint8_t index = (page + 1) % FLASH_EEPROM_MAZE_PAGES;
+	uint32_t address = page_address(index);
+	uint16_t crc = crc16(CRC16_INIT, image, MAZE_STORE_SIZE);
+
+	eeprom_wait_writes();
+	memcpy(snapshot, image, MAZE_STORE_SIZE);
+	memcpy(snapshot + MAZE_STORE_SIZE, &crc, sizeof(crc));
+	header.sequence = page_sequence + 1;
+	header.magic = PAGE_MAGIC;
+	program(address + SNAPSHOT_OFFSET, snapshot, sizeof(snapshot), true);
+	program(address, &header, sizeof(header), false);
+	page = index;
+	page_sequence = header.sequence;
+	next_record = 0;
+}
+
+/**
+ * @brief Stage a record for a changed cell in the current page.
+ */
+static void append(uint16_t offset, uint8_t value)
+{
+	struct record *record = &records[next_record++];
+
+	record->offset = offset;
+	record->sequence = ++record_sequence;
+	record->value = value;
+	record->crc = crc16(CRC16_INIT, record, offsetof(struct record, crc));
+	image[offset] = value;
+}
+
+/**
+ * @brief Save the maze, appending only the changed cells to the journal.
+ *
+ * If the changes do not fit in the current page, a new page is started with
+ * a snapshot of the whole maze instead.
+ *
+ * Flash is written asynchronously, so this function does not wait for the
+ * writes to complete (see `maze_store_get_status()`). The saved maze can be
+ * loaded back immediately, though.
+ *
+ * While checkpointing (see `maze_store_set_checkpoint()`), nothing is saved
+ * if previous writes are still pending or if the changes do not fit in the
+ * current page, so the caller never waits and no page is erased.
+ *
+ * @param[in] data Maze to save.
+ * @param[in] num_bytes Size of the maze, up to `MAZE_STORE_SIZE`.
+ * @return `RESULT_OK`, as the writes are only queued, `EEPROM_DATA_TOO_LARGE`
+ * if the maze does not fit or `EEPROM_WRITE_PENDING` if a checkpoint was
+ * skipped (nothing is saved then).
+ */
+uint32_t maze_store_save(const uint8_t *data, uint16_t num_bytes)
+{
+	uint16_t first = next_record;
+	uint16_t changes = 0;
+	uint16_t i;
+
+	if (num_bytes > MAZE_STORE_SIZE)
+		return EEPROM_DATA_TOO_LARGE;
+	if (checkpoint && eeprom_writes_pending())
+		return EEPROM_WRITE_PENDING;
+	if (!mounted)
+		mount();
+	for (i = 0; i < num_bytes; i++)
+		changes += data[i] != image[i];
+	if (!changes)
+		return RESULT_OK;
+
+	if (changes > RECORDS_PER_PAGE - next_record) {
+		if (checkpoint)
+			return EEPROM_WRITE_PENDING;
+		memcpy(image, data, num_bytes);
+		rotate();
+		return RESULT_OK;
+	}
+	for (i = 0; i < num_bytes; i++) {
+		if (data[i] != image[i])
+			append(i, data[i]);
+	}
+	program(record_address(page, first), &records[first],
+		changes * sizeof(struct record), false);
+	return RESULT_OK;
+}
+
+/**
+ * @brief Enable or disable the checkpoint mode of `maze_store_save()`.
+ *
+ * Checkpoints can be saved from an interruption with a higher priority than
+ * the flash interruption, as they never wait for the writes to complete.
+ * They must not preempt other maze store calls.
+ *
+ * @param[in] enabled Whether the next saves are checkpoints.
+ */
+void maze_store_set_checkpoint(bool enabled)
+{
+	checkpoint = enabled;
+}
+
+/**
+ * @brief Load the latest saved maze.
+ *
+ * Bytes beyond `MAZE_STORE_SIZE` are read as erased flash.
+ *
+ * @param[out] data Buffer to save the maze to.
+ * @param[in] num_bytes Size of the maze.
+ */
+void maze_store_load(uint8_t *data, uint16_t num_bytes)
+{
+	if (!mounted)
+		mount();
+	memset(data, 0xFF, num_bytes);
+	if (num_bytes > MAZE_STORE_SIZE)
+		num_bytes = MAZE_STORE_SIZE;
+	memcpy(data, image, num_bytes);
+}
+
+/**
+ * @brief Erase the saved maze.
+ *
+ * A new page is started with an erased snapshot.
+ *
+ * @return `RESULT_OK`, as the writes are only queued.
+ */
+uint32_t maze_store_reset(void)
+{
+	if (!mounted)
+		mount();
+	memset(image, 0xFF, MAZE_STORE_SIZE);
+	rotate();
+	return RESULT_OK;
+}
+
+/**
+ * @brief Get the state of the last maze store write.
+ *
+ * @return `EEPROM_WRITE_PENDING` while writes are in progress, or the flash
+ * state of the last write.
+ */
+uint32_t maze_store_get_status(void)
+{
+	if (!last_ticket)
+		return RESULT_OK;
+	return eeprom_get_write_status(last_ticket);
+}
@@ -0,0 +1,24 @@
+#ifndef __MAZE_STORE_H
+#define __MAZE_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libopencm3/stm32/flash.h>
+
+#include "crc.h"
+#include "eeprom.h"
+#include "setup.h"
+
+/** Size of the stored maze (one byte per cell) */
+#define MAZE_STORE_SIZE 256
+
+uint32_t maze_store_save(const uint8_t *data, uint16_t num_bytes);
+void maze_store_set_checkpoint(bool enabled);
+void maze_store_load(uint8_t *data, uint16_t num_bytes);
+uint32_t maze_store_reset(void);
+uint32_t maze_store_get_status(void);
+
+#endif /* __MAZE_STORE_H */
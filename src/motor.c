@@ -1,7 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmlib/logging.h"
+
 #include "motor.h"
+#include "serial.h"
 
 static volatile uint32_t saturated_left;
 static volatile uint32_t saturated_right;
+static volatile bool active;
+static volatile int32_t power_left_command;
+static volatile int32_t power_right_command;
+static volatile uint32_t updates_nesting;
+
+/**
+ * @brief Start staging the motor driver compare values.
+ *
+ * TIM3 update events are disabled, so the preloaded compare values written
+ * until `commit_motor_update()` is called are not transferred to the active
+ * registers. That way, both motors outputs are applied on the same PWM
+ * period.
+ *
+ * Calls can be nested (i.e.: `power_left()` within `motor_control()`), and
+ * they can be interrupted by a nested pair too: update events are only
+ * enabled again when the outermost update is committed.
+ */
+void begin_motor_update(void)
+{
+	updates_nesting++;
+	timer_disable_update_event(TIM3);
+}
+
+/**
+ * @brief Commit the staged motor driver compare values.
+ *
+ * They are applied on the next TIM3 update event, all at once.
+ */
+void commit_motor_update(void)
+{
+	if (--updates_nesting == 0)
+		timer_enable_update_event(TIM3);
+}
+
+/**
+ * @brief Set a motor driver compare value.
+ *
+ * The value is scaled from `DRIVER_PWM_PERIOD` to the current PWM period, so
+ * the power does not depend on the PWM frequency.
+ */
+static void set_compare(enum tim_oc_id oc_id, uint32_t value)
+{
+	timer_set_oc_value(TIM3, oc_id,
+			   value * TIM_ARR(TIM3) / DRIVER_PWM_PERIOD);
+}
+
+/**
+ * @brief Set the motor driver PWM frequency.
+ *
+ * The period is adjusted with the timer clocked at `SYSCLK_FREQUENCY_HZ`, so
+ * the frequency is limited to keep at least `DRIVER_PWM_PERIOD` steps of
+ * resolution (up to 70 kHz). Current outputs are rescaled to the new period
+ * and applied with it on the next update event.
+ *
+ * @param[in] frequency PWM frequency, in hertz.
+ */
+void set_motor_pwm_frequency(uint32_t frequency)
+{
+	uint32_t period = SYSCLK_FREQUENCY_HZ / frequency - 1;
+	uint32_t previous = TIM_ARR(TIM3);
+	enum tim_oc_id oc_ids[] = {TIM_OC1, TIM_OC2, TIM_OC3, TIM_OC4};
+	uint32_t compares[] = {TIM_CCR1(TIM3), TIM_CCR2(TIM3), TIM_CCR3(TIM3),
+			       TIM_CCR4(TIM3)};
+	int i;
+
+	if (period < DRIVER_PWM_PERIOD)
+		period = DRIVER_PWM_PERIOD;
+	if (period > UINT16_MAX)
+		period = UINT16_MAX;
+	begin_motor_update();
+	timer_set_period(TIM3, period);
+	for (i = 0; i < 4; i++)
+		timer_set_oc_value(TIM3, oc_ids[i],
+				   compares[i] * period / previous);
+	commit_motor_update();
+}
+
+/**
+ * @brief Get the motor driver PWM frequency, in hertz.
+ */
+uint32_t get_motor_pwm_frequency(void)
+{
+	return SYSCLK_FREQUENCY_HZ / (TIM_ARR(TIM3) + 1);
+}
 
 /**
  * @brief Set left motor power.
@@ -20,6 +110,7 @@ void power_left(int32_t power)
 {
 	bool forward = true;
 
+	power_left_command = power;
 	if (power < 0) {
 		power = -power;
 		forward = false;
@@ -30,13 +121,16 @@ void power_left(int32_t power)
 	} else {
 		saturated_left = 0;
 	}
+	active = true;
+	begin_motor_update();
 	if (forward) {
-		timer_set_oc_value(TIM3, TIM_OC1, MAX_PWM_PERIOD);
-		timer_set_oc_value(TIM3, TIM_OC2, MAX_PWM_PERIOD - power);
+		set_compare(TIM_OC1, MAX_PWM_PERIOD);
+		set_compare(TIM_OC2, MAX_PWM_PERIOD - power);
 	} else {
-		timer_set_oc_value(TIM3, TIM_OC1, MAX_PWM_PERIOD - power);
-		timer_set_oc_value(TIM3, TIM_OC2, MAX_PWM_PERIOD);
+		set_compare(TIM_OC1, MAX_PWM_PERIOD - power);
+		set_compare(TIM_OC2, MAX_PWM_PERIOD);
 	}
+	commit_motor_update();
 }
 
 /**
@@ -56,6 +150,7 @@ void power_right(int32_t power)
 {
 	bool forward = true;
 
+	power_right_command = power;
 	if (power < 0) {
 		power = -power;
 		forward = false;
@@ -66,13 +161,16 @@ void power_right(int32_t power)
 	} else {
 		saturated_right = 0;
 	}
+	active = true;
+	begin_motor_update();
 	if (forward) {
-		timer_set_oc_value(TIM3, TIM_OC3, MAX_PWM_PERIOD);
-		timer_set_oc_value(TIM3, TIM_OC4, MAX_PWM_PERIOD - power);
+		set_compare(TIM_OC3, MAX_PWM_PERIOD);
+		set_compare(TIM_OC4, MAX_PWM_PERIOD - power);
 	} else {
-		timer_set_oc_value(TIM3, TIM_OC3, MAX_PWM_PERIOD - power);
-		timer_set_oc_value(TIM3, TIM_OC4, MAX_PWM_PERIOD);
+		set_compare(TIM_OC3, MAX_PWM_PERIOD - power);
+		set_compare(TIM_OC4, MAX_PWM_PERIOD);
 	}
+	commit_motor_update();
 }
 
 /**
@@ -80,10 +178,15 @@ void power_right(int32_t power)
  */
 void drive_break(void)
 {
-	timer_set_oc_value(TIM3, TIM_OC1, MAX_PWM_PERIOD);
-	timer_set_oc_value(TIM3, TIM_OC2, MAX_PWM_PERIOD);
-	timer_set_oc_value(TIM3, TIM_OC3, MAX_PWM_PERIOD);
-	timer_set_oc_value(TIM3, TIM_OC4, MAX_PWM_PERIOD);
+	active = false;
+	power_left_command = 0;
+	power_right_command = 0;
+	begin_motor_update();
+	set_compare(TIM_OC1, MAX_PWM_PERIOD);
+	set_compare(TIM_OC2, MAX_PWM_PERIOD);
+	set_compare(TIM_OC3, MAX_PWM_PERIOD);
+	set_compare(TIM_OC4, MAX_PWM_PERIOD);
+	commit_motor_update();
 }
 
 /**
@@ -91,10 +194,52 @@ void drive_break(void)
  */
 void drive_off(void)
 {
-	timer_set_oc_value(TIM3, TIM_OC1, 0);
-	timer_set_oc_value(TIM3, TIM_OC2, 0);
-	timer_set_oc_value(TIM3, TIM_OC3, 0);
-	timer_set_oc_value(TIM3, TIM_OC4, 0);
+	active = false;
+	power_left_command = 0;
+	power_right_command = 0;
+	begin_motor_update();
+	set_compare(TIM_OC1, 0);
+	set_compare(TIM_OC2, 0);
+	set_compare(TIM_OC3, 0);
+	set_compare(TIM_OC4, 0);
+	commit_motor_update();
+}
+
+/**
+ * @brief Get the last power commanded to the left motor.
+ *
+ * The value is the one received by `power_left()`, before saturation, or 0
+ * after breaking or disabling the motor driver.
+ */
+int32_t get_left_power(void)
+{
+	return power_left_command;
+}
+
+/**
+ * @brief Get the last power commanded to the right motor.
+ *
+ * See `get_left_power()`.
+ */
+int32_t get_right_power(void)
+{
+	return power_right_command;
+}
+
+/**
+ * @brief Whether the last output of either motor was saturated.
+ */
+bool motor_driver_saturated(void)
+{
+	return saturated_left || saturated_right;
+}
+
+/**
+ * @brief Whether the motors are being driven (not braking nor coasting).
+ */
+bool motor_driver_active(void)
+{
+	return active;
 }
 
 /**
@@ -115,3 +260,37 @@ void reset_motor_driver_saturation(void)
 	saturated_left = 0;
 	saturated_right = 0;
 }
+
+/**
+ * @brief Execute the received command if it is a motor command.
+ *
+ * - `pwm_frequency`: log the motor driver PWM frequency.
+ * - `pwm_frequency HZ`: set the motor driver PWM frequency (see
+ *   `set_motor_pwm_frequency()`).
+ *
+ * Other commands are left for `execute_command()`.
+ *
+ * @return Whether a motor command was executed.
+ */
+bool execute_motor_command(void)
+{
+	char *command;
+	char *end;
+	long frequency;
+
+	if (!get_received_command_flag())
+		return false;
+	command = get_received_serial_buffer();
+	if (!strncmp(command, "pwm_frequency ", 14)) {
+		frequency = strtol(command + 14, &end, 10);
+		if (end == command + 14 || *end || frequency <= 0)
+			LOG_ERROR("Invalid PWM frequency");
+		else
+			set_motor_pwm_frequency((uint32_t)frequency);
+	} else if (strcmp(command, "pwm_frequency")) {
+		return false;
+	}
+	LOG_INFO("PWM frequency: %u Hz", get_motor_pwm_frequency());
+	set_received_command_flag(false);
+	return true;
+}
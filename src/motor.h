@@ -6,11 +6,20 @@
 
 #include "setup.h"
 
+void begin_motor_update(void);
+void commit_motor_update(void);
+void set_motor_pwm_frequency(uint32_t frequency);
+uint32_t get_motor_pwm_frequency(void);
 void drive_break(void);
 void drive_off(void);
 void power_left(int32_t power);
 void power_right(int32_t power);
+int32_t get_left_power(void);
+int32_t get_right_power(void);
+bool motor_driver_saturated(void);
+bool motor_driver_active(void);
 uint32_t motor_driver_saturation(void);
 void reset_motor_driver_saturation(void);
+bool execute_motor_command(void);
 
 #endif /* __MOTOR_H */
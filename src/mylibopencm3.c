@@ -78,3 +78,72 @@ void usart_clear_idle_line_detected(uint32_t usart)
 	USART_SR(usart);
 	USART_DR(usart);
 }
+
+/**
+ * @brief Enable flash interrupts.
+ *
+ * @param[in] interrupts Interrupts to enable (`FLASH_CR_EOPIE` and/or
+ * `FLASH_CR_ERRIE`).
+ *
+ * @see Programming Manual (PM0075): Flash control register (FLASH_CR).
+ */
+void flash_enable_interrupts(uint32_t interrupts)
+{
+	FLASH_CR |= interrupts;
+}
+
+/**
+ * @brief Disable flash interrupts.
+ *
+ * @param[in] interrupts Interrupts to disable (`FLASH_CR_EOPIE` and/or
+ * `FLASH_CR_ERRIE`).
+ */
+void flash_disable_interrupts(uint32_t interrupts)
+{
+	FLASH_CR &= ~interrupts;
+}
+
+/**
+ * @brief Start erasing a flash page, without waiting for completion.
+ *
+ * Unlike `flash_erase_page()`, this function returns while the flash is busy.
+ * Completion is signaled with the end of operation flag.
+ *
+ * @param[in] page_address Address of the page to erase.
+ *
+ * @see Programming Manual (PM0075): Page Erase.
+ */
+void flash_start_erase_page(uint32_t page_address)
+{
+	FLASH_CR |= FLASH_CR_PER;
+	FLASH_AR = page_address;
+	FLASH_CR |= FLASH_CR_STRT;
+}
+
+/**
+ * @brief Start programming a half word, without waiting for completion.
+ *
+ * Unlike `flash_program_half_word()`, this function returns while the flash
+ * is busy. Completion is signaled with the end of operation flag.
+ *
+ * @param[in] address Address to program, aligned to a half word.
+ * @param[in] data Half word to program.
+ *
+ * @see Programming Manual (PM0075): Main Flash memory programming.
+ */
+void flash_start_program_half_word(uint32_t address, uint16_t data)
+{
+	FLASH_CR |= FLASH_CR_PG;
+	MMIO16(address) = data;
+}
+
+/**
+ * @brief Clear the operation bits after a flash operation has completed.
+ *
+ * Must be called after `flash_start_erase_page()` or
+ * `flash_start_program_half_word()`, before starting a different operation.
+ */
+void flash_end_operation(void)
+{
+	FLASH_CR &= ~(FLASH_CR_PG | FLASH_CR_PER);
+}
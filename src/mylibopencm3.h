@@ -2,6 +2,7 @@
 #define __MYLIBOPENCM3_H
 
 #include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/flash.h>
 #include <libopencm3/stm32/usart.h>
 
 bool adc_get_flag(uint32_t adc_peripheral, uint32_t flag);
@@ -10,5 +11,10 @@ void usart_enable_idle_line_interrupt(uint32_t usart);
 void usart_disable_idle_line_interrupt(uint32_t usart);
 bool usart_idle_line_detected(uint32_t usart);
 void usart_clear_idle_line_detected(uint32_t usart);
+void flash_enable_interrupts(uint32_t interrupts);
+void flash_disable_interrupts(uint32_t interrupts);
+void flash_start_erase_page(uint32_t page_address);
+void flash_start_program_half_word(uint32_t address, uint16_t data);
+void flash_end_operation(void);
 
 #endif /* __MYLIBOPENCM3_H */
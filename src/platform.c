@@ -2,6 +2,65 @@
 
 #define MPU_READ 0x80
 
+#define MPU_CONFIG 0x1A
+#define MPU_FIFO_EN 0x23
+#define MPU_FIFO_EN_ZG 0x10
+#define MPU_GYRO_ZOUT_H 0x47
+#define MPU_USER_CTRL 0x6A
+#define MPU_USER_CTRL_FIFO_EN 0x40
+#define MPU_USER_CTRL_FIFO_RST 0x04
+#define MPU_FIFO_COUNTH 0x72
+#define MPU_FIFO_R_W 0x74
+#define MPU_FIFO_SIZE 512
+
+/**
+ * SYSCLK cycles per SPI2 clock cycle at high speed.
+ *
+ * SPI2 is clocked from APB1 (36 MHz) divided by 2 (see
+ * `setup_spi_high_speed()`), so an SPI clock cycle lasts 4 SYSCLK cycles.
+ * Each `nop` takes at least one cycle, so `wait_spi_clock_cycle()` lasts at
+ * least one SPI clock cycle.
+ */
+#define SPI_HIGH_SPEED_HZ 18000000
+#define SPI_HIGH_SPEED_CLOCK_CYCLES (SYSCLK_FREQUENCY_HZ / SPI_HIGH_SPEED_HZ)
+
+/** Gyroscope samples expected in the FIFO on each SysTick period */
+#define MPU_FIFO_SAMPLES_PER_TICK (MPU_GYRO_RATE_HZ / SYSTICK_FREQUENCY_HZ)
+
+/** Maximum number of bytes drained from the FIFO on each SysTick period */
+#define MPU_FIFO_MAX_READ (8 * MPU_FIFO_SAMPLES_PER_TICK * sizeof(int16_t))
+
+#if MPU_GYRO_RATE_HZ % SYSTICK_FREQUENCY_HZ
+#error "MPU_GYRO_RATE_HZ must be a multiple of SYSTICK_FREQUENCY_HZ"
+#endif
+
+/**
+ * MPU burst read state.
+ *
+ * The burst buffer is written by DMA while reading and then serves the
+ * burst registers until the burst read is ended. When the FIFO is enabled,
+ * it is drained right after the burst registers.
+ */
+enum burst_state {
+	BURST_IDLE,
+	BURST_READING,
+	BURST_READING_FIFO,
+	BURST_COMPLETED
+};
+
+static volatile uint8_t burst[MPU_BURST_SIZE];
+static volatile enum burst_state burst_state;
+static volatile uint8_t *dma_last;
+
+static bool fifo_enabled;
+static uint8_t fifo_user_control;
+static volatile bool fifo_desynchronized;
+static volatile bool fifo_resetting;
+static uint8_t fifo[MPU_FIFO_MAX_READ];
+static uint16_t fifo_read;
+static int32_t fifo_residual;
+static volatile uint32_t fifo_overflows;
+
 /**
  * @brief Read the microcontroller clock cycle counter.
  *
@@ -14,10 +73,14 @@ uint32_t read_cycle_counter(void)
 
 /**
  * @brief Read left motor encoder counter.
+ *
+ * The counter is recorded or played when replaying (see `replay.h`), like
+ * the rest of the reads below.
  */
 uint16_t read_encoder_left(void)
 {
-	return (uint16_t)timer_get_counter(TIM2);
+	return replay_encoder(REPLAY_ENCODER_LEFT,
+			      (uint16_t)timer_get_counter(TIM2));
 }
 
 /**
@@ -25,18 +88,34 @@ uint16_t read_encoder_left(void)
  */
 uint16_t read_encoder_right(void)
 {
-	return (uint16_t)timer_get_counter(TIM4);
+	return replay_encoder(REPLAY_ENCODER_RIGHT,
+			      (uint16_t)timer_get_counter(TIM4));
 }
 
 /**
  * @brief Read a MPU register.
  *
+ * Registers covered by a burst read (see `mpu_start_burst_read()`) are served
+ * from the burst buffer, waiting for the burst read to complete if needed.
+ * Other registers are read with a blocking SPI transaction.
+ *
+ * The value is recorded or played when replaying (see `replay.h`).
+ *
  * @param[in] address Register address.
  */
 uint8_t mpu_read_register(uint8_t address)
 {
 	uint8_t reading;
 
+	if (burst_state != BURST_IDLE) {
+		while (burst_state == BURST_READING ||
+		       burst_state == BURST_READING_FIFO)
+			;
+		if ((uint8_t)(address - MPU_BURST_ADDRESS) < MPU_BURST_SIZE)
+			return replay_mpu_register(
+			    address, burst[address - MPU_BURST_ADDRESS]);
+	}
+
 	gpio_clear(GPIOB, GPIO12);
 	spi_send(SPI2, (MPU_READ | address));
 	spi_read(SPI2);
@@ -44,7 +123,7 @@ uint8_t mpu_read_register(uint8_t address)
 	reading = spi_read(SPI2);
 	gpio_set(GPIOB, GPIO12);
 
-	return reading;
+	return replay_mpu_register(address, reading);
 }
 
 /**
@@ -62,3 +141,292 @@ void mpu_write_register(uint8_t address, uint8_t value)
 	spi_read(SPI2);
 	gpio_set(GPIOB, GPIO12);
 }
+
+/**
+ * @brief Setup DMA for MPU burst reads.
+ *
+ * SPI2 reception is served by DMA1 channel 4. SPI2 transmission would be
+ * served by channel 5, which is used by the emitters, so the burst is read
+ * in master receive-only mode instead, which generates the clock without
+ * transmitting.
+ *
+ * An interruption is generated on transfer complete to end the transaction.
+ */
+void setup_mpu_burst_read(void)
+{
+	dma_channel_reset(DMA1, DMA_CHANNEL4);
+
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL4,
+				   (uint32_t)(uintptr_t)&SPI2_DR);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL4);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL4);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL4, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL4, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL4, DMA_CCR_PL_VERY_HIGH);
+
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL4);
+}
+
+/**
+ * @brief Enable the MPU FIFO for the gyroscope Z-axis.
+ *
+ * The gyroscope is sampled at `MPU_GYRO_RATE_HZ` (8 kHz, with the digital low
+ * pass filter disabled) and the Z-axis samples are stored in the FIFO, which
+ * is drained on every SysTick period (see `mpu_start_burst_read()`). The
+ * FIFO holds 256 samples (32 ms), so no samples are lost even if the
+ * SysTick handler is delayed.
+ *
+ * The MPU INT pin is not connected, so the FIFO count is polled instead of
+ * using a data ready interruption.
+ *
+ * Must be called after `setup_mpu()`, before starting the burst reads.
+ */
+void setup_mpu_fifo(void)
+{
+	setup_spi_low_speed();
+	fifo_user_control = mpu_read_register(MPU_USER_CTRL);
+	mpu_write_register(MPU_CONFIG, 0x00);
+	mpu_write_register(MPU_FIFO_EN, MPU_FIFO_EN_ZG);
+	mpu_write_register(MPU_USER_CTRL,
+			   fifo_user_control | MPU_USER_CTRL_FIFO_RST);
+	mpu_write_register(MPU_USER_CTRL,
+			   fifo_user_control | MPU_USER_CTRL_FIFO_EN);
+	setup_spi_high_speed();
+	fifo_residual = 0;
+	fifo_enabled = true;
+}
+
+/**
+ * @brief Discard the samples stored in the MPU FIFO if a byte was lost.
+ *
+ * Realigns the FIFO reads to whole samples after a byte has been lost (see
+ * `dma1_channel4_isr()`). The loss is accounted as an overflow.
+ *
+ * Must be called from thread mode: the registers are written at low speed,
+ * which takes about 60 us. Burst reads are skipped meanwhile, and the
+ * gyroscope Z-axis register is served from the burst registers until the
+ * FIFO is reset.
+ */
+void mpu_resynchronize_fifo(void)
+{
+	if (!fifo_desynchronized)
+		return;
+	fifo_resetting = true;
+	while (burst_state == BURST_READING ||
+	       burst_state == BURST_READING_FIFO)
+		;
+	setup_spi_low_speed();
+	mpu_write_register(MPU_USER_CTRL,
+			   fifo_user_control | MPU_USER_CTRL_FIFO_RST);
+	mpu_write_register(MPU_USER_CTRL,
+			   fifo_user_control | MPU_USER_CTRL_FIFO_EN);
+	setup_spi_high_speed();
+	fifo_residual = 0;
+	fifo_overflows++;
+	fifo_desynchronized = false;
+	fifo_resetting = false;
+}
+
+/**
+ * @brief Get the number of times the MPU FIFO has been found full.
+ *
+ * Gyroscope samples may have been lost each time.
+ */
+uint32_t get_mpu_fifo_overflows(void)
+{
+	return fifo_overflows;
+}
+
+/**
+ * @brief Read the number of bytes stored in the MPU FIFO.
+ *
+ * Only whole samples, up to `MPU_FIFO_MAX_READ` bytes, are counted. The rest
+ * are left for the next SysTick period.
+ */
+static uint16_t read_fifo_count(void)
+{
+	uint16_t count;
+
+	gpio_clear(GPIOB, GPIO12);
+	spi_send(SPI2, (MPU_READ | MPU_FIFO_COUNTH));
+	spi_read(SPI2);
+	spi_send(SPI2, 0x00);
+	count = spi_read(SPI2) << 8;
+	spi_send(SPI2, 0x00);
+	count |= spi_read(SPI2);
+	gpio_set(GPIOB, GPIO12);
+
+	if (count >= MPU_FIFO_SIZE)
+		fifo_overflows++;
+	if (count > MPU_FIFO_MAX_READ)
+		count = MPU_FIFO_MAX_READ;
+	return count & ~(sizeof(int16_t) - 1);
+}
+
+/**
+ * @brief Start reading MPU registers with DMA.
+ *
+ * Only the register address is transmitted by the CPU: the data is received
+ * by DMA in master receive-only mode and the transaction is ended from the
+ * transfer complete interruption (see `dma1_channel4_isr()`). DMA receives
+ * all bytes but the last one, which is received by the interruption while
+ * stopping the clock.
+ *
+ * @param[in] address First register address.
+ * @param[out] data Buffer to store the read data.
+ * @param[in] size Number of bytes to read (at least 2).
+ */
+static void start_dma_read(uint8_t address, volatile uint8_t *data,
+			   uint16_t size)
+{
+	gpio_clear(GPIOB, GPIO12);
+	spi_send(SPI2, (MPU_READ | address));
+	spi_read(SPI2);
+	while (SPI_SR(SPI2) & SPI_SR_BSY)
+		;
+	spi_disable(SPI2);
+
+	dma_last = &data[size - 1];
+	dma_set_memory_address(DMA1, DMA_CHANNEL4, (uint32_t)(uintptr_t)data);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL4, size - 1);
+	dma_enable_channel(DMA1, DMA_CHANNEL4);
+	spi_enable_rx_dma(SPI2);
+	spi_set_receive_only_mode(SPI2);
+	spi_enable(SPI2);
+}
+
+/**
+ * @brief Integrate the gyroscope samples drained from the FIFO.
+ *
+ * The sum of the samples is divided by the number of samples expected per
+ * SysTick period and served as the gyroscope Z-axis register. That way,
+ * integrating that value once per period accounts for every sample, even if
+ * periods are jittered. The division remainder is carried to the next
+ * period, so no angle is lost to rounding either.
+ */
+static void integrate_fifo(void)
+{
+	int32_t total = fifo_residual;
+	int32_t rate;
+	uint16_t i;
+
+	for (i = 0; i < fifo_read; i += sizeof(int16_t))
+		total += (int16_t)(fifo[i] << 8 | fifo[i + 1]);
+	rate = total / (int32_t)MPU_FIFO_SAMPLES_PER_TICK;
+	if (rate > INT16_MAX)
+		rate = INT16_MAX;
+	else if (rate < INT16_MIN)
+		rate = INT16_MIN;
+	fifo_residual = total - rate * (int32_t)MPU_FIFO_SAMPLES_PER_TICK;
+	burst[MPU_GYRO_ZOUT_H - MPU_BURST_ADDRESS] = (uint8_t)(rate >> 8);
+	burst[MPU_GYRO_ZOUT_H + 1 - MPU_BURST_ADDRESS] = (uint8_t)rate;
+}
+
+/**
+ * @brief Start reading the MPU burst registers asynchronously.
+ *
+ * Accelerometer, temperature and gyroscope measurements (`MPU_BURST_SIZE`
+ * bytes from `MPU_BURST_ADDRESS`) are read in a single DMA transaction. If
+ * the FIFO is enabled, its count is read first and the stored samples are
+ * drained in a second DMA transaction, chained from the first one.
+ *
+ * The burst registers are then served from the buffer, without SPI
+ * transactions, until `mpu_end_burst_read()` is called.
+ *
+ * While the FIFO is desynchronized, it is not drained. While it is being
+ * reset (see `mpu_resynchronize_fifo()`), nothing is read and the previous
+ * burst registers are served again.
+ */
+void mpu_start_burst_read(void)
+{
+	if (burst_state == BURST_READING || burst_state == BURST_READING_FIFO)
+		return;
+	if (fifo_resetting) {
+		burst_state = BURST_COMPLETED;
+		return;
+	}
+	burst_state = BURST_READING;
+	fifo_read =
+	    fifo_enabled && !fifo_desynchronized ? read_fifo_count() : 0;
+	start_dma_read(MPU_BURST_ADDRESS, burst, MPU_BURST_SIZE);
+}
+
+/**
+ * @brief Stop serving the burst registers from the burst buffer.
+ */
+void mpu_end_burst_read(void)
+{
+	while (burst_state == BURST_READING ||
+	       burst_state == BURST_READING_FIFO)
+		;
+	burst_state = BURST_IDLE;
+}
+
+/**
+ * @brief Get the latest gyroscope Z-axis raw reading.
+ *
+ * The value is taken from the burst buffer, without SPI transactions, so it
+ * corresponds to the latest burst read (see `mpu_start_burst_read()`).
+ */
+int16_t get_mpu_gyro_z_raw(void)
+{
+	return (int16_t)((burst[MPU_GYRO_ZOUT_H - MPU_BURST_ADDRESS] << 8) |
+			 burst[MPU_GYRO_ZOUT_H + 1 - MPU_BURST_ADDRESS]);
+}
+
+/**
+ * @brief Busy-wait for (at least) one SPI clock cycle, with a software loop.
+ */
+static void wait_spi_clock_cycle(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < SPI_HIGH_SPEED_CLOCK_CYCLES; i++)
+		__asm__ volatile("nop");
+}
+
+/**
+ * @brief End an MPU DMA read transaction.
+ *
+ * In master receive-only mode the clock keeps running until the SPI is
+ * disabled, and every byte clocked from `MPU_FIFO_R_W` pops a byte from the
+ * FIFO. The SPI is stopped as described in the reference manual (RM0008)
+ * "Disabling the SPI" section: the interruption is generated by the second
+ * to last byte, the SPI is disabled one SPI clock cycle later, while the last
+ * byte is being received, and that byte is read once received.
+ *
+ * If the interruption is delayed beyond the last byte, more bytes are
+ * clocked and lost with an overrun. That is harmless for the burst
+ * registers, but FIFO reads would not be aligned to samples anymore, so the
+ * FIFO is not drained nor integrated until it is reset from thread mode (see
+ * `mpu_resynchronize_fifo()`).
+ *
+ * After the burst registers, the FIFO is drained if needed. Its samples are
+ * integrated once received.
+ */
+void dma1_channel4_isr(void)
+{
+	bool overrun;
+
+	dma_clear_interrupt_flags(DMA1, DMA_CHANNEL4, DMA_TCIF);
+	wait_spi_clock_cycle();
+	spi_disable(SPI2);
+	*dma_last = (uint8_t)spi_read(SPI2);
+	overrun = SPI_SR(SPI2) & SPI_SR_OVR;
+	dma_disable_channel(DMA1, DMA_CHANNEL4);
+	spi_disable_rx_dma(SPI2);
+	spi_set_full_duplex_mode(SPI2);
+	gpio_set(GPIOB, GPIO12);
+	spi_enable(SPI2);
+	if (overrun && burst_state == BURST_READING_FIFO)
+		fifo_desynchronized = true;
+
+	if (burst_state == BURST_READING && fifo_read) {
+		burst_state = BURST_READING_FIFO;
+		start_dma_read(MPU_FIFO_R_W, fifo, fifo_read);
+		return;
+	}
+	if (fifo_enabled && !fifo_desynchronized)
+		integrate_fifo();
+	burst_state = BURST_COMPLETED;
+}
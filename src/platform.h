@@ -4,12 +4,30 @@
 #include <libopencm3/cm3/dwt.h>
 #include <libopencm3/stm32/timer.h>
 
+#include "replay.h"
 #include "setup.h"
 
+/** MPU registers read in a burst: accelerometer, temperature and gyroscope */
+#define MPU_BURST_ADDRESS 0x3B
+#define MPU_BURST_SIZE 14
+
+/** MPU gyroscope Z-axis offset registers (high and low bytes) */
+#define MPU_GYRO_Z_OFFSET_ADDRESS 0x17
+
+/** MPU gyroscope output data rate, with the FIFO enabled */
+#define MPU_GYRO_RATE_HZ 8000
+
 uint32_t read_cycle_counter(void);
 uint16_t read_encoder_left(void);
 uint16_t read_encoder_right(void);
 uint8_t mpu_read_register(uint8_t address);
 void mpu_write_register(uint8_t address, uint8_t value);
+void setup_mpu_burst_read(void);
+void setup_mpu_fifo(void);
+void mpu_resynchronize_fifo(void);
+uint32_t get_mpu_fifo_overflows(void);
+void mpu_start_burst_read(void);
+void mpu_end_burst_read(void);
+int16_t get_mpu_gyro_z_raw(void);
 
 #endif /* __PLATFORM_H */
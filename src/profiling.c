@@ -0,0 +1,250 @@
+#include <string.h>
+
+#include "mmlib/logging.h"
+
+#include "profiling.h"
+
+struct stage_record {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint16_t histogram[PROFILING_BUCKETS];
+};
+
+static const char *const stage_names[PROFILING_NUM_STAGES] = {
+    "mpu",     "clock", "distance", "battery",    "gyro",
+    "encoder", "motor", "log",      "checkpoint", "total"};
+
+static struct stage_record records[PROFILING_NUM_STAGES];
+static volatile uint32_t overruns;
+static uint32_t tick_start;
+static uint32_t stage_start;
+
+/**
+ * @brief Return the histogram bucket for a number of cycles.
+ *
+ * Each power of two is divided in 4 buckets, so the relative resolution is
+ * better than 25 %. Values below 4 have their own bucket.
+ */
+static uint32_t bucket(uint32_t cycles)
+{
+	uint32_t msb;
+	uint32_t index;
+
+	if (cycles < 4)
+		return cycles;
+	msb = 31 - __builtin_clz(cycles);
+	index = (msb - 1) * 4 + ((cycles >> (msb - 2)) & 0x3);
+	if (index >= PROFILING_BUCKETS)
+		index = PROFILING_BUCKETS - 1;
+	return index;
+}
+
+/**
+ * @brief Return the highest number of cycles that falls in a bucket.
+ */
+static uint32_t bucket_upper_bound(uint32_t index)
+{
+	uint32_t msb;
+	uint32_t width;
+
+	if (index < 4)
+		return index;
+	msb = index / 4 + 1;
+	width = 1 << (msb - 2);
+	return (4 + index % 4) * width + width - 1;
+}
+
+/**
+ * @brief Add a measurement to a stage record.
+ *
+ * Histogram counters are 16-bit wide to save RAM, so all of them are halved
+ * when one is about to overflow. That keeps the shape of the distribution,
+ * which is all the percentile estimation needs.
+ */
+static void record(enum profiling_stage stage, uint32_t cycles)
+{
+	struct stage_record *stage_record = &records[stage];
+	uint32_t index = bucket(cycles);
+	uint32_t i;
+
+	if (!stage_record->count || cycles < stage_record->min)
+		stage_record->min = cycles;
+	if (cycles > stage_record->max)
+		stage_record->max = cycles;
+	stage_record->count++;
+	stage_record->total += cycles;
+	if (stage_record->histogram[index] == UINT16_MAX)
+		for (i = 0; i < PROFILING_BUCKETS; i++)
+			stage_record->histogram[i] /= 2;
+	stage_record->histogram[index]++;
+}
+
+/**
+ * @brief Mark the beginning of a SysTick handler execution.
+ *
+ * Must be called first thing in the handler.
+ */
+void profiling_tick_start(void)
+{
+	tick_start = read_cycle_counter();
+	stage_start = tick_start;
+}
+
+/**
+ * @brief Mark the end of a stage of the SysTick handler.
+ *
+ * The stage duration is measured since the end of the previous stage (or
+ * the beginning of the handler).
+ *
+ * @param[in] stage Stage that just ended.
+ */
+void profiling_stage_end(enum profiling_stage stage)
+{
+	uint32_t now = read_cycle_counter();
+
+	record(stage, now - stage_start);
+	stage_start = now;
+}
+
+/**
+ * @brief Mark the end of a SysTick handler execution.
+ *
+ * The whole handler duration is recorded as `PROFILING_TOTAL`, and overruns
+ * of the SysTick period are counted.
+ */
+void profiling_tick_end(void)
+{
+	uint32_t cycles = read_cycle_counter() - tick_start;
+
+	record(PROFILING_TOTAL, cycles);
+	if (cycles > PROFILING_BUDGET_CYCLES)
+		overruns++;
+}
+
+/**
+ * @brief Discard all the profiling measurements.
+ */
+void reset_profiling(void)
+{
+	cm_disable_interrupts();
+	memset(records, 0, sizeof(records));
+	overruns = 0;
+	cm_enable_interrupts();
+}
+
+/**
+ * @brief Get the name of a stage, as reported by `log_profiling()`.
+ */
+const char *get_profiling_stage_name(enum profiling_stage stage)
+{
+	return stage_names[stage];
+}
+
+/**
+ * @brief Get the statistics of a stage, in cycles.
+ *
+ * The 99th percentile is estimated from the histogram, so it is rounded up
+ * to the upper bound of its bucket (but never above the maximum). It is
+ * relative to the histogram total, which is below the count once the
+ * histogram has been halved.
+ *
+ * @param[in] stage Stage to get the statistics from.
+ */
+struct profiling_statistics get_profiling_statistics(enum profiling_stage stage)
+{
+	struct profiling_statistics statistics = {0};
+	struct stage_record stage_record;
+	uint32_t threshold;
+	uint32_t samples = 0;
+	uint32_t accumulated = 0;
+	uint32_t i;
+
+	cm_disable_interrupts();
+	stage_record = records[stage];
+	cm_enable_interrupts();
+
+	if (!stage_record.count)
+		return statistics;
+	statistics.count = stage_record.count;
+	statistics.min = stage_record.min;
+	statistics.max = stage_record.max;
+	statistics.avg = (uint32_t)(stage_record.total / stage_record.count);
+	for (i = 0; i < PROFILING_BUCKETS; i++)
+		samples += stage_record.histogram[i];
+	threshold = samples - samples / 100;
+	for (i = 0; i < PROFILING_BUCKETS; i++) {
+		accumulated += stage_record.histogram[i];
+		if (accumulated >= threshold)
+			break;
+	}
+	statistics.p99 = bucket_upper_bound(i);
+	if (statistics.p99 > statistics.max)
+		statistics.p99 = statistics.max;
+	return statistics;
+}
+
+/**
+ * @brief Get the number of SysTick handler executions exceeding the SysTick
+ * period.
+ */
+uint32_t get_profiling_overruns(void)
+{
+	return overruns;
+}
+
+/**
+ * @brief Log the statistics of every stage and the overruns.
+ *
+ * The data lost since start-up is logged too: serial messages dropped for
+ * lack of room (or while the transfer lock was taken), received bytes
+ * overwritten before being read, discarded commands and MPU FIFO overflows.
+ */
+void log_profiling(void)
+{
+	struct profiling_statistics statistics;
+	int stage;
+
+	for (stage = 0; stage < PROFILING_NUM_STAGES; stage++) {
+		statistics = get_profiling_statistics(stage);
+		LOG_INFO("%s: min %u, avg %u, p99 %u, max %u",
+			 stage_names[stage], statistics.min, statistics.avg,
+			 statistics.p99, statistics.max);
+	}
+	/* Statistics of the last stage (`PROFILING_TOTAL`) count every tick */
+	LOG_INFO("overruns: %u of %u (budget %u)", get_profiling_overruns(),
+		 statistics.count, PROFILING_BUDGET_CYCLES);
+	LOG_INFO("serial: dropped %u bytes, %u messages, lost %u bytes, "
+		 "discarded %u commands",
+		 get_serial_dropped_bytes(), get_serial_dropped_messages(),
+		 get_serial_lost_bytes(), get_serial_discarded_commands());
+	LOG_INFO("mpu fifo overflows: %u", get_mpu_fifo_overflows());
+}
+
+/**
+ * @brief Execute the received command if it is a profiling command.
+ *
+ * - `profile`: log the profiling statistics and the data lost.
+ * - `profile_reset`: reset the profiling statistics.
+ *
+ * Other commands are left for `execute_command()`.
+ *
+ * @return Whether a profiling command was executed.
+ */
+bool execute_profiling_command(void)
+{
+	char *command;
+
+	if (!get_received_command_flag())
+		return false;
+	command = get_received_serial_buffer();
+	if (!strcmp(command, "profile"))
+		log_profiling();
+	else if (!strcmp(command, "profile_reset"))
+		reset_profiling();
+	else
+		return false;
+	set_received_command_flag(false);
+	return true;
+}
@@ -0,0 +1,54 @@
+#ifndef __PROFILING_H
+#define __PROFILING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#include "platform.h"
+#include "serial.h"
+#include "setup.h"
+
+/** SysTick period, in cycles */
+#define PROFILING_BUDGET_CYCLES (SYSCLK_FREQUENCY_HZ / SYSTICK_FREQUENCY_HZ)
+
+/**
+ * Histogram buckets: 4 per power of two, up to 2^17 - 1 cycles (longer
+ * measurements, over 3 SysTick periods, are accounted in the last bucket).
+ */
+#define PROFILING_BUCKETS (4 * 16)
+
+enum profiling_stage {
+	PROFILING_MPU,
+	PROFILING_CLOCK,
+	PROFILING_DISTANCE,
+	PROFILING_BATTERY,
+	PROFILING_GYRO,
+	PROFILING_ENCODER,
+	PROFILING_MOTOR,
+	PROFILING_LOG,
+	PROFILING_CHECKPOINT,
+	PROFILING_TOTAL,
+	PROFILING_NUM_STAGES,
+};
+
+struct profiling_statistics {
+	uint32_t count;
+	uint32_t min;
+	uint32_t avg;
+	uint32_t p99;
+	uint32_t max;
+};
+
+void profiling_tick_start(void);
+void profiling_stage_end(enum profiling_stage stage);
+void profiling_tick_end(void);
+void reset_profiling(void);
+const char *get_profiling_stage_name(enum profiling_stage stage);
+struct profiling_statistics get_profiling_statistics(enum profiling_stage stage);
+uint32_t get_profiling_overruns(void);
+void log_profiling(void);
+bool execute_profiling_command(void);
+
+#endif /* __PROFILING_H */
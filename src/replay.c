@@ -0,0 +1,354 @@
+#include <string.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#include "mmlib/control.h"
+
+#include "motor.h"
+#include "platform.h"
+#include "replay.h"
+#include "telemetry.h"
+
+enum replay_mode {
+	REPLAY_MODE_OFF,
+	REPLAY_MODE_RECORDING,
+	REPLAY_MODE_PLAYING,
+};
+
+/** Value size of each entry, in bytes (the tag not included) */
+static const uint8_t entry_sizes[] = {
+    [REPLAY_ENCODER_LEFT] = sizeof(uint16_t),
+    [REPLAY_ENCODER_RIGHT] = sizeof(uint16_t),
+    [REPLAY_MPU_REGISTER] = 2 * sizeof(uint8_t),
+    [REPLAY_SENSORS] = 2 * NUM_SENSOR * sizeof(uint16_t),
+    [REPLAY_TARGET] = 2 * sizeof(float),
+    [REPLAY_POWER] = 2 * sizeof(int32_t),
+    [REPLAY_HEADER] = sizeof(struct replay_header),
+};
+
+static volatile enum replay_mode mode;
+static bool ticking;
+static uint16_t encoder_counters[2];
+
+/* Recording, entries are sent in chunks as telemetry records */
+static uint8_t chunk[TELEMETRY_MAX_RECORD_SIZE];
+static uint32_t chunk_size;
+static bool target_recorded;
+static float target[2];
+
+/* Playback */
+static const uint8_t *entries;
+static uint32_t entries_size;
+static uint32_t position;
+static struct replay_statistics statistics;
+
+/**
+ * @brief Send the recorded entries that have not been sent yet.
+ */
+static void flush(void)
+{
+	if (!chunk_size)
+		return;
+	telemetry_send(TELEMETRY_REPLAY, chunk, chunk_size);
+	chunk_size = 0;
+}
+
+/**
+ * @brief Record an entry.
+ *
+ * Entries are never split among chunks, so a lost chunk does not
+ * desynchronize the following ones.
+ */
+static void record(enum replay_entry entry, const void *value)
+{
+	uint32_t size = entry_sizes[entry];
+
+	if (chunk_size + 1 + size > sizeof(chunk))
+		flush();
+	chunk[chunk_size++] = entry;
+	memcpy(&chunk[chunk_size], value, size);
+	chunk_size += size;
+}
+
+/**
+ * @brief Whether an entry tag is valid.
+ */
+static bool is_entry(uint8_t entry)
+{
+	return entry < sizeof(entry_sizes) && entry_sizes[entry];
+}
+
+/**
+ * @brief Account for an input or output that does not match the recording.
+ */
+static void mismatch(uint32_t *counter)
+{
+	if (!statistics.input_mismatches && !statistics.output_mismatches)
+		statistics.first_mismatch_tick = statistics.ticks;
+	(*counter)++;
+}
+
+/**
+ * @brief Whether the next entry to play is of the given type.
+ */
+static bool next_is(enum replay_entry entry)
+{
+	return position + 1 + entry_sizes[entry] <= entries_size &&
+	       entries[position] == entry;
+}
+
+/**
+ * @brief Play the next entry, which is expected to be of the given type.
+ *
+ * Unexpected entries are not consumed and `value` is left untouched, so the
+ * live value is used instead.
+ *
+ * @return Whether the entry was played.
+ */
+static bool play(enum replay_entry entry, void *value)
+{
+	if (!next_is(entry)) {
+		mismatch(&statistics.input_mismatches);
+		return false;
+	}
+	memcpy(value, &entries[position + 1], entry_sizes[entry]);
+	position += 1 + entry_sizes[entry];
+	return true;
+}
+
+/**
+ * @brief Start recording, sending the entries as telemetry records.
+ *
+ * The header is recorded first, so the replay starts from the same state.
+ * Must be called with interruptions disabled, right before enabling the
+ * motor control. Data logging should be stopped meanwhile, as the serial
+ * bandwidth is mostly taken by the recording.
+ *
+ * @param[in] force Force of the movements.
+ * @param[in] run Whether the movements are a run instead of an exploration.
+ */
+void replay_start_recording(float force, bool run)
+{
+	struct replay_header header;
+
+	header.force = force;
+	header.run = run;
+	header.gyro_z_offset[0] = mpu_read_register(MPU_GYRO_Z_OFFSET_ADDRESS);
+	header.gyro_z_offset[1] =
+	    mpu_read_register(MPU_GYRO_Z_OFFSET_ADDRESS + 1);
+	header.encoder_left = encoder_counters[0];
+	header.encoder_right = encoder_counters[1];
+	header.config = *get_config();
+	chunk_size = 0;
+	record(REPLAY_HEADER, &header);
+	target_recorded = false;
+	mode = REPLAY_MODE_RECORDING;
+}
+
+/**
+ * @brief Stop recording and send the remaining entries.
+ */
+void replay_stop_recording(void)
+{
+	cm_disable_interrupts();
+	mode = REPLAY_MODE_OFF;
+	ticking = false;
+	cm_enable_interrupts();
+	flush();
+}
+
+/**
+ * @brief Start playing a recording.
+ *
+ * @param[in] recording Recorded entries, which must remain available until
+ * the playback is finished.
+ * @param[in] size Size (number of bytes) of the recording.
+ */
+void replay_start_playback(const uint8_t *recording, uint32_t size)
+{
+	cm_disable_interrupts();
+	entries = recording;
+	entries_size = size;
+	position = 0;
+	memset(&statistics, 0, sizeof(statistics));
+	mode = REPLAY_MODE_PLAYING;
+	cm_enable_interrupts();
+}
+
+/**
+ * @brief Whether the whole recording has been played.
+ */
+bool replay_playback_finished(void)
+{
+	return mode != REPLAY_MODE_PLAYING;
+}
+
+/**
+ * @brief Play the recording header.
+ *
+ * Must be called right after `replay_start_playback()`, before ticking.
+ *
+ * @param[out] header Recorded header.
+ * @return Whether the recording starts with a header.
+ */
+bool get_replay_header(struct replay_header *header)
+{
+	if (!next_is(REPLAY_HEADER))
+		return false;
+	memcpy(header, &entries[position + 1], sizeof(*header));
+	position += 1 + sizeof(*header);
+	return true;
+}
+
+/**
+ * @brief Get the playback statistics.
+ *
+ * Mismatches are entries that do not match the reads made (inputs) or the
+ * motor powers computed (outputs) while playing.
+ */
+struct replay_statistics get_replay_statistics(void)
+{
+	return statistics;
+}
+
+/**
+ * @brief Start recording or playing the reads of a SysTick period.
+ *
+ * The movement targets are recorded when changed, or set from the recording
+ * when playing, so the motor control uses the same targets.
+ */
+void replay_tick_start(void)
+{
+	float speeds[2];
+
+	if (mode == REPLAY_MODE_OFF)
+		return;
+	ticking = true;
+	if (mode == REPLAY_MODE_RECORDING) {
+		speeds[0] = get_target_linear_speed();
+		speeds[1] = get_target_angular_speed();
+		if (target_recorded && !memcmp(speeds, target, sizeof(speeds)))
+			return;
+		memcpy(target, speeds, sizeof(target));
+		target_recorded = true;
+		record(REPLAY_TARGET, target);
+		return;
+	}
+	while (next_is(REPLAY_TARGET)) {
+		play(REPLAY_TARGET, speeds);
+		set_target_linear_speed(speeds[0]);
+		set_target_angular_speed(speeds[1]);
+	}
+}
+
+/**
+ * @brief End recording or playing the reads of a SysTick period.
+ *
+ * Must be called after the motor control. The motor powers are recorded or,
+ * when playing, compared with the recorded ones. Recorded reads that were
+ * not made are skipped, so the playback is synchronized on every tick.
+ */
+void replay_tick_end(void)
+{
+	int32_t powers[2];
+
+	if (mode == REPLAY_MODE_OFF)
+		return;
+	ticking = false;
+	powers[0] = get_left_power();
+	powers[1] = get_right_power();
+	if (mode == REPLAY_MODE_RECORDING) {
+		record(REPLAY_POWER, powers);
+		return;
+	}
+	while (position < entries_size && !next_is(REPLAY_POWER)) {
+		mismatch(&statistics.input_mismatches);
+		if (!is_entry(entries[position])) {
+			position = entries_size;
+			break;
+		}
+		position += 1 + entry_sizes[entries[position]];
+	}
+	if (position >= entries_size) {
+		mode = REPLAY_MODE_OFF;
+		return;
+	}
+	if (memcmp(&entries[position + 1], powers, sizeof(powers)))
+		mismatch(&statistics.output_mismatches);
+	position += 1 + sizeof(powers);
+	statistics.ticks++;
+	if (position >= entries_size)
+		mode = REPLAY_MODE_OFF;
+}
+
+/**
+ * @brief Record or play an encoder counter read.
+ *
+ * @param[in] entry `REPLAY_ENCODER_LEFT` or `REPLAY_ENCODER_RIGHT`.
+ * The last counters read are kept to be recorded in the header.
+ *
+ * @param[in] counter Counter read from the timer.
+ * @return The counter to use.
+ */
+uint16_t replay_encoder(enum replay_entry entry, uint16_t counter)
+{
+	if (mode != REPLAY_MODE_PLAYING)
+		encoder_counters[entry - REPLAY_ENCODER_LEFT] = counter;
+	if (!ticking)
+		return counter;
+	if (mode == REPLAY_MODE_RECORDING)
+		record(entry, &counter);
+	else
+		play(entry, &counter);
+	return counter;
+}
+
+/**
+ * @brief Record or play a MPU register read.
+ *
+ * @param[in] address Register address.
+ * @param[in] value Value read from the register.
+ * @return The value to use.
+ */
+uint8_t replay_mpu_register(uint8_t address, uint8_t value)
+{
+	uint8_t data[2] = {address, value};
+
+	if (!ticking)
+		return value;
+	if (mode == REPLAY_MODE_RECORDING) {
+		record(REPLAY_MPU_REGISTER, data);
+		return value;
+	}
+	if (!play(REPLAY_MPU_REGISTER, data))
+		return value;
+	if (data[0] != address) {
+		mismatch(&statistics.input_mismatches);
+		return value;
+	}
+	return data[1];
+}
+
+/**
+ * @brief Record or play a sensors readings read.
+ *
+ * @param[in,out] on Readings with emitters on.
+ * @param[in,out] off Readings with emitters off.
+ */
+void replay_sensors(uint16_t *on, uint16_t *off)
+{
+	uint16_t data[2 * NUM_SENSOR];
+
+	if (!ticking)
+		return;
+	memcpy(data, on, NUM_SENSOR * sizeof(uint16_t));
+	memcpy(&data[NUM_SENSOR], off, NUM_SENSOR * sizeof(uint16_t));
+	if (mode == REPLAY_MODE_RECORDING) {
+		record(REPLAY_SENSORS, data);
+		return;
+	}
+	if (!play(REPLAY_SENSORS, data))
+		return;
+	memcpy(on, data, NUM_SENSOR * sizeof(uint16_t));
+	memcpy(off, &data[NUM_SENSOR], NUM_SENSOR * sizeof(uint16_t));
+}
@@ -0,0 +1,77 @@
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/**
+ * Record and replay of the control loop inputs.
+ *
+ * The peripheral reads done by the SysTick handler between
+ * `replay_tick_start()` and `replay_tick_end()` (encoder counters, MPU
+ * registers and sensors readings), the movement targets and the resulting
+ * motor powers are recorded as a stream of entries, in the order they are
+ * produced. Each entry is a tag byte followed by its little-endian value:
+ *
+ * - `REPLAY_ENCODER_LEFT`, `REPLAY_ENCODER_RIGHT`: counter (`uint16_t`).
+ * - `REPLAY_MPU_REGISTER`: register address and value (`uint8_t` each).
+ * - `REPLAY_SENSORS`: readings with emitters on and off (`uint16_t` each).
+ * - `REPLAY_TARGET`: linear and angular target speeds (`float` each), only
+ *   recorded when they change.
+ * - `REPLAY_POWER`: left and right motor powers (`int32_t` each), which
+ *   ends every tick.
+ * - `REPLAY_HEADER`: state the control starts from (`struct replay_header`),
+ *   recorded first.
+ *
+ * While playing, the same reads return the recorded values instead, so the
+ * control code can be fed with the inputs of a recorded run.
+ */
+enum replay_entry {
+	REPLAY_ENCODER_LEFT = 1,
+	REPLAY_ENCODER_RIGHT,
+	REPLAY_MPU_REGISTER,
+	REPLAY_SENSORS,
+	REPLAY_TARGET,
+	REPLAY_POWER,
+	REPLAY_HEADER,
+};
+
+/**
+ * Replay header.
+ *
+ * Movement force and kind, gyroscope Z-axis offset registers (where the
+ * calibration is stored, so the recorded gyroscope reads already include
+ * it), encoder counters read on the tick before the recording and live
+ * configuration (control constants of the selected tuning profile).
+ */
+struct __attribute__((packed)) replay_header {
+	float force;
+	uint8_t run;
+	uint8_t gyro_z_offset[2];
+	uint16_t encoder_left;
+	uint16_t encoder_right;
+	struct config config;
+};
+
+struct replay_statistics {
+	uint32_t ticks;
+	uint32_t input_mismatches;
+	uint32_t output_mismatches;
+	uint32_t first_mismatch_tick;
+};
+
+void replay_start_recording(float force, bool run);
+void replay_stop_recording(void);
+void replay_start_playback(const uint8_t *recording, uint32_t size);
+bool replay_playback_finished(void);
+bool get_replay_header(struct replay_header *header);
+struct replay_statistics get_replay_statistics(void);
+void replay_tick_start(void);
+void replay_tick_end(void);
+uint16_t replay_encoder(enum replay_entry entry, uint16_t counter);
+uint8_t replay_mpu_register(uint8_t address, uint8_t value);
+void replay_sensors(uint16_t *on, uint16_t *off);
+
+#endif /* __REPLAY_H */
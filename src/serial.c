@@ -1,36 +1,150 @@
 #include "serial.h"
 
 static mutex_t _send_lock;
-static volatile bool received;
+
+/**
+ * Reception ring buffer, continuously written by DMA in circular mode.
+ *
+ * The write count is updated by the interruptions (idle line, half and
+ * complete transfer) and the read count is updated when commands are
+ * extracted by `get_received_command_flag()`. Both are free-running and
+ * wrapped with `RECEIVE_RING_SIZE` when accessing the buffer.
+ */
+static char receive_ring[RECEIVE_RING_SIZE];
+static volatile uint32_t receive_write;
+static uint32_t receive_read;
 static char receive_buffer[RECEIVE_BUFFER_SIZE];
+static uint32_t receive_length;
+static bool receive_discarding;
+static bool received;
+static uint32_t lost_bytes;
+static uint32_t discarded_commands;
+
+/**
+ * Transmission ring buffer.
+ *
+ * The producer (`serial_send()`) only moves the head and the consumer
+ * (`dma1_channel2_isr()`) only moves the tail. Both indexes are free-running
+ * and wrapped with `TRANSMIT_BUFFER_MASK` when accessing the buffer. The
+ * chunk is the number of bytes, starting at the tail, being transferred by
+ * DMA (`0` when DMA is idle).
+ */
+static char transmit_buffer[TRANSMIT_BUFFER_SIZE];
+static volatile uint32_t transmit_head;
+static volatile uint32_t transmit_tail;
+static volatile uint32_t transmit_chunk;
+static volatile uint32_t dropped_bytes;
+static volatile uint32_t dropped_messages;
 
 /**
  * @brief Try to acquire the serial transfer lock.
  *
+ * The lock guarantees a single producer for the transmission buffer. It is
+ * released by `serial_send()`, so the lock holder must always call it.
+ *
+ * A message is accounted as dropped when the lock is not acquired.
+ *
  * @return Whether the lock was acquired or not.
  */
 bool serial_acquire_transfer_lock(void)
 {
-	return (bool)mutex_trylock(&_send_lock);
+	if (mutex_trylock(&_send_lock))
+		return true;
+	dropped_messages++;
+	return false;
 }
 
 /**
  * @brief Send data through serial.
  *
- * DMA is configured to read from `data` a number `size` of bytes. It then
- * writes all those bytes to USART3 (Bluetooth).
+ * The data is copied to the transmission buffer, so `data` can be reused as
+ * soon as the function returns. If there is not enough room for the whole
+ * message it is dropped instead. The DMA transfer complete interruption is
+ * pended when DMA is idle to start the transmission.
  *
- * An interruption is generated when the transfer is complete.
+ * It will also release the serial transfer lock.
  *
  * @param[in] data Data to send.
  * @param[in] size Size (number of bytes) to send.
  */
 void serial_send(char *data, int size)
 {
+	uint32_t head = transmit_head;
+	uint32_t index = head & TRANSMIT_BUFFER_MASK;
+	uint32_t first;
+
+	if ((uint32_t)size > TRANSMIT_BUFFER_SIZE - (head - transmit_tail)) {
+		dropped_bytes += size;
+		dropped_messages++;
+		mutex_unlock(&_send_lock);
+		return;
+	}
+	first = TRANSMIT_BUFFER_SIZE - index;
+	if (first > (uint32_t)size)
+		first = size;
+	memcpy(&transmit_buffer[index], data, first);
+	memcpy(transmit_buffer, data + first, size - first);
+	__dmb();
+	transmit_head = head + size;
+	mutex_unlock(&_send_lock);
+
+	if (!transmit_chunk)
+		nvic_set_pending_irq(NVIC_DMA1_CHANNEL2_IRQ);
+}
+
+/**
+ * @brief Get the number of bytes that can be sent without being dropped.
+ */
+uint32_t get_serial_transmit_space(void)
+{
+	return TRANSMIT_BUFFER_SIZE - (transmit_head - transmit_tail);
+}
+
+/**
+ * @brief Get the number of bytes dropped because the transmission buffer
+ * was full.
+ */
+uint32_t get_serial_dropped_bytes(void)
+{
+	return dropped_bytes;
+}
+
+/**
+ * @brief Get the number of messages dropped, either because the
+ * transmission buffer was full or because the transfer lock was taken.
+ */
+uint32_t get_serial_dropped_messages(void)
+{
+	return dropped_messages;
+}
+
+/**
+ * @brief Transmit the next chunk of the transmission buffer.
+ *
+ * DMA is configured to read, from the tail of the transmission buffer, all
+ * the pending bytes until the head or the end of the buffer. It then writes
+ * all those bytes to USART3 (Bluetooth).
+ *
+ * An interruption is generated when the transfer is complete.
+ */
+static void serial_transmit(void)
+{
+	uint32_t tail = transmit_tail;
+	uint32_t index = tail & TRANSMIT_BUFFER_MASK;
+	uint32_t size = transmit_head - tail;
+
+	if (size > TRANSMIT_BUFFER_SIZE - index)
+		size = TRANSMIT_BUFFER_SIZE - index;
+	transmit_chunk = size;
+	if (!size)
+		return;
+
 	dma_channel_reset(DMA1, DMA_CHANNEL2);
 
-	dma_set_peripheral_address(DMA1, DMA_CHANNEL2, (uint32_t)&USART3_DR);
-	dma_set_memory_address(DMA1, DMA_CHANNEL2, (uint32_t)data);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL2,
+				   (uint32_t)(uintptr_t)&USART3_DR);
+	dma_set_memory_address(DMA1, DMA_CHANNEL2,
+			       (uint32_t)(uintptr_t)&transmit_buffer[index]);
 	dma_set_number_of_data(DMA1, DMA_CHANNEL2, size);
 	dma_set_read_from_memory(DMA1, DMA_CHANNEL2);
 	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL2);
@@ -46,26 +160,31 @@ void serial_send(char *data, int size)
 }
 
 /**
- * @brief Receive data from serial.
+ * @brief Setup the serial reception DMA.
  *
- * DMA is configured to read from USART3 (Bluetooth) a number `size` of bytes.
- * It writes all those bytes to `data`.
+ * DMA is configured, in circular mode, to continuously read from USART3
+ * (Bluetooth) into the reception ring buffer.
  *
- * An interruption is generated when the transfer is complete.
+ * Interruptions are generated on half and complete transfer, so the ring is
+ * processed at least twice per lap even if the line never gets idle.
  */
-static void serial_receive(void)
+void setup_serial_receive_dma(void)
 {
 	dma_channel_reset(DMA1, DMA_CHANNEL3);
 
-	dma_set_peripheral_address(DMA1, DMA_CHANNEL3, (uint32_t)&USART3_DR);
-	dma_set_memory_address(DMA1, DMA_CHANNEL3, (uint32_t)receive_buffer);
-	dma_set_number_of_data(DMA1, DMA_CHANNEL3, RECEIVE_BUFFER_SIZE);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL3,
+				   (uint32_t)(uintptr_t)&USART3_DR);
+	dma_set_memory_address(DMA1, DMA_CHANNEL3,
+			       (uint32_t)(uintptr_t)receive_ring);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL3, RECEIVE_RING_SIZE);
 	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL3);
 	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL3);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL3);
 	dma_set_peripheral_size(DMA1, DMA_CHANNEL3, DMA_CCR_PSIZE_8BIT);
 	dma_set_memory_size(DMA1, DMA_CHANNEL3, DMA_CCR_MSIZE_8BIT);
 	dma_set_priority(DMA1, DMA_CHANNEL3, DMA_CCR_PL_HIGH);
 
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL3);
 	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL3);
 
 	dma_enable_channel(DMA1, DMA_CHANNEL3);
@@ -74,65 +193,116 @@ static void serial_receive(void)
 }
 
 /**
- * @brief DMA 1 channel 2 interruption routine.
+ * @brief Update the write count with the bytes written by DMA since the last
+ * call.
  *
- * Executed on serial transfer complete. Clears the interruption flag, and
- * disables serial transfer DMA until next call to `serial_send()`.
+ * The DMA position is deduced from the number of data register. As this is
+ * executed at least twice per lap (on half and complete transfer), the
+ * position can never advance more than a lap between calls.
+ */
+static void serial_receive(void)
+{
+	uint32_t position =
+	    RECEIVE_RING_SIZE - dma_get_number_of_data(DMA1, DMA_CHANNEL3);
+	uint32_t write = receive_write;
+
+	write += (position - write) % RECEIVE_RING_SIZE;
+	receive_write = write;
+}
+
+/**
+ * @brief DMA 1 channel 2 interruption routine.
  *
- * It will also release the serial transfer lock.
+ * Executed on serial transfer complete or when pended by `serial_send()`.
+ * On transfer complete, clears the interruption flag, disables serial
+ * transfer DMA and releases the transferred chunk from the transmission
+ * buffer. If DMA is idle, the next chunk is transmitted.
  */
 void dma1_channel2_isr(void)
 {
-	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL2, DMA_TCIF))
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL2, DMA_TCIF)) {
 		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL2, DMA_TCIF);
-
-	dma_disable_transfer_complete_interrupt(DMA1, DMA_CHANNEL2);
-	usart_disable_tx_dma(USART3);
-	dma_disable_channel(DMA1, DMA_CHANNEL2);
-	mutex_unlock(&_send_lock);
+		dma_disable_transfer_complete_interrupt(DMA1, DMA_CHANNEL2);
+		usart_disable_tx_dma(USART3);
+		dma_disable_channel(DMA1, DMA_CHANNEL2);
+		transmit_tail += transmit_chunk;
+		transmit_chunk = 0;
+	}
+	if (!transmit_chunk)
+		serial_transmit();
 }
 
 /**
  * @brief DMA 1 channel 3 interruption routine.
  *
- * Executed on serial receive complete. Clears the interruption flag, and
- * resets the receive DMA by calling `serial_receive()`.
- *
- * This function should never be reached. Commands should be processed before
- * on USART idle line interruption.
+ * Executed on serial receive half and complete transfer. Clears the
+ * interruption flags and updates the reception write count.
  **/
 void dma1_channel3_isr(void)
 {
-	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL3, DMA_TCIF))
-		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL3, DMA_TCIF);
-
-	dma_disable_transfer_complete_interrupt(DMA1, DMA_CHANNEL3);
-	usart_disable_rx_dma(USART3);
-	dma_disable_channel(DMA1, DMA_CHANNEL3);
-	LOG_ERROR("Receive buffer is full! Resetting...");
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL3, DMA_HTIF | DMA_TCIF))
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL3,
+					  DMA_HTIF | DMA_TCIF);
 	serial_receive();
 }
 
 /**
  * @brief USART interruption routine.
  *
- * On RX interruption it will process the data received and, in case it finds
- * a `'\0'` character, the `process_command` function will be executed.
+ * On idle line interruption it will update the reception write count.
  */
 void usart3_isr(void)
 {
 	/* Only execute on idle interrupt */
 	if (((USART_CR1(USART3) & USART_CR1_IDLEIE) != 0) &&
 	    usart_idle_line_detected(USART3)) {
-		received = true;
 		usart_clear_idle_line_detected(USART3);
 		serial_receive();
 	}
 }
 
+/**
+ * @brief Whether there is a received command pending to be processed.
+ *
+ * If there is none, the received bytes are extracted from the reception ring
+ * buffer until a command terminator (`'\0'`) is found, so back-to-back
+ * commands are processed one after another.
+ *
+ * If DMA overwrote bytes not yet read, those are lost and the command being
+ * received is discarded. Commands not fitting in `RECEIVE_BUFFER_SIZE` are
+ * discarded too.
+ */
 bool get_received_command_flag(void)
 {
-	return received;
+	uint32_t write = receive_write;
+	char byte;
+
+	if (received)
+		return true;
+	if (write - receive_read > RECEIVE_RING_SIZE) {
+		lost_bytes += write - receive_read - RECEIVE_RING_SIZE;
+		receive_read = write - RECEIVE_RING_SIZE;
+		receive_discarding = true;
+	}
+	while (receive_read != write) {
+		byte = receive_ring[receive_read++ % RECEIVE_RING_SIZE];
+		if (receive_length >= RECEIVE_BUFFER_SIZE) {
+			receive_length = 0;
+			receive_discarding = true;
+		}
+		if (!receive_discarding)
+			receive_buffer[receive_length++] = byte;
+		if (byte != '\0')
+			continue;
+		if (receive_discarding)
+			discarded_commands++;
+		received = !receive_discarding && receive_length > 1;
+		receive_discarding = false;
+		receive_length = 0;
+		if (received)
+			return true;
+	}
+	return false;
 }
 
 void set_received_command_flag(bool value)
@@ -144,3 +314,21 @@ char *get_received_serial_buffer(void)
 {
 	return receive_buffer;
 }
+
+/**
+ * @brief Get the number of received bytes overwritten by DMA before being
+ * read.
+ */
+uint32_t get_serial_lost_bytes(void)
+{
+	return lost_bytes;
+}
+
+/**
+ * @brief Get the number of received commands discarded because they did not
+ * fit in the command buffer or some of their bytes were lost.
+ */
+uint32_t get_serial_discarded_commands(void)
+{
+	return discarded_commands;
+}
@@ -1,6 +1,9 @@
 #ifndef __SERIAL_H
 #define __SERIAL_H
 
+#include <string.h>
+
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/sync.h>
 #include <libopencm3/stm32/usart.h>
 
@@ -9,10 +12,23 @@
 
 #define RECEIVE_BUFFER_SIZE 256
 
+/** Reception DMA ring buffer size, must be a power of two */
+#define RECEIVE_RING_SIZE 512
+
+/** Transmission buffer size, must be a power of two */
+#define TRANSMIT_BUFFER_SIZE 2048
+#define TRANSMIT_BUFFER_MASK (TRANSMIT_BUFFER_SIZE - 1)
+
 bool serial_acquire_transfer_lock(void);
 void serial_send(char *data, int size);
+uint32_t get_serial_transmit_space(void);
+uint32_t get_serial_dropped_bytes(void);
+uint32_t get_serial_dropped_messages(void);
+void setup_serial_receive_dma(void);
 bool get_received_command_flag(void);
 void set_received_command_flag(bool value);
 char *get_received_serial_buffer(void);
+uint32_t get_serial_lost_bytes(void);
+uint32_t get_serial_discarded_commands(void);
 
 #endif /* __SERIAL_H */
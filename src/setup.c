@@ -1,4 +1,7 @@
 #include "setup.h"
+#include "detection.h"
+#include "platform.h"
+#include "serial.h"
 
 /** Exception priorities */
 #define PRIORITY_FACTOR 16
@@ -65,17 +68,23 @@ static void setup_clock(void)
  * Exception priorities:
  *
  * - TIM1_UP with priority 0.
+ * - DMA 1 channel 1 with priority 0 with NVIC.
+ * - DMA 1 channel 4 with priority 0 with NVIC.
  * - Systick priority to 1 with SCB.
  * - DMA 1 channel 2 with priority 2 with NVIC.
  * - DMA 1 channel 3 with priority 2 with NVIC.
  * - USART3 with priority 2 with NVIC.
+ * - FLASH with priority 3 with NVIC.
  *
  * Interruptions enabled:
  *
  * - TIM1 Update interrupt.
+ * - DMA 1 channel 1 interrupt.
+ * - DMA 1 channel 4 interrupt.
  * - DMA 1 channel 2 interrupt.
  * - DMA 1 channel 3 interrupt.
  * - USART3 interrupt.
+ * - FLASH interrupt.
  *
  * @note The priority levels are assigned on steps of 16 because the processor
  * implements only bits[7:4].
@@ -85,15 +94,21 @@ static void setup_clock(void)
 static void setup_exceptions(void)
 {
 	nvic_set_priority(NVIC_TIM1_UP_IRQ, 0);
+	nvic_set_priority(NVIC_DMA1_CHANNEL1_IRQ, 0);
+	nvic_set_priority(NVIC_DMA1_CHANNEL4_IRQ, 0);
 	nvic_set_priority(NVIC_SYSTICK_IRQ, PRIORITY_FACTOR * 1);
 	nvic_set_priority(NVIC_DMA1_CHANNEL2_IRQ, PRIORITY_FACTOR * 2);
 	nvic_set_priority(NVIC_DMA1_CHANNEL3_IRQ, PRIORITY_FACTOR * 2);
 	nvic_set_priority(NVIC_USART3_IRQ, PRIORITY_FACTOR * 2);
+	nvic_set_priority(NVIC_FLASH_IRQ, PRIORITY_FACTOR * 3);
 
 	nvic_enable_irq(NVIC_TIM1_UP_IRQ);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
 	nvic_enable_irq(NVIC_DMA1_CHANNEL2_IRQ);
 	nvic_enable_irq(NVIC_DMA1_CHANNEL3_IRQ);
 	nvic_enable_irq(NVIC_USART3_IRQ);
+	nvic_enable_irq(NVIC_FLASH_IRQ);
 }
 
 /**
@@ -165,6 +180,8 @@ static void setup_gpio(void)
  *
  * A pull-up resistor is used in RX to avoid a floating input when no
  * bluetooth is connected, which could trigger incorrect interruptions.
+ *
+ * Reception DMA is started before enabling the USART so no byte is lost.
  */
 static void setup_usart(void)
 {
@@ -176,6 +193,7 @@ static void setup_usart(void)
 	usart_set_mode(USART3, USART_MODE_TX_RX);
 
 	usart_enable_idle_line_interrupt(USART3);
+	setup_serial_receive_dma();
 
 	usart_enable(USART3);
 }
@@ -235,11 +253,13 @@ void setup_spi_low_speed(void)
  * TIM3 is used to generate both PWM signals (left and right motor):
  *
  * - Edge-aligned, up-counting timer.
- * - Prescale to increment timer counter at 24 MHz.
- * - Set PWM frequency to 24 kHz.
+ * - No prescaling, to increment timer counter at `SYSCLK_FREQUENCY_HZ`.
+ * - Set PWM frequency to `DRIVER_PWM_FREQUENCY_HZ`.
  * - Configure channels 1, 2, 3 and 4 as output GPIOs.
  * - Set output compare mode to PWM1 (output is active when the counter is
  *   less than the compare register contents and inactive otherwise.
+ * - Enable output compare preload, so compare values are applied on update
+ *   events (see `begin_motor_update()`).
  * - Reset output compare value (set it to 0).
  * - Enable channels 1, 2, 3 and 4 outputs.
  * - Enable counter for TIM3.
@@ -252,16 +272,21 @@ static void setup_motor_driver(void)
 	timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE,
 		       TIM_CR1_DIR_UP);
 
-	timer_set_prescaler(TIM3, 3);
+	timer_set_prescaler(TIM3, 0);
 	timer_set_repetition_counter(TIM3, 0);
 	timer_enable_preload(TIM3);
 	timer_continuous_mode(TIM3);
-	timer_set_period(TIM3, DRIVER_PWM_PERIOD);
+	timer_set_period(TIM3,
+			 SYSCLK_FREQUENCY_HZ / DRIVER_PWM_FREQUENCY_HZ - 1);
 
 	timer_set_oc_mode(TIM3, TIM_OC1, TIM_OCM_PWM1);
 	timer_set_oc_mode(TIM3, TIM_OC2, TIM_OCM_PWM1);
 	timer_set_oc_mode(TIM3, TIM_OC3, TIM_OCM_PWM1);
 	timer_set_oc_mode(TIM3, TIM_OC4, TIM_OCM_PWM1);
+	timer_enable_oc_preload(TIM3, TIM_OC1);
+	timer_enable_oc_preload(TIM3, TIM_OC2);
+	timer_enable_oc_preload(TIM3, TIM_OC3);
+	timer_enable_oc_preload(TIM3, TIM_OC4);
 	timer_set_oc_value(TIM3, TIM_OC1, 0);
 	timer_set_oc_value(TIM3, TIM_OC2, 0);
 	timer_set_oc_value(TIM3, TIM_OC3, 0);
@@ -294,9 +319,10 @@ void setup_speaker(void)
 {
 	rcc_periph_reset_pulse(RST_TIM1);
 
-	/* Make sure to turn emitters off */
+	/* Make sure to turn emitters off and stop sensors acquisition */
 	gpio_clear(GPIOA, GPIO8 | GPIO9);
 	gpio_clear(GPIOB, GPIO8 | GPIO9);
+	adc_disable_external_trigger_regular(ADC1);
 
 	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE,
 		       TIM_CR1_DIR_UP);
@@ -438,37 +464,76 @@ static void setup_adc1(void)
 }
 
 /**
- * @brief Setup for ADC 2: configured for regular conversion.
+ * @brief Setup for ADC 1 on DMA acquisition mode: eight regular channels on
+ * discontinuous mode.
+ *
+ * - Each phototransistor is read twice in a row: first with the emitter off
+ *   and then with the emitter on. The order to read the sensors is the same
+ *   as in `setup_adc1()`.
+ * - Power off the ADC to be sure that does not run during configuration and
+ *   to restart the sequence.
+ * - Enable scan mode with discontinuous mode, converting one channel of the
+ *   sequence on each TIM1 compare 1 event.
+ * - Configure the alignment (right) and the sample time (13.5 cycles of ADC
+ *   clock).
+ * - Set regular sequence with `channel_sequence` structure.
+ * - Enable DMA requests after each conversion.
+ * - Start the ADC.
+ *
+ * @see Reference manual (RM0008) "Analog-to-digital converter" and in
+ * particular "Discontinuous mode" section.
+ */
+static void setup_adc1_dma(void)
+{
+	uint8_t channel_sequence[SENSORS_SWEEP_SLOTS] = {
+	    ADC_CHANNEL4, ADC_CHANNEL4, ADC_CHANNEL3, ADC_CHANNEL3,
+	    ADC_CHANNEL5, ADC_CHANNEL5, ADC_CHANNEL2, ADC_CHANNEL2};
+
+	adc_power_off(ADC1);
+	adc_enable_scan_mode(ADC1);
+	adc_set_single_conversion_mode(ADC1);
+	adc_enable_discontinuous_mode_regular(ADC1, 1);
+	adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_TIM1_CC1);
+	adc_set_right_aligned(ADC1);
+	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_13DOT5CYC);
+	adc_set_regular_sequence(ADC1, SENSORS_SWEEP_SLOTS, channel_sequence);
+	adc_enable_dma(ADC1);
+	start_adc(ADC1);
+}
+
+/**
+ * @brief Setup for ADC 2: configured for injected conversion.
  *
  * - Power off the ADC to be sure that does not run during configuration.
  * - Disable scan mode.
  * - Set single conversion mode triggered by software.
  * - Configure the alignment (right) and the sample time (13.5 cycles of ADC
  *   clock).
- * - Set regular sequence with `channel_sequence` structure.
+ * - Set injected sequence with `channel_sequence` structure.
  * - Start the ADC.
  *
- * @note This ADC reads the battery status.
+ * @note This ADC reads the battery status, sampled in the background (see
+ * `update_battery_voltage()`).
  *
  * @see Reference manual (RM0008) "Analog-to-digital converter".
  */
 static void setup_adc2(void)
 {
-	uint8_t channel_sequence[16];
+	uint8_t channel_sequence[4];
 
 	channel_sequence[0] = ADC_CHANNEL0;
 	adc_power_off(ADC2);
 	adc_disable_scan_mode(ADC2);
 	adc_set_single_conversion_mode(ADC2);
-	adc_disable_external_trigger_regular(ADC2);
+	adc_enable_external_trigger_injected(ADC2, ADC_CR2_JEXTSEL_JSWSTART);
 	adc_set_right_aligned(ADC2);
 	adc_set_sample_time_on_all_channels(ADC2, ADC_SMPR_SMP_13DOT5CYC);
-	adc_set_regular_sequence(ADC2, 1, channel_sequence);
+	adc_set_injected_sequence(ADC2, 1, channel_sequence);
 	start_adc(ADC2);
 }
 
 /**
- * @brief TIM1 setup.
+ * @brief TIM1 setup for the interruption acquisition mode.
  *
  * The TIM1 generates an update event interruption that invokes the
  * function tim1_up_isr.
@@ -489,7 +554,7 @@ static void setup_adc2(void)
  *
  * @see Reference manual (RM0008) "Advanced-control timers"
  */
-void setup_emitters(void)
+static void setup_emitters_interruption(void)
 {
 	rcc_periph_reset_pulse(RST_TIM1);
 
@@ -502,6 +567,66 @@ void setup_emitters(void)
 	timer_enable_irq(TIM1, TIM_DIER_UIE);
 }
 
+/**
+ * @brief TIM1 setup for the DMA acquisition mode.
+ *
+ * Each sensors sweep is divided in 8 slots: for each sensor, one with the
+ * emitter off and one with the emitter on. No interruptions are generated
+ * by TIM1:
+ *
+ * - Set TIM1 default values and setup ADC1 and the DMA channels.
+ * - Configure the base time (no clock division ratio, no aligned mode,
+ *   direction up).
+ * - Set clock division, prescaler and period parameters to get an update
+ *   event with a frequency of 8 KHz. 8 slots by ms, one sweep per ms.
+ * - Emitters are switched at the beginning of each slot, with DMA requests
+ *   on the update event (GPIOA emitters) and on the compare 3 event (GPIOB
+ *   emitters).
+ * - Set output compare 1 on PWM2 mode, so that the compare 1 event, which
+ *   triggers an ADC1 conversion, occurs in the middle of each slot. As in the
+ *   interruption acquisition mode, that leaves 62.5 us from the emitter
+ *   switching to the conversion.
+ * - Generate an update event to start the sweep on its first slot.
+ * - Enable the TIM1.
+ *
+ * @note Output compare 1 is not mapped to PA8, which is configured as a
+ * general purpose output.
+ *
+ * @see Reference manual (RM0008) "Advanced-control timers"
+ */
+static void setup_emitters_dma(void)
+{
+	rcc_periph_reset_pulse(RST_TIM1);
+	setup_adc1_dma();
+	setup_sensors_dma();
+
+	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE,
+		       TIM_CR1_DIR_UP);
+	timer_set_clock_division(TIM1, 0x00);
+	timer_set_prescaler(TIM1, (rcc_apb2_frequency / 160000 - 1));
+	timer_set_period(TIM1, 20 - 1);
+	timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_PWM2);
+	timer_set_oc_value(TIM1, TIM_OC1, 10);
+	timer_enable_oc_output(TIM1, TIM_OC1);
+	timer_set_oc_value(TIM1, TIM_OC3, 1);
+	timer_enable_irq(TIM1, TIM_DIER_UDE | TIM_DIER_CC3DE);
+	timer_generate_event(TIM1, TIM_EGR_UG);
+	timer_enable_counter(TIM1);
+}
+
+/**
+ * @brief Setup the emitters and sensors acquisition.
+ *
+ * @see `SENSORS_DMA_ACQUISITION`.
+ */
+void setup_emitters(void)
+{
+	if (SENSORS_DMA_ACQUISITION)
+		setup_emitters_dma();
+	else
+		setup_emitters_interruption();
+}
+
 /**
  * @brief Execute all setup functions.
  */
@@ -516,7 +641,8 @@ void setup(void)
 	setup_encoders();
 	setup_motor_driver();
 	setup_mpu();
+	setup_mpu_fifo();
+	setup_mpu_burst_read();
 	setup_systick();
 	setup_emitters();
-	setup_adc1();
 }
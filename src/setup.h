@@ -49,9 +49,59 @@
 /** System clock frequency is set in `setup_clock` */
 #define SYSCLK_FREQUENCY_HZ 72000000
 #define SPEAKER_BASE_FREQUENCY_HZ 1000000
-#define SYSTICK_FREQUENCY_HZ 1000
 #define DRIVER_PWM_PERIOD 1024
 
+/**
+ * Motor driver PWM frequency.
+ *
+ * TIM3 is clocked at `SYSCLK_FREQUENCY_HZ`, so the period is adjusted to the
+ * frequency (see `set_motor_pwm_frequency()`), while the power resolution is
+ * kept at `DRIVER_PWM_PERIOD` steps. Higher frequencies move the switching
+ * noise out of the audible range at the cost of switching losses.
+ */
+#define DRIVER_PWM_FREQUENCY_HZ 20000
+
+#if SYSCLK_FREQUENCY_HZ / DRIVER_PWM_FREQUENCY_HZ - 1 < DRIVER_PWM_PERIOD
+#error "DRIVER_PWM_FREQUENCY_HZ too high for DRIVER_PWM_PERIOD resolution"
+#endif
+
+/**
+ * SysTick handler scheduling.
+ *
+ * The SysTick frequency is the rate of the fast stages: gyroscope and encoders
+ * readings and motor control. The clock, the distance processing, the
+ * battery sampling and the logging are decimated to their own (lower) rates,
+ * which must divide the SysTick frequency. The clock must always tick every
+ * millisecond and the sensors are swept at a fixed rate too, regardless of
+ * the SysTick frequency.
+ */
+#define SYSTICK_FREQUENCY_HZ 2000
+#define CLOCK_FREQUENCY_HZ 1000
+#define SENSORS_SWEEP_FREQUENCY_HZ 1000
+#define DISTANCE_FREQUENCY_HZ 1000
+#define LOG_FREQUENCY_HZ 1000
+#define BATTERY_FREQUENCY_HZ 100
+
+/**
+ * Maze checkpoints.
+ *
+ * While exploring, the maze is saved from the SysTick handler at this rate,
+ * so a crash does not lose the whole exploration. Checkpoints only append the
+ * changed cells to the maze store (see `maze_store_set_checkpoint()`); each
+ * flash half-word write stalls flash reads for about 50 us.
+ */
+#define MAZE_CHECKPOINT_FREQUENCY_HZ 1
+
+/**
+ * Sensors acquisition mode.
+ *
+ * When set to `1`, TIM1 switches the emitters and triggers the ADC
+ * conversions, which are transferred with DMA, so only one interruption is
+ * generated per sensors sweep. When set to `0`, the sensors are read from the
+ * TIM1 update interruption instead.
+ */
+#define SENSORS_DMA_ACQUISITION 1
+
 /**
  * Maximum PWM period (should be <= DRIVER_PWM_PERIOD).
  *
@@ -70,6 +120,50 @@
  */
 #define MAX_MOTOR_DRIVER_SATURATION_PERIOD 0.01
 
+/**
+ * Collision detection.
+ *
+ * Each condition is evaluated on every SysTick period while the motors are
+ * driven, and a collision is detected when it is met on at least the given
+ * ratio of the periods within its sliding window (in seconds):
+ *
+ * - Motor driver saturation.
+ * - Linear speed error: ideal speed minus speed measured with the encoders.
+ * - Gyroscope anomaly: angular speed error (ideal minus measured) or angular
+ *   acceleration above the limits.
+ */
+#define COLLISION_SATURATION_WINDOW MAX_MOTOR_DRIVER_SATURATION_PERIOD
+#define COLLISION_SATURATION_RATIO 1.
+#define COLLISION_LINEAR_ERROR 0.5
+#define COLLISION_LINEAR_WINDOW 0.05
+#define COLLISION_LINEAR_RATIO 0.8
+#define COLLISION_ANGULAR_ERROR 4.
+#define COLLISION_ANGULAR_ACCELERATION 500.
+#define COLLISION_ANGULAR_WINDOW 0.02
+#define COLLISION_ANGULAR_RATIO 0.5
+
+/**
+ * RAM capture.
+ *
+ * Raw peripheral values are recorded every `CAPTURE_DECIMATION` SysTick
+ * periods into a ring of `CAPTURE_RECORDS` records (18 bytes each, so mind
+ * the RAM). By default, the ring holds the last 512 ms. Once triggered,
+ * `CAPTURE_POST_TRIGGER` more records are taken before the buffer is frozen,
+ * so the rest of the ring keeps the records that led to the trigger.
+ */
+#define CAPTURE_RECORDS 128
+#define CAPTURE_DECIMATION 8
+#define CAPTURE_POST_TRIGGER (CAPTURE_RECORDS / 2)
+
+/**
+ * Replay recording.
+ *
+ * When set to `1`, the control loop inputs and outputs are recorded while
+ * moving (see `replay.h`) instead of logging the control variables, so the
+ * run can be replayed on the host with `src/host/build/replay`.
+ */
+#define REPLAY_RECORDING 0
+
 /**
  * Maximum number of movements in a smoothed path.
  */
@@ -86,21 +180,42 @@
 #define VOLT_DIV_FACTOR 2
 #define BATTERY_LOW_LIMIT_VOLTAGE 3.3
 
+/** Battery voltage low-pass filter factor (about 0.2 s at 100 Hz) */
+#define BATTERY_FILTER_FACTOR 0.05
+
+/**
+ * Motor driver supply.
+ *
+ * When set to `1`, the motor driver is supplied directly from the battery and
+ * the measured battery voltage is used to convert the motor voltages to PWM
+ * outputs. When set to `0`, it is supplied from a regulated DC-DC converter
+ * at `MOTOR_DRIVER_INPUT_VOLTAGE`, as in Bulebule, so the compensation is
+ * disabled by default.
+ */
+#define MOTOR_DRIVER_BATTERY_SUPPLY 0
+
 /**
  * Flash module organization.
  *
  * The memory organization is based on a main memory block containing 64 pages
  * of 1 Kbyte (for medium-density devices), and an information block.
  *
- * The linker file was modified to reserve the last memory page for EEPROM.
+ * The linker file was modified to reserve the last 4 memory pages for EEPROM.
  * FLASH_EEPROM_ADDRESS = FLASH_BASE + FLASH_EEPROM_PAGE_NUM * FLASH_PAGE_SIZE
  * FLASH_BASE = 0x08000000
- * FLASH_EEPROM_PAGE_NUM = 63
+ * FLASH_EEPROM_PAGE_NUM = 60
  * FLASH_PAGE_SIZE = 0x400 (1 Kbyte)
  *
+ * The maze is stored in a journal over the first `FLASH_EEPROM_MAZE_PAGES`
+ * pages (see `maze_store_save()`) and the tuning profiles in the last page
+ * (see `tuning_save()`).
+ *
  * @see Programming manual (PM0075) "Flash module organization"
  */
-#define FLASH_EEPROM_ADDRESS_MAZE ((uint32_t)(0x0800fc00))
+#define FLASH_EEPROM_PAGE_SIZE 0x400
+#define FLASH_EEPROM_ADDRESS_MAZE ((uint32_t)(0x0800f000))
+#define FLASH_EEPROM_MAZE_PAGES 3
+#define FLASH_EEPROM_ADDRESS_TUNING ((uint32_t)(0x0800fc00))
 
 void setup(void);
 void setup_emitters(void);
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+#include "telemetry.h"
+
+/** Frame buffer, only used with interruptions disabled */
+static uint8_t frame[TELEMETRY_MAX_FRAME_SIZE];
+static uint16_t sequence;
+
+/**
+ * @brief Scale a value by 1000 and saturate it to the `int16_t` range.
+ *
+ * @param[in] value Value to scale (i.e.: meters per second).
+ */
+static int16_t saturate_milli(float value)
+{
+	value *= 1000;
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)value;
+}
+
+/**
+ * @brief Send a telemetry record through serial with a given timestamp.
+ *
+ * The frame is built and sent only if the serial transfer lock is acquired.
+ * The sequence number is incremented on every call anyway, so the receiver
+ * can account for dropped frames.
+ *
+ * Records are sent both from thread mode and from the interruptions, so the
+ * sequence number is taken and the frame is queued with interruptions
+ * disabled. That way, frames are always queued in sequence order.
+ *
+ * @param[in] type Record type.
+ * @param[in] record Record to send.
+ * @param[in] size Size (number of bytes) of the record.
+ * @param[in] timestamp Time at which the record was taken, in clock ticks.
+ */
+void telemetry_send_at(enum telemetry_record type, const void *record,
+		       uint8_t size, uint32_t timestamp)
+{
+	struct telemetry_header header = {
+	    .sync = {TELEMETRY_SYNC_0, TELEMETRY_SYNC_1},
+	    .type = type,
+	    .size = size,
+	    .timestamp = timestamp,
+	};
+	uint32_t length = sizeof(header);
+	uint16_t crc;
+
+	if (size > TELEMETRY_MAX_RECORD_SIZE)
+		return;
+	cm_disable_interrupts();
+	header.sequence = sequence++;
+	if (!serial_acquire_transfer_lock()) {
+		cm_enable_interrupts();
+		return;
+	}
+	memcpy(frame, &header, sizeof(header));
+	memcpy(&frame[length], record, size);
+	length += size;
+	crc = crc16(CRC16_INIT, &frame[sizeof(header.sync)],
+		    length - sizeof(header.sync));
+	frame[length++] = crc & 0xFF;
+	frame[length++] = crc >> 8;
+	serial_send((char *)frame, length);
+	cm_enable_interrupts();
+}
+
+/**
+ * @brief Send a telemetry record through serial, timestamped now.
+ *
+ * See `telemetry_send_at()`.
+ */
+void telemetry_send(enum telemetry_record type, const void *record,
+		    uint8_t size)
+{
+	telemetry_send_at(type, record, size, get_clock_ticks());
+}
+
+/**
+ * @brief Log the control variables as a binary telemetry record.
+ *
+ * Meant to be used as data logging function (see `start_data_logging()`).
+ */
+void log_telemetry_control(void)
+{
+	struct telemetry_control record = {
+	    .target_linear_speed = saturate_milli(get_target_linear_speed()),
+	    .ideal_linear_speed = saturate_milli(get_ideal_linear_speed()),
+	    .left_speed = saturate_milli(get_encoder_left_speed()),
+	    .right_speed = saturate_milli(get_encoder_right_speed()),
+	    .ideal_angular_speed = saturate_milli(get_ideal_angular_speed()),
+	    .angular_speed = saturate_milli(get_measured_angular_speed()),
+	    .pwm_left = get_left_pwm(),
+	    .pwm_right = get_right_pwm(),
+	    .voltage_left = saturate_milli(get_left_motor_voltage()),
+	    .voltage_right = saturate_milli(get_right_motor_voltage()),
+	};
+
+	telemetry_send(TELEMETRY_CONTROL, &record, sizeof(record));
+}
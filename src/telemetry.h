@@ -0,0 +1,88 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mmlib/clock.h"
+#include "mmlib/control.h"
+#include "mmlib/encoder.h"
+#include "mmlib/logging.h"
+#include "mmlib/speed.h"
+
+#include "crc.h"
+#include "detection.h"
+#include "serial.h"
+
+/**
+ * Telemetry frames.
+ *
+ * Each frame is made of a header, a fixed-layout record and the CRC of both
+ * (excluding the synchronization bytes), all of them little-endian. The
+ * first synchronization byte is not a valid ASCII character, so frames can
+ * be told apart from text log messages.
+ */
+#define TELEMETRY_SYNC_0 0xA5
+#define TELEMETRY_SYNC_1 0x5A
+#define TELEMETRY_MAX_RECORD_SIZE 64
+#define TELEMETRY_MAX_FRAME_SIZE                                               \
+	(sizeof(struct telemetry_header) + TELEMETRY_MAX_RECORD_SIZE +         \
+	 sizeof(uint16_t))
+
+enum telemetry_record {
+	TELEMETRY_CONTROL = 1,
+	TELEMETRY_CAPTURE = 2,
+	TELEMETRY_REPLAY = 3,
+};
+
+struct __attribute__((packed)) telemetry_header {
+	uint8_t sync[2];
+	uint8_t type;
+	uint8_t size;
+	uint16_t sequence;
+	uint32_t timestamp;
+};
+
+/**
+ * Control record.
+ *
+ * Speeds are in millimeters (or milliradians) per second, PWM values are in
+ * driver PWM counts and voltages are in millivolts.
+ */
+struct __attribute__((packed)) telemetry_control {
+	int16_t target_linear_speed;
+	int16_t ideal_linear_speed;
+	int16_t left_speed;
+	int16_t right_speed;
+	int16_t ideal_angular_speed;
+	int16_t angular_speed;
+	int16_t pwm_left;
+	int16_t pwm_right;
+	int16_t voltage_left;
+	int16_t voltage_right;
+};
+
+/**
+ * Capture record.
+ *
+ * Raw peripheral values: encoder counters, gyroscope Z-axis register and
+ * sensors readings (with emitters on minus with emitters off, which is what
+ * distances are computed from). Powers are the values commanded to the
+ * motors, in driver PWM counts.
+ */
+struct __attribute__((packed)) telemetry_capture {
+	uint16_t encoder_left;
+	uint16_t encoder_right;
+	int16_t gyro_z;
+	int16_t sensors[NUM_SENSOR];
+	int16_t power_left;
+	int16_t power_right;
+};
+
+void telemetry_send_at(enum telemetry_record type, const void *record,
+		       uint8_t size, uint32_t timestamp);
+void telemetry_send(enum telemetry_record type, const void *record,
+		    uint8_t size);
+void log_telemetry_control(void);
+
+#endif /* __TELEMETRY_H */
@@ -0,0 +1,267 @@
+#include "tuning.h"
+
+#define TUNING_MAGIC 0x4E55542B
+
+/**
+ * Tuning flash page contents.
+ */
+struct tuning_page {
+	uint32_t magic;
+	uint32_t selected;
+	struct tuning_profile profiles[TUNING_PROFILES];
+	uint16_t crc;
+	uint16_t padding;
+};
+
+/* RAM copy of the flash page, also used as the asynchronous write buffer */
+static struct tuning_page stored;
+static uint32_t write_ticket;
+static uint32_t saved_selection;
+
+/**
+ * @brief Compute the CRC of a tuning page contents.
+ */
+static uint16_t page_crc(const struct tuning_page *page)
+{
+	return crc16(CRC16_INIT, page, offsetof(struct tuning_page, crc));
+}
+
+/**
+ * @brief Fill a profile with the live configuration.
+ */
+static void get_live_profile(struct tuning_profile *profile)
+{
+	profile->control = get_control_constants();
+	profile->micrometers_per_count = get_micrometers_per_count();
+	profile->linear_speed_limit = get_linear_speed_limit();
+}
+
+/**
+ * @brief Apply a profile to the live configuration.
+ *
+ * The whole profile is published at once, so the control loop never runs
+ * with a mix of the previous and the new profile.
+ */
+static void apply(const struct tuning_profile *profile)
+{
+	struct config *update = begin_config_update();
+
+	update->control = profile->control;
+	update->micrometers_per_count = profile->micrometers_per_count;
+	update->linear_speed_limit = profile->linear_speed_limit;
+	commit_config_update(update);
+}
+
+/**
+ * @brief Wait for the previous write of the page to complete.
+ *
+ * The RAM copy of the page must not be modified before that.
+ */
+static void wait_write(void)
+{
+	if (!write_ticket)
+		return;
+	while (eeprom_get_write_status(write_ticket) == EEPROM_WRITE_PENDING)
+		;
+}
+
+/**
+ * @brief Queue the write of the RAM copy of the page to flash.
+ */
+static void write(void)
+{
+	stored.magic = TUNING_MAGIC;
+	stored.crc = page_crc(&stored);
+	do {
+		write_ticket = eeprom_flash_page_async(
+		    FLASH_EEPROM_ADDRESS_TUNING, (const uint8_t *)&stored,
+		    sizeof(stored));
+	} while (!write_ticket);
+	saved_selection = stored.selected;
+}
+
+/**
+ * @brief Load the tuning profiles from flash and apply the selected one.
+ *
+ * If there are no valid profiles stored, they are all initialized with the
+ * compile-time defaults (the live configuration) and the first one is
+ * selected. Nothing is written to flash until a profile is saved.
+ */
+void tuning_load(void)
+{
+	uint8_t i;
+
+	eeprom_read_data(FLASH_EEPROM_ADDRESS_TUNING, sizeof(stored),
+			 (uint8_t *)&stored);
+	if (stored.magic == TUNING_MAGIC && stored.crc == page_crc(&stored) &&
+	    stored.selected < TUNING_PROFILES) {
+		apply(&stored.profiles[stored.selected]);
+		saved_selection = stored.selected;
+		return;
+	}
+	memset(&stored, 0, sizeof(stored));
+	for (i = 0; i < TUNING_PROFILES; i++) {
+		strcpy(stored.profiles[i].name, "default");
+		get_live_profile(&stored.profiles[i]);
+	}
+	saved_selection = stored.selected;
+}
+
+/**
+ * @brief Get the index of the selected tuning profile.
+ */
+uint8_t tuning_get_selected(void)
+{
+	return stored.selected;
+}
+
+/**
+ * @brief Select a tuning profile, applying it to the live configuration.
+ *
+ * The selection is only changed in RAM, so cycling through the profiles does
+ * not wear the flash. It is saved with `tuning_save_selection()`.
+ *
+ * @param[in] index Profile index.
+ */
+void tuning_select(uint8_t index)
+{
+	if (index >= TUNING_PROFILES)
+		return;
+	wait_write();
+	stored.selected = index;
+	apply(&stored.profiles[index]);
+}
+
+/**
+ * @brief Save the selected tuning profile to flash, if it changed.
+ *
+ * The profile is then applied again on the next start-up. The page write is
+ * asynchronous, but the flash is stalled while the page is erased, so this
+ * must not be called while moving.
+ */
+void tuning_save_selection(void)
+{
+	if (stored.selected == saved_selection)
+		return;
+	wait_write();
+	write();
+}
+
+/**
+ * @brief Select the next tuning profile (wrapping around).
+ */
+void tuning_select_next(void)
+{
+	tuning_select((stored.selected + 1) % TUNING_PROFILES);
+}
+
+/**
+ * @brief Save the live configuration as a tuning profile.
+ *
+ * The profile is also selected.
+ *
+ * @param[in] index Profile index.
+ * @param[in] name Profile name, truncated to `TUNING_NAME_SIZE - 1`
+ * characters.
+ */
+void tuning_save(uint8_t index, const char *name)
+{
+	struct tuning_profile *profile;
+
+	if (index >= TUNING_PROFILES)
+		return;
+	wait_write();
+	profile = &stored.profiles[index];
+	get_live_profile(profile);
+	strncpy(profile->name, name, TUNING_NAME_SIZE - 1);
+	profile->name[TUNING_NAME_SIZE - 1] = '\0';
+	stored.selected = index;
+	write();
+}
+
+/**
+ * @brief Log the tuning profiles.
+ *
+ * One line per profile, with the index, the name, whether it is selected and
+ * then the control constants, micrometers per count and linear speed limit.
+ */
+void log_tuning(void)
+{
+	const struct tuning_profile *profile;
+	uint8_t i;
+
+	for (i = 0; i < TUNING_PROFILES; i++) {
+		profile = &stored.profiles[i];
+		LOG_INFO("%u,%s,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+			 "%.3f,%.3f,%.3f,%.3f",
+			 i, profile->name, i == stored.selected,
+			 profile->control.kp_linear, profile->control.kd_linear,
+			 profile->control.kp_angular,
+			 profile->control.kd_angular,
+			 profile->control.kp_angular_front,
+			 profile->control.ki_angular_front,
+			 profile->control.kp_angular_side,
+			 profile->control.ki_angular_side,
+			 profile->control.kp_angular_diagonal,
+			 profile->control.ki_angular_diagonal,
+			 profile->micrometers_per_count,
+			 profile->linear_speed_limit);
+	}
+}
+
+/**
+ * @brief Parse a profile index at the beginning of a string.
+ *
+ * @param[in] text String to parse.
+ * @param[out] end Pointer to the character after the index.
+ * @return Profile index, or `TUNING_PROFILES` if it is not valid.
+ */
+static uint8_t parse_index(const char *text, char **end)
+{
+	long index = strtol(text, end, 10);
+
+	if (*end == text || index < 0 || index >= TUNING_PROFILES)
+		return TUNING_PROFILES;
+	return (uint8_t)index;
+}
+
+/**
+ * @brief Execute the received command if it is a tuning command.
+ *
+ * - `tuning`: log the tuning profiles.
+ * - `tuning_select INDEX`: select a profile.
+ * - `tuning_save INDEX NAME`: save the live configuration as a profile.
+ *
+ * Other commands are left for `execute_command()`.
+ *
+ * @return Whether a tuning command was executed.
+ */
+bool execute_tuning_command(void)
+{
+	char *command;
+	char *end;
+	uint8_t index;
+
+	if (!get_received_command_flag())
+		return false;
+	command = get_received_serial_buffer();
+	if (!strcmp(command, "tuning")) {
+		log_tuning();
+	} else if (!strncmp(command, "tuning_select ", 14)) {
+		index = parse_index(command + 14, &end);
+		if (index < TUNING_PROFILES)
+			tuning_select(index);
+		else
+			LOG_ERROR("Invalid tuning profile");
+	} else if (!strncmp(command, "tuning_save ", 12)) {
+		index = parse_index(command + 12, &end);
+		if (index < TUNING_PROFILES && *end == ' ' && end[1])
+			tuning_save(index, end + 1);
+		else
+			LOG_ERROR("Invalid tuning profile");
+	} else {
+		return false;
+	}
+	set_received_command_flag(false);
+	return true;
+}
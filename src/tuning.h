@@ -0,0 +1,41 @@
+#ifndef __TUNING_H
+#define __TUNING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmlib/hmi.h"
+#include "mmlib/logging.h"
+
+#include "config.h"
+#include "crc.h"
+#include "eeprom.h"
+#include "serial.h"
+#include "setup.h"
+
+/** Number of tuning profiles stored in flash */
+#define TUNING_PROFILES 4
+
+/** Maximum length of a profile name, including the terminating '\0' */
+#define TUNING_NAME_SIZE 12
+
+struct tuning_profile {
+	char name[TUNING_NAME_SIZE];
+	struct control_constants control;
+	float micrometers_per_count;
+	float linear_speed_limit;
+};
+
+void tuning_load(void);
+uint8_t tuning_get_selected(void);
+void tuning_select(uint8_t index);
+void tuning_select_next(void);
+void tuning_save_selection(void);
+void tuning_save(uint8_t index, const char *name);
+void log_tuning(void);
+bool execute_tuning_command(void);
+
+#endif /* __TUNING_H */
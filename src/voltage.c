@@ -1,13 +1,50 @@
 #include "voltage.h"
 
+static volatile float battery_voltage;
+static bool sampling;
+
 /**
- * @brief Function to get battery voltage.
+ * @brief Convert ADC bits to battery voltage.
+ *
+ * The battery voltage is read through a voltage divider.
+ */
+static float battery_bits_to_voltage(uint16_t battery_bits)
+{
+	return battery_bits * ADC_LSB * VOLT_DIV_FACTOR;
+}
+
+/**
+ * @brief Sample the battery voltage in the background.
  *
- * This function reads the voltage of the battery from the register configured
- * on the ADC2.
+ * ADC2 injected conversions are started by software and read on the next
+ * call, one `BATTERY_FREQUENCY_HZ` period later, so it never waits for the
+ * ADC. The samples are low-pass filtered with `BATTERY_FILTER_FACTOR`.
  *
- * The value is converted from bits to voltage taking into account that the
- * battery voltage is read through a voltage divider.
+ * Must be called at `BATTERY_FREQUENCY_HZ`, from the SysTick handler.
+ */
+void update_battery_voltage(void)
+{
+	float voltage;
+
+	if (sampling) {
+		voltage = battery_bits_to_voltage(adc_read_injected(ADC2, 1));
+		if (battery_voltage > 0.)
+			voltage = battery_voltage +
+				  BATTERY_FILTER_FACTOR *
+				      (voltage - battery_voltage);
+		battery_voltage = voltage;
+	}
+	adc_start_conversion_injected(ADC2);
+	sampling = true;
+}
+
+/**
+ * @brief Function to get battery voltage.
+ *
+ * The voltage is sampled in the background (see `update_battery_voltage()`)
+ * and filtered. Before the first sample, it is read from ADC2 waiting for the
+ * conversion to complete, with interruptions disabled so the SysTick handler
+ * does not start or read a conversion meanwhile.
  *
  *@return The battery voltage in volts.
  */
@@ -15,21 +52,32 @@ float get_battery_voltage(void)
 {
 	uint16_t battery_bits;
 
-	adc_start_conversion_direct(ADC2);
-	while (!adc_eoc(ADC2))
+	if (battery_voltage > 0.)
+		return battery_voltage;
+	cm_disable_interrupts();
+	ADC_SR(ADC2) &= ~ADC_SR_JEOC;
+	adc_start_conversion_injected(ADC2);
+	while (!adc_eoc_injected(ADC2))
 		;
-	battery_bits = adc_read_regular(ADC2);
-	return battery_bits * ADC_LSB * VOLT_DIV_FACTOR;
+	battery_bits = adc_read_injected(ADC2, 1);
+	cm_enable_interrupts();
+	return battery_bits_to_voltage(battery_bits);
 }
 
 /**
  * @brief Function to get motor driver input voltage.
  *
- * In Bulebule, we assume the motor driver input voltage is constant.
+ * When the motor driver is supplied from the battery (see
+ * `MOTOR_DRIVER_BATTERY_SUPPLY`), its input voltage is the filtered battery
+ * voltage, so the PWM outputs compensate for the battery discharge. In
+ * Bulebule, the motor driver is supplied from a DC-DC converter, so the
+ * input voltage is constant.
  *
  *@return The motor driver input voltage in volts.
  */
 float get_motor_driver_input_voltage(void)
 {
+	if (MOTOR_DRIVER_BATTERY_SUPPLY)
+		return get_battery_voltage();
 	return MOTOR_DRIVER_INPUT_VOLTAGE;
 }
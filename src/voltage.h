@@ -1,10 +1,12 @@
 #ifndef __VOLTAGE_H
 #define __VOLTAGE_H
 
+#include <libopencm3/cm3/cortex.h>
 #include <libopencm3/stm32/adc.h>
 
 #include "setup.h"
 
+void update_battery_voltage(void);
 float get_battery_voltage(void);
 float get_motor_driver_input_voltage(void);
 